@@ -30,29 +30,42 @@
  
 %typemap(in) (unsigned char * data, int len)
 %{
-    lua_getfield(L, -1, "len");
-    lua_pushvalue(L, -2);
-    lua_call(L, 1, 1);
-    $2 = lua_tonumber(L,-1);
-    lua_pop(L, 1);
+    // Wireshark 1.11.3 and newer can return the bytes directly as a Lua string
+    lua_getfield(L, $input, "raw");
     
-    if (!$2) SWIG_fail;
-    
-    $1 = new unsigned char[$2];
-    
-    if (!$1) SWIG_fail;
-    
-    for (int i=0; i<$2; i++) {
-        lua_getfield(L, -1, "get_index");
-        lua_pushvalue(L, -2);
-        lua_pushinteger(L, i);
-        lua_call(L, 2, 1);
-        $1[i] = (unsigned char)lua_tonumber(L,-1);
+    if (!lua_isnil(L, -1)) {
+        lua_pushvalue(L, $input);
+        lua_call(L, 1, 1);
+    }
+    else {
+        lua_pop(L, 1);
+        
+        lua_getfield(L, $input, "len");
+        lua_pushvalue(L, $input);
+        lua_call(L, 1, 1);
+        int byte_count = lua_tonumber(L, -1);
         lua_pop(L, 1);
+        
+        luaL_Buffer buffer;
+        luaL_buffinit(L, &buffer);
+        
+        for (int i=0; i<byte_count; i++) {
+            lua_getfield(L, $input, "get_index");
+            lua_pushvalue(L, $input);
+            lua_pushinteger(L, i);
+            lua_call(L, 2, 1);
+            unsigned char byte = (unsigned char)lua_tonumber(L, -1);
+            lua_pop(L, 1);
+            luaL_addchar(&buffer, byte);
+        }
+        
+        luaL_pushresult(&buffer);
     }
+    
+    // The string is left on the stack, which keeps the bytes alive during the call
+    size_t raw_len;
+    $1 = (unsigned char *)lua_tolstring(L, -1, &raw_len);
+    $2 = raw_len;
+    
+    if (!$2) SWIG_fail;
 %}
-
-%typemap(freearg) (unsigned char * data, int len)
-%{
-    delete [] $1;
-%}
\ No newline at end of file
@@ -0,0 +1,369 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+#include "capture_reader.h"
+
+#include <stdexcept>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_FILE_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_SECTION_HEADER_BLOCK 0x0a0d0d0a
+#define PCAPNG_INTERFACE_DESCRIPTION_BLOCK 1
+#define PCAPNG_PACKET_BLOCK 2
+#define PCAPNG_SIMPLE_PACKET_BLOCK 3
+#define PCAPNG_ENHANCED_PACKET_BLOCK 6
+#define PCAPNG_OPTION_END 0
+#define PCAPNG_OPTION_IF_TSRESOL 9
+#define PCAPNG_DEFAULT_TICKS_PER_SECOND 1000000
+
+static inline uint32_t Swap32(uint32_t x)
+{
+    return __builtin_bswap32(x);
+}
+
+static inline size_t Padded32(size_t length)
+{
+    return (length + 3) & ~(size_t)3;
+}
+
+CaptureReader::CaptureReader(const char * filename) :
+    m_filename(filename),
+    m_data(NULL),
+    m_size(0),
+    m_offset(0),
+    m_pcapng(false),
+    m_swapped(false),
+    m_link_type(LINKTYPE_ETHERNET),
+    m_ns_per_tick(1000)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        throw runtime_error("Cannot open capture file " + m_filename + "!");
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw runtime_error("Cannot read capture file " + m_filename + "!");
+    }
+    
+    m_size = st.st_size;
+    
+    if (m_size > 0)
+    {
+        void * mapped = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            close(fd);
+            throw runtime_error("Cannot map capture file " + m_filename + "!");
+        }
+        
+        m_data = (const uint8_t *)mapped;
+        madvise(mapped, m_size, MADV_SEQUENTIAL);
+    }
+    
+    close(fd);
+    
+    try
+    {
+        ReadFileHeader();
+    }
+    catch (...)
+    {
+        if (m_data)
+        {
+            munmap((void *)m_data, m_size);
+        }
+        
+        throw;
+    }
+}
+
+void CaptureReader::ReadFileHeader()
+{
+    if (m_size < 4)
+    {
+        throw runtime_error("Capture file " + m_filename + " is too short!");
+    }
+    
+    uint32_t magic;
+    memcpy(&magic, m_data, 4);
+    
+    if (magic == PCAPNG_SECTION_HEADER_BLOCK)
+    {
+        // The byte order is set by each section header block
+        m_pcapng = true;
+        return;
+    }
+    
+    if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS)
+    {
+        m_swapped = false;
+    }
+    else if (Swap32(magic) == PCAP_MAGIC_US || Swap32(magic) == PCAP_MAGIC_NS)
+    {
+        m_swapped = true;
+        magic = Swap32(magic);
+    }
+    else
+    {
+        throw runtime_error(m_filename + " is not a pcap or pcapng file!");
+    }
+    
+    if (m_size < PCAP_FILE_HEADER_SIZE)
+    {
+        throw runtime_error("Capture file " + m_filename + " is too short!");
+    }
+    
+    m_ns_per_tick = (magic == PCAP_MAGIC_NS) ? 1 : 1000;
+    m_link_type = Read32(m_data + 20) & 0xffff;
+    m_offset = PCAP_FILE_HEADER_SIZE;
+}
+
+CaptureReader::~CaptureReader()
+{
+    if (m_data)
+    {
+        munmap((void *)m_data, m_size);
+    }
+}
+
+bool CaptureReader::NextPacket(CapturedPacket& packet)
+{
+    return m_pcapng ? NextPcapngPacket(packet) : NextPcapPacket(packet);
+}
+
+bool CaptureReader::NextPcapPacket(CapturedPacket& packet)
+{
+    if (m_offset + PCAP_RECORD_HEADER_SIZE > m_size)
+    {
+        // A truncated final record is ignored, as left by an interrupted capture
+        return false;
+    }
+    
+    const uint8_t * header = m_data + m_offset;
+    uint32_t captured_length = Read32(header + 8);
+    
+    if (m_offset + PCAP_RECORD_HEADER_SIZE + captured_length > m_size)
+    {
+        return false;
+    }
+    
+    packet.time_ns = (int64_t)Read32(header) * 1000000000 + (int64_t)Read32(header + 4) * m_ns_per_tick;
+    packet.link_type = m_link_type;
+    packet.data = header + PCAP_RECORD_HEADER_SIZE;
+    packet.length = captured_length;
+    
+    m_offset += PCAP_RECORD_HEADER_SIZE + captured_length;
+    return true;
+}
+
+bool CaptureReader::NextPcapngPacket(CapturedPacket& packet)
+{
+    while (m_offset + 12 <= m_size)
+    {
+        const uint8_t * block = m_data + m_offset;
+        
+        uint32_t block_type;
+        memcpy(&block_type, block, 4);
+        
+        if (block_type == PCAPNG_SECTION_HEADER_BLOCK)
+        {
+            uint32_t byte_order_magic;
+            memcpy(&byte_order_magic, block + 8, 4);
+            
+            if (byte_order_magic == PCAPNG_BYTE_ORDER_MAGIC)
+            {
+                m_swapped = false;
+            }
+            else if (Swap32(byte_order_magic) == PCAPNG_BYTE_ORDER_MAGIC)
+            {
+                m_swapped = true;
+            }
+            else
+            {
+                throw runtime_error("Invalid pcapng section header in " + m_filename + "!");
+            }
+            
+            m_interfaces.clear();
+        }
+        else
+        {
+            block_type = Read32(block);
+        }
+        
+        uint32_t block_length = Read32(block + 4);
+        
+        if (block_length < 12 || (block_length & 3) != 0)
+        {
+            throw runtime_error("Invalid pcapng block length in " + m_filename + "!");
+        }
+        
+        if (m_offset + block_length > m_size)
+        {
+            return false;
+        }
+        
+        const uint8_t * body = block + 8;
+        size_t body_length = block_length - 12;
+        
+        m_offset += block_length;
+        
+        if (block_type == PCAPNG_INTERFACE_DESCRIPTION_BLOCK)
+        {
+            ReadInterfaceDescription(body, body_length);
+            continue;
+        }
+        
+        uint32_t interface_id;
+        uint64_t timestamp;
+        uint32_t captured_length;
+        const uint8_t * packet_data;
+        
+        if (block_type == PCAPNG_ENHANCED_PACKET_BLOCK && body_length >= 20)
+        {
+            interface_id = Read32(body);
+            timestamp = ((uint64_t)Read32(body + 4) << 32) | Read32(body + 8);
+            captured_length = Read32(body + 12);
+            packet_data = body + 20;
+            
+            if (20 + Padded32(captured_length) > body_length)
+            {
+                throw runtime_error("Invalid pcapng packet length in " + m_filename + "!");
+            }
+        }
+        else if (block_type == PCAPNG_PACKET_BLOCK && body_length >= 20)
+        {
+            interface_id = Read16(body);
+            timestamp = ((uint64_t)Read32(body + 4) << 32) | Read32(body + 8);
+            captured_length = Read32(body + 12);
+            packet_data = body + 20;
+            
+            if (20 + Padded32(captured_length) > body_length)
+            {
+                throw runtime_error("Invalid pcapng packet length in " + m_filename + "!");
+            }
+        }
+        else if (block_type == PCAPNG_SIMPLE_PACKET_BLOCK && body_length >= 4)
+        {
+            // Simple packets are always from the first interface, and have no timestamp
+            interface_id = 0;
+            timestamp = 0;
+            captured_length = min<size_t>(Read32(body), body_length - 4);
+            packet_data = body + 4;
+        }
+        else
+        {
+            // Statistics, name resolution and other blocks are skipped
+            continue;
+        }
+        
+        if (interface_id >= m_interfaces.size())
+        {
+            throw runtime_error("Packet from an undescribed pcapng interface in " + m_filename + "!");
+        }
+        
+        const Interface& interface = m_interfaces[interface_id];
+        
+        packet.time_ns = (int64_t)(timestamp / interface.ticks_per_second) * 1000000000 + 
+            (int64_t)((unsigned __int128)(timestamp % interface.ticks_per_second) * 1000000000 / interface.ticks_per_second);
+        packet.link_type = interface.link_type;
+        packet.data = packet_data;
+        packet.length = captured_length;
+        return true;
+    }
+    
+    return false;
+}
+
+void CaptureReader::ReadInterfaceDescription(const uint8_t * body, size_t body_length)
+{
+    if (body_length < 8)
+    {
+        throw runtime_error("Invalid pcapng interface description in " + m_filename + "!");
+    }
+    
+    Interface interface;
+    interface.link_type = Read16(body);
+    interface.ticks_per_second = PCAPNG_DEFAULT_TICKS_PER_SECOND;
+    
+    size_t offset = 8;
+    while (offset + 4 <= body_length)
+    {
+        uint16_t option_code = Read16(body + offset);
+        uint16_t option_length = Read16(body + offset + 2);
+        
+        if (option_code == PCAPNG_OPTION_END || offset + 4 + option_length > body_length)
+        {
+            break;
+        }
+        
+        if (option_code == PCAPNG_OPTION_IF_TSRESOL && option_length >= 1)
+        {
+            // The resolution is a negative power of 10, or of 2 if the high bit is set
+            uint8_t resolution = body[offset + 4];
+            uint64_t ticks_per_second = 1;
+            
+            for (int i = 0; i < (resolution & 0x7f) && ticks_per_second < 1000000000000000000ull; i++)
+            {
+                ticks_per_second *= (resolution & 0x80) ? 2 : 10;
+            }
+            
+            interface.ticks_per_second = ticks_per_second;
+        }
+        
+        offset += 4 + Padded32(option_length);
+    }
+    
+    m_interfaces.push_back(interface);
+}
+
+uint16_t CaptureReader::Read16(const uint8_t * p) const
+{
+    uint16_t x;
+    memcpy(&x, p, 2);
+    return m_swapped ? __builtin_bswap16(x) : x;
+}
+
+uint32_t CaptureReader::Read32(const uint8_t * p) const
+{
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return m_swapped ? Swap32(x) : x;
+}
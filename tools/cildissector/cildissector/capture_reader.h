@@ -0,0 +1,96 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Link-layer header types, from http://www.tcpdump.org/linktypes.html
+ */
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+struct CapturedPacket
+{
+    int64_t time_ns;      // Capture time in nanoseconds since the epoch
+    int link_type;        // Link-layer header type of the packet data
+    const uint8_t * data; // Captured bytes of the packet, valid for the lifetime of the reader
+    uint32_t length;      // Number of captured bytes
+};
+
+/*
+ * Sequential reader of the packets in a pcap or pcapng file. The file is
+ * mapped into memory, so packet data is not copied and stays valid until
+ * the reader is destroyed.
+ */
+class CaptureReader
+{
+public:
+    CaptureReader(const char * filename);
+    ~CaptureReader();
+    
+    // Read the next packet, returning false at the end of the file
+    bool NextPacket(CapturedPacket& packet);
+    
+protected:
+    // pcapng interface, as described by an Interface Description Block
+    struct Interface
+    {
+        int link_type;
+        uint64_t ticks_per_second;
+    };
+    
+    void ReadFileHeader();
+    bool NextPcapPacket(CapturedPacket& packet);
+    bool NextPcapngPacket(CapturedPacket& packet);
+    void ReadInterfaceDescription(const uint8_t * body, size_t body_length);
+    
+    uint16_t Read16(const uint8_t * p) const;
+    uint32_t Read32(const uint8_t * p) const;
+    
+    std::string m_filename;
+    const uint8_t * m_data;  // mapped file contents
+    size_t m_size;           // size of the file
+    size_t m_offset;         // offset of the next record or block
+    bool m_pcapng;           // true for pcapng, false for pcap
+    bool m_swapped;          // true if the file byte order differs from the host's
+    
+    // pcap file header
+    int m_link_type;
+    int64_t m_ns_per_tick;   // 1000 for microsecond timestamps, 1 for nanosecond timestamps
+    
+    // pcapng interfaces of the current section
+    std::vector<Interface> m_interfaces;
+};
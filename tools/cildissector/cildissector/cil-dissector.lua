@@ -53,54 +53,71 @@ cil_server_proto = Proto(CIL_SERVER_PROTO_NAME,CIL_SERVER_PROTO_DESC)
 cil_client_proto = Proto(CIL_CLIENT_PROTO_NAME,CIL_CLIENT_PROTO_DESC)
 cil_peer_proto = Proto(CIL_PEER_PROTO_NAME,CIL_PEER_PROTO_DESC)
 
+-- The whole message JSON costs about as much to render as all of its fields, so is only added on request
+cil_proto.prefs.show_json = Pref.bool(
+    "Show Message JSON",
+    false,
+    "Add each whole message to the tree as JSON, which roughly doubles the dissection time"
+)
+
+cil_proto.prefs.payload_filter = Pref.string(
+    "Payload Filter",
+    "",
+    "Comma-separated payloads to dissect, such as spectrum_usage,location_update. Other messages are only labelled with their payload, so their fields cannot be filtered on. Leave empty to dissect all messages"
+)
+
 local f_data = Field.new("zmtp.frame.data")
 
 local protocol_info = {}
 
 --
--- Field parsers for converting a string to a value type
+-- Field parsers for getting a value from a FieldTreeNode
 --
-local function dummy_parser(x)
-    return x
+local function text_value(node)
+    return node.value
 end
 
-local function uint64_parser(x)
-    local remove_quotes = string.gsub(x, '"([%d%.]*)"', "%1")
-    return UInt64(remove_quotes)
+local function number_value(node)
+    return node.number
 end
 
-local function int64_parser(x)
-    local remove_quotes = string.gsub(x, '"([%d%.]*)"', "%1")
-    return Int64(remove_quotes)
+local function uint64_value(node)
+    return UInt64.new(node.low_bits, node.high_bits)
 end
 
-local function bool_parser(x)
-    if x:lower() == "true" then
-        return true
-    else
-        return false
-    end
+local function int64_value(node)
+    return Int64.new(node.low_bits, node.high_bits)
+end
+
+local function bool_value(node)
+    return node.number ~= 0
 end
 
 --
 -- Map between a protobufs FieldDescriptor::cpp_type_name and
 -- a corresponding Wireshark field type, and a parser function
--- to convert a string to a value which is compatible with
+-- to get a value from a FieldTreeNode which is compatible with
 -- that field type.
 --
 local type_lookup = {}
-type_lookup["message"] = { ftypes.STRING, dummy_parser }
-type_lookup["string"] = { ftypes.STRING, dummy_parser }
-type_lookup["enum"] = { ftypes.STRING, dummy_parser }
-type_lookup["int32"] = { ftypes.INT32, tonumber }
-type_lookup["int64"] = { ftypes.INT64, int64_parser }
-type_lookup["uint32"] = { ftypes.UINT32, tonumber }
-type_lookup["uint64"] = { ftypes.UINT64, uint64_parser }
-type_lookup["double"] = { ftypes.DOUBLE, tonumber }
-type_lookup["float"] = { ftypes.DOUBLE, tonumber }
-type_lookup["bool"] = { ftypes.BOOLEAN, bool_parser }
+type_lookup["message"] = { ftypes.STRING, text_value }
+type_lookup["string"] = { ftypes.STRING, text_value }
+type_lookup["enum"] = { ftypes.STRING, text_value }
+type_lookup["int32"] = { ftypes.INT32, number_value }
+type_lookup["int64"] = { ftypes.INT64, int64_value }
+type_lookup["uint32"] = { ftypes.UINT32, number_value }
+type_lookup["uint64"] = { ftypes.UINT64, uint64_value }
+type_lookup["double"] = { ftypes.DOUBLE, number_value }
+type_lookup["float"] = { ftypes.FLOAT, number_value }
+type_lookup["bool"] = { ftypes.BOOLEAN, bool_value }
 
+--
+-- Register a ProtoField for each message field, returning a list of
+-- the field and value parser of each, indexed by FieldTreeNode field_index
+--
 local function add_field_info(protocol_name, protocol, field_info)
+    local field_list = {}
+    
     for i = 0, field_info:size() - 1 do
         local field_name = field_info[i].name
         local field_path = field_info[i].path
@@ -109,12 +126,17 @@ local function add_field_info(protocol_name, protocol, field_info)
         local full_path = string.format("%s.%s", protocol_name, field_path)
         
         local pf_type = ftypes.STRING
+        local value_parser = text_value
         if type_lookup[field_type] ~= nil then
             pf_type = type_lookup[field_type][1]
+            value_parser = type_lookup[field_type][2]
         end
         
         protocol.fields[full_path] = ProtoField.new(field_name, full_path, pf_type)
+        field_list[i] = { protocol.fields[full_path], value_parser }
     end
+    
+    return field_list
 end
 
 --
@@ -131,7 +153,8 @@ local function init_proto(protocol_name, protocol, field_info)
     protocol.fields = {}
     protocol.fields["message"] = ProtoField.new("message", string.format("%s.message", protocol_name), ftypes.STRING)
     
-    add_field_info(protocol_name, protocol, field_info)
+    protocol_info[protocol_name].field_list = add_field_info(protocol_name, protocol, field_info)
+    protocol_info[protocol_name].field_list[-1] = { protocol.fields["message"], text_value }
 end
 
 --
@@ -141,6 +164,29 @@ init_proto(CIL_SERVER_PROTO_NAME, cil_server_proto, cil_parser.GetTalkToServerFi
 init_proto(CIL_CLIENT_PROTO_NAME, cil_client_proto, cil_parser.GetTellClientFieldInfo())
 init_proto(CIL_PEER_PROTO_NAME, cil_peer_proto, cil_parser.GetCilMessageFieldInfo())
 
+--
+-- Returns the set of payload names to dissect, or nil to dissect all
+-- messages, parsed again only when the preference changes
+--
+local payload_filter = nil
+local payload_filter_string = ""
+
+local function get_payload_filter()
+    local filter_string = cil_proto.prefs.payload_filter
+    
+    if filter_string ~= payload_filter_string then
+        payload_filter_string = filter_string
+        payload_filter = nil
+        
+        for name in string.gmatch(filter_string, "[^,%s]+") do
+            payload_filter = payload_filter or {}
+            payload_filter[name] = true
+        end
+    end
+    
+    return payload_filter
+end
+
 --
 -- Helper function to convert a variadic return value to an array
 --
@@ -152,47 +198,50 @@ end
 -- Generate a dissection tree for a message with field names
 -- and values. 
 --
--- parser: function to generate a FieldTreeNodeVector from a Wireshark ByteArray
+-- parser: function to generate a FieldTreeNodeVector from a Wireshark ByteArray,
+--         and optionally the message JSON
+-- peeker: function to read the payload of a Wireshark ByteArray without decoding it
 -- tree: parent TreeItem
 -- protocol_name: protocol_name as a string
 -- data: TvbRange covering the packet
 --
-local function dissect_message(parser, tree, protocol_name, data)
+local function dissect_message(parser, peeker, tree, protocol_name, data)
     local data_bytearray = data:bytes()
     
-    local protocol = protocol_info[protocol_name].protocol
-    local parsed = parser(data_bytearray)
+    -- Messages with other payloads are not decoded at all
+    local filter = get_payload_filter()
+    if filter ~= nil then
+        local payload_name = peeker(data_bytearray).payload_name
+        
+        if not filter[payload_name] then
+            if payload_name == "" then
+                payload_name = "no payload"
+            end
+            
+            tree:append_text(" ("..payload_name..", not dissected)")
+            return
+        end
+    end
+    
+    local field_list = protocol_info[protocol_name].field_list
+    local parsed = parser(data_bytearray, cil_proto.prefs.show_json)
     
     local subtrees = {}
     
     for i = 0, parsed:size()-1 do
-        local id = parsed[i].id
-        local parent_id = parsed[i].parent_id
-        local value = parsed[i].value
-        local value_type = parsed[i].type
-        local full_path
-        
-        if parsed[i].path ~= "" then
-            full_path = string.format("%s.%s", protocol_name, parsed[i].path)
-        else
-            full_path = "message"
-        end
-        
-        local field = protocol.fields[full_path]
+        local node = parsed[i]
+        local id = node.id
+        local parent_id = node.parent_id
+        local field = field_list[node.field_index]
         local parent_tree
         
-        if parsed[i].parent_id >= 0 then
+        if parent_id >= 0 then
             parent_tree = subtrees[parent_id]
         else
             parent_tree = tree
         end
         
-        local value_parser = dummy_parser
-        if type_lookup[value_type] ~= nil then
-            value_parser = type_lookup[value_type][2]
-        end
-        
-        subtrees[id] = parent_tree:add(field,data(),value_parser(value))
+        subtrees[id] = parent_tree:add(field[1],data(),field[2](node))
     end
 end
 
@@ -209,7 +258,7 @@ function cil_server_proto.dissector(buffer,pinfo,tree)
             local payload_data = payloads[i].range()
             local subtree = cil_tree:add(cil_server_proto,payload_data())
             
-            dissect_message(cil_parser.TalkToServerDecodeValues, subtree, CIL_SERVER_PROTO_NAME, payload_data())
+            dissect_message(cil_parser.TalkToServerArenaDecodeValues, cil_parser.TalkToServerPeek, subtree, CIL_SERVER_PROTO_NAME, payload_data())
         end
     end
 end
@@ -227,7 +276,7 @@ function cil_client_proto.dissector(buffer,pinfo,tree)
             local payload_data = payloads[i].range()
             local subtree = cil_tree:add(cil_client_proto,payload_data())
 
-            dissect_message(cil_parser.TellClientDecodeValues, subtree, CIL_CLIENT_PROTO_NAME, payload_data())
+            dissect_message(cil_parser.TellClientArenaDecodeValues, cil_parser.TellClientPeek, subtree, CIL_CLIENT_PROTO_NAME, payload_data())
         end
     end
 end
@@ -245,7 +294,7 @@ function cil_peer_proto.dissector(buffer,pinfo,tree)
             local payload_data = payloads[i].range()
             local subtree = cil_tree:add(cil_peer_proto,payload_data())
             
-            dissect_message(cil_parser.CilMessageDecodeValues, subtree, CIL_PEER_PROTO_NAME, payload_data())
+            dissect_message(cil_parser.CilMessageArenaDecodeValues, cil_parser.CilMessagePeek, subtree, CIL_PEER_PROTO_NAME, payload_data())
         end
     end
 end
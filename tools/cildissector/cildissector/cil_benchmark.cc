@@ -0,0 +1,201 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+/*
+ * Benchmarks of the CIL message decoding hot paths, on synthetic matches
+ * from GenerateCilMessages with the number of flows per node given by the
+ * benchmark argument. Every benchmark reports events/s (messages) and
+ * bytes/s of serialized messages, and peak_rss, the peak resident set size
+ * of the whole process so far. Run one benchmark at a time with
+ * --benchmark_filter to measure its own peak memory.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+#include <benchmark/benchmark.h>
+
+#include "cil_parser.h"
+#include "cil_generator.h"
+
+using namespace std;
+
+namespace
+{
+    // A generated match, as serialized messages
+    struct GeneratedMessages
+    {
+        vector<vector<unsigned char> > messages;
+        size_t bytes;
+    };
+    
+    // Messages of the match described by the benchmark arguments, generated once per match. They are
+    // mutable only because the decoding functions take unsigned char *.
+    GeneratedMessages& GetMessages(const benchmark::State& state)
+    {
+        static map<unsigned int, GeneratedMessages> generated;
+        
+        unsigned int num_flows = state.range(0);
+        
+        map<unsigned int, GeneratedMessages>::iterator it = generated.find(num_flows);
+        if (it != generated.end())
+        {
+            return it->second;
+        }
+        
+        CilGeneratorOptions options;
+        options.num_flows = num_flows;
+        
+        vector<string> serialized = GenerateCilMessages(options);
+        
+        GeneratedMessages& messages = generated[num_flows];
+        messages.bytes = 0;
+        
+        for (size_t i = 0; i < serialized.size(); i++)
+        {
+            messages.messages.push_back(vector<unsigned char>(serialized[i].begin(), serialized[i].end()));
+            messages.bytes += serialized[i].size();
+        }
+        
+        return messages;
+    }
+    
+    // Report throughput of the messages and bytes decoded per iteration, and the peak resident set size
+    void SetCounters(benchmark::State& state, const GeneratedMessages& messages)
+    {
+        state.SetBytesProcessed(state.iterations() * messages.bytes);
+        state.counters["events"] = benchmark::Counter(messages.messages.size() * (double)state.iterations(), 
+            benchmark::Counter::kIsRate);
+        
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        state.counters["peak_rss"] = benchmark::Counter(usage.ru_maxrss * 1024.0, benchmark::Counter::kDefaults, 
+            benchmark::Counter::OneK::kIs1024);
+    }
+    
+    void MatchArguments(benchmark::internal::Benchmark * benchmark)
+    {
+        benchmark->ArgName("flows");
+        benchmark->Arg(1);
+        benchmark->Arg(10);
+        benchmark->Arg(50);
+        benchmark->Unit(benchmark::kMillisecond);
+    }
+}
+
+// Field tree of each message, copied into a new vector as the dissector originally did
+static void BM_DecodeFieldValues(benchmark::State& state)
+{
+    GeneratedMessages& messages = GetMessages(state);
+    
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < messages.messages.size(); i++)
+        {
+            vector<unsigned char>& data = messages.messages[i];
+            benchmark::DoNotOptimize(DecodeFieldValues<sc2::cil::CilMessage>(&data[0], data.size()));
+        }
+    }
+    
+    SetCounters(state, messages);
+}
+BENCHMARK(BM_DecodeFieldValues)->Apply(MatchArguments);
+
+// Field tree of each message, decoded on the reused arena and vector used by the dissector
+static void BM_ArenaDecodeFieldValues(benchmark::State& state)
+{
+    GeneratedMessages& messages = GetMessages(state);
+    
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < messages.messages.size(); i++)
+        {
+            vector<unsigned char>& data = messages.messages[i];
+            benchmark::DoNotOptimize(ArenaDecodeFieldValues<sc2::cil::CilMessage>(&data[0], data.size()).size());
+        }
+    }
+    
+    SetCounters(state, messages);
+}
+BENCHMARK(BM_ArenaDecodeFieldValues)->Apply(MatchArguments);
+
+// Field tree of each message, including the whole message JSON
+static void BM_ArenaDecodeFieldValuesWithJSON(benchmark::State& state)
+{
+    GeneratedMessages& messages = GetMessages(state);
+    
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < messages.messages.size(); i++)
+        {
+            vector<unsigned char>& data = messages.messages[i];
+            benchmark::DoNotOptimize(ArenaDecodeFieldValues<sc2::cil::CilMessage>(&data[0], data.size(), true).size());
+        }
+    }
+    
+    SetCounters(state, messages);
+}
+BENCHMARK(BM_ArenaDecodeFieldValuesWithJSON)->Apply(MatchArguments);
+
+// JSON of each message, as written by the offline decoder
+static void BM_DecodeAsJSON(benchmark::State& state)
+{
+    GeneratedMessages& messages = GetMessages(state);
+    
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < messages.messages.size(); i++)
+        {
+            vector<unsigned char>& data = messages.messages[i];
+            benchmark::DoNotOptimize(DecodeAsJSON<sc2::cil::CilMessage>(&data[0], data.size()));
+        }
+    }
+    
+    SetCounters(state, messages);
+}
+BENCHMARK(BM_DecodeAsJSON)->Apply(MatchArguments);
+
+// Payload of each message, read without decoding it
+static void BM_PeekMessageFields(benchmark::State& state)
+{
+    GeneratedMessages& messages = GetMessages(state);
+    
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < messages.messages.size(); i++)
+        {
+            vector<unsigned char>& data = messages.messages[i];
+            benchmark::DoNotOptimize(PeekMessageFields<sc2::cil::CilMessage>(&data[0], data.size()).payload_field);
+        }
+    }
+    
+    SetCounters(state, messages);
+}
+BENCHMARK(BM_PeekMessageFields)->Apply(MatchArguments);
+
+BENCHMARK_MAIN();
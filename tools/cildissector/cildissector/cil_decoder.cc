@@ -0,0 +1,745 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+/*
+ * Offline decoder of the CIL messages in pcap and pcapng captures. The TCP
+ * streams of each capture are reassembled, split into ZMTP frames and
+ * decoded in parallel into temporary spool files, then merged into NDJSON
+ * lines in capture order, with the same fields as ciltool's CilReader.
+ */
+
+#include <atomic>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <set>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cil_parser.h"
+#include "capture_reader.h"
+#include "tcp_streams.h"
+#include "zmtp_parser.h"
+
+using namespace std;
+
+#define DEFAULT_SERVER_PORT 5556
+#define DEFAULT_CLIENT_PORT 5557
+#define DEFAULT_PEER_PORT 5558
+
+// Size of each read of spooled messages when merging flows, in bytes
+#define SPOOL_READ_SIZE (32 * 1024)
+
+enum MessageType
+{
+    MESSAGE_CIL,    // CilMessage between peers
+    MESSAGE_CLIENT, // TalkToServer from a client
+    MESSAGE_SERVER, // TellClient from the server
+    NUM_MESSAGE_TYPES
+};
+
+// Key of each message type in the output, as with ciltool's CilReader
+static const char * MESSAGE_KEYS[NUM_MESSAGE_TYPES] = { "cil_message", "client_msg", "server_msg" };
+
+struct DecoderOptions
+{
+    unsigned int num_threads;
+    string output_dir;
+    uint16_t server_port;
+    uint16_t client_port;
+    uint16_t peer_port;
+    bool filter_payloads;                         // True to only decode the payloads in payload_filter
+    set<int> payload_filter[NUM_MESSAGE_TYPES];   // Payload oneof field numbers to decode, for each message type
+};
+
+/*
+ * Unlinked temporary file of the NDJSON lines decoded by one thread, so the
+ * decoded messages of a capture are not held in memory until all of its
+ * flows have been decoded
+ */
+class MessageSpool
+{
+public:
+    MessageSpool();
+    ~MessageSpool();
+    
+    // Append the line of a message made of its header, JSON and closing brace. Sets the offset it was 
+    // written at, and returns its length.
+    uint32_t Append(const char * header, const string& json, uint64_t& offset);
+    
+    // Flush the appended lines, so they can be read
+    void Flush();
+    
+    // Read length bytes at offset, which must be within the flushed lines
+    void Read(uint64_t offset, size_t length, char * data) const;
+    
+    uint64_t Size() const { return m_size; }
+    
+private:
+    FILE * m_file;
+    uint64_t m_size;    // bytes appended so far
+    
+    MessageSpool(const MessageSpool&);
+    MessageSpool& operator=(const MessageSpool&);
+};
+
+struct DecodedMessage
+{
+    uint64_t packet_index; // Index of the packet which completed the message
+    uint64_t offset;       // Offset of the NDJSON line in the spool of its flow
+    uint32_t length;       // Length of the line, including the newline
+    MessageType type;
+};
+
+// Decoded messages and warnings of one TCP flow
+struct FlowResult
+{
+    FlowResult() : spool(NULL) {}
+    
+    vector<DecodedMessage> messages;
+    MessageSpool * spool;   // spool of the thread which decoded the flow, holding the lines of its messages
+    ostringstream warnings;
+    exception_ptr error;
+};
+
+MessageSpool::MessageSpool() : m_file(tmpfile()), m_size(0)
+{
+    if (!m_file)
+    {
+        throw runtime_error("Cannot create a temporary file for decoded messages!");
+    }
+}
+
+MessageSpool::~MessageSpool()
+{
+    fclose(m_file);
+}
+
+uint32_t MessageSpool::Append(const char * header, const string& json, uint64_t& offset)
+{
+    size_t header_length = strlen(header);
+    
+    bool written = fwrite(header, 1, header_length, m_file) == header_length &&
+        fwrite(json.data(), 1, json.size(), m_file) == json.size() &&
+        fwrite("}\n", 1, 2, m_file) == 2;
+    
+    if (!written)
+    {
+        throw runtime_error("Error writing decoded messages to a temporary file!");
+    }
+    
+    uint32_t length = header_length + json.size() + 2;
+    
+    offset = m_size;
+    m_size += length;
+    return length;
+}
+
+void MessageSpool::Flush()
+{
+    if (fflush(m_file) != 0)
+    {
+        throw runtime_error("Error writing decoded messages to a temporary file!");
+    }
+}
+
+void MessageSpool::Read(uint64_t offset, size_t length, char * data) const
+{
+    while (length > 0)
+    {
+        ssize_t bytes_read = pread(fileno(m_file), data, length, offset);
+        
+        if (bytes_read < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        
+        if (bytes_read <= 0)
+        {
+            throw runtime_error("Error reading decoded messages from a temporary file!");
+        }
+        
+        data += bytes_read;
+        offset += bytes_read;
+        length -= bytes_read;
+    }
+}
+
+/*
+ * Parse a message on the decode arena, returning false if it is not valid
+ */
+template<class T>
+static bool DecodeMessageJSON(const ZmtpFrame& frame, string& json)
+{
+    google::protobuf::Arena& arena = GetDecodeArena();
+    arena.Reset();
+    
+    T * m = google::protobuf::Arena::CreateMessage<T>(&arena);
+    if (!m->ParseFromArray(frame.payload, frame.length))
+    {
+        return false;
+    }
+    
+    json = GetJSON(*m);
+    return true;
+}
+
+// Descriptor of the top-level message of a message type
+static const google::protobuf::Descriptor * MessageDescriptor(MessageType type)
+{
+    switch (type)
+    {
+        case MESSAGE_CIL:
+            return sc2::cil::CilMessage::descriptor();
+        case MESSAGE_CLIENT:
+            return sc2::reg::TalkToServer::descriptor();
+        default:
+            return sc2::reg::TellClient::descriptor();
+    }
+}
+
+/*
+ * Add the comma-separated payload names to the payload filter of each message type having them
+ */
+static void AddPayloadFilter(const string& names, DecoderOptions& options)
+{
+    stringstream stream(names);
+    string name;
+    
+    while (getline(stream, name, ','))
+    {
+        bool found = false;
+        
+        for (int type = 0; type < NUM_MESSAGE_TYPES; type++)
+        {
+            const google::protobuf::Descriptor * desc = MessageDescriptor((MessageType)type);
+            const google::protobuf::FieldDescriptor * field = desc->FindFieldByName(name);
+            
+            if (field && field->containing_oneof() == desc->FindOneofByName("payload"))
+            {
+                options.payload_filter[type].insert(field->number());
+                found = true;
+            }
+        }
+        
+        if (!found)
+        {
+            throw runtime_error("Unknown payload " + name + "!");
+        }
+    }
+    
+    options.filter_payloads = true;
+}
+
+/*
+ * Reassemble and decode the CIL messages of one direction of a TCP connection
+ */
+static void DecodeFlow(const TcpFlow& flow, MessageType type, bool force_zmtp, const DecoderOptions& options, FlowResult& result)
+{
+    const google::protobuf::Descriptor * desc = MessageDescriptor(type);
+    MessagePeek peek;
+    
+    TcpReassembler reassembler;
+    ZmtpParser parser(force_zmtp);
+    
+    string src_ip = flow.key.SrcAddress();
+    string dst_ip = flow.key.DstAddress();
+    
+    vector<TcpStreamData> stream_data;
+    ZmtpFrame frame;
+    string json;
+    
+    for (size_t i = 0; i <= flow.segments.size() && !parser.IsError(); i++)
+    {
+        stream_data.clear();
+        
+        if (i < flow.segments.size())
+        {
+            reassembler.AddSegment(flow.segments[i], stream_data);
+        }
+        else
+        {
+            reassembler.Flush(stream_data);
+        }
+        
+        for (size_t j = 0; j < stream_data.size() && !parser.IsError(); j++)
+        {
+            const TcpStreamData& data = stream_data[j];
+            
+            if (data.gap_before)
+            {
+                // Frame boundaries cannot be found again after missing data
+                if (parser.IsValid())
+                {
+                    result.warnings << "Missing TCP data from " << src_ip << ":" << flow.key.src_port << " to " << dst_ip << ":" 
+                        << flow.key.dst_port << ", skipping the rest of the stream" << endl;
+                }
+                
+                parser.SetError();
+                break;
+            }
+            
+            parser.Append(data.data, data.length);
+            
+            while (parser.NextFrame(frame))
+            {
+                // Skip uninteresting payloads before fully parsing them
+                if (options.filter_payloads && (!PeekMessage(frame.payload, frame.length, desc, peek) || 
+                    options.payload_filter[type].count(peek.payload_field) == 0))
+                {
+                    continue;
+                }
+                
+                bool valid;
+                
+                switch (type)
+                {
+                    case MESSAGE_CIL:
+                        valid = DecodeMessageJSON<sc2::cil::CilMessage>(frame, json);
+                        break;
+                    case MESSAGE_CLIENT:
+                        valid = DecodeMessageJSON<sc2::reg::TalkToServer>(frame, json);
+                        break;
+                    default:
+                        valid = DecodeMessageJSON<sc2::reg::TellClient>(frame, json);
+                        break;
+                }
+                
+                if (!valid)
+                {
+                    result.warnings << "Protobuf decode error in a message from " << src_ip << ":" << flow.key.src_port << " to " 
+                        << dst_ip << ":" << flow.key.dst_port << " at packet " << data.segment->packet_index + 1 << endl;
+                    continue;
+                }
+                
+                int64_t time_ns = data.segment->time_ns;
+                
+                char header[256];
+                snprintf(header, sizeof(header), 
+                    "{\"timestamp\": %lld.%09lld, \"tcp_length\": %llu, \"tcp_stream\": %d, \"src_ip\": \"%s\", \"src_port\": %u, "
+                    "\"dst_ip\": \"%s\", \"dst_port\": %u, \"%s\": ",
+                    (long long)(time_ns / 1000000000), (long long)(time_ns % 1000000000), (unsigned long long)frame.frame_length,
+                    flow.tcp_stream, src_ip.c_str(), flow.key.src_port, dst_ip.c_str(), flow.key.dst_port, MESSAGE_KEYS[type]);
+                
+                DecodedMessage message;
+                message.packet_index = data.segment->packet_index;
+                message.type = type;
+                message.length = result.spool->Append(header, json, message.offset);
+                
+                result.messages.push_back(message);
+            }
+        }
+    }
+}
+
+/*
+ * Output files of the decoded messages of each type, or stdout for all of them
+ */
+class MessageWriter
+{
+public:
+    MessageWriter(const string& output_dir);
+    ~MessageWriter();
+    
+    // Write the line of a message, message.length bytes
+    void Write(const DecodedMessage& message, const char * line);
+    
+    // Close the output files, throwing if any write failed
+    void Close();
+    
+private:
+    FILE * m_outputs[NUM_MESSAGE_TYPES];
+    bool m_write_error;
+};
+
+MessageWriter::MessageWriter(const string& output_dir) : m_write_error(false)
+{
+    for (int type = 0; type < NUM_MESSAGE_TYPES; type++)
+    {
+        m_outputs[type] = output_dir.empty() ? stdout : NULL;
+    }
+    
+    for (int type = 0; type < NUM_MESSAGE_TYPES && !output_dir.empty(); type++)
+    {
+        string path = output_dir + "/" + MESSAGE_KEYS[type] + ".ndjson";
+        m_outputs[type] = fopen(path.c_str(), "w");
+        
+        if (!m_outputs[type])
+        {
+            for (int opened = 0; opened < type; opened++)
+            {
+                fclose(m_outputs[opened]);
+            }
+            
+            throw runtime_error("Cannot open output file " + path + "!");
+        }
+    }
+}
+
+MessageWriter::~MessageWriter()
+{
+    for (int type = 0; type < NUM_MESSAGE_TYPES; type++)
+    {
+        if (m_outputs[type] && m_outputs[type] != stdout)
+        {
+            fclose(m_outputs[type]);
+        }
+    }
+}
+
+void MessageWriter::Write(const DecodedMessage& message, const char * line)
+{
+    m_write_error |= (fwrite(line, 1, message.length, m_outputs[message.type]) != message.length);
+}
+
+void MessageWriter::Close()
+{
+    for (int type = 0; type < NUM_MESSAGE_TYPES; type++)
+    {
+        if (m_outputs[type])
+        {
+            m_write_error |= (m_outputs[type] == stdout) ? (fflush(stdout) != 0) : (fclose(m_outputs[type]) != 0);
+            m_outputs[type] = NULL;
+        }
+    }
+    
+    if (m_write_error)
+    {
+        throw runtime_error("Error writing decoded messages!");
+    }
+}
+
+// Block of the spooled lines of one flow, read while merging
+struct SpoolCursor
+{
+    SpoolCursor() : begin(0), size(0) {}
+    
+    vector<char> buffer;
+    uint64_t begin;     // offset in the spool of buffer[0]
+    size_t size;        // number of bytes read into buffer
+};
+
+/*
+ * Return the line of a spooled message, reading the block of the spool
+ * starting with it if the cursor does not hold it already
+ */
+static const char * ReadSpooledLine(const MessageSpool& spool, const DecodedMessage& message, SpoolCursor& cursor)
+{
+    if (message.offset < cursor.begin || message.offset + message.length > cursor.begin + cursor.size)
+    {
+        // The lines of a flow are contiguous, and mostly read in order
+        cursor.begin = message.offset;
+        cursor.size = min<uint64_t>(max<size_t>(SPOOL_READ_SIZE, message.length), spool.Size() - message.offset);
+        cursor.buffer.resize(max(cursor.buffer.size(), cursor.size));
+        spool.Read(cursor.begin, cursor.size, &cursor.buffer[0]);
+    }
+    
+    return &cursor.buffer[message.offset - cursor.begin];
+}
+
+/*
+ * Write the decoded messages of all flows in capture order, by merging the
+ * flows on the heap of the next packet index of each one. Messages completed
+ * by the same packet are written in flow order, then in their order within
+ * the flow. Lines are read back from the spools a block at a time per flow.
+ */
+static void WriteFlowMessages(vector<FlowResult>& results, MessageWriter& writer)
+{
+    typedef pair<uint64_t, size_t> MergeEntry; // packet index of the next message, and index of its flow
+    
+    priority_queue<MergeEntry, vector<MergeEntry>, greater<MergeEntry> > heap;
+    vector<size_t> positions(results.size(), 0);
+    vector<SpoolCursor> cursors(results.size());
+    
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        vector<DecodedMessage>& messages = results[i].messages;
+        
+        // Out-of-order segments can complete a message before the ones of earlier packets
+        stable_sort(messages.begin(), messages.end(), [](const DecodedMessage& a, const DecodedMessage& b)
+        {
+            return a.packet_index < b.packet_index;
+        });
+        
+        if (!messages.empty())
+        {
+            heap.push(MergeEntry(messages[0].packet_index, i));
+        }
+    }
+    
+    while (!heap.empty())
+    {
+        size_t i = heap.top().second;
+        heap.pop();
+        
+        vector<DecodedMessage>& messages = results[i].messages;
+        const DecodedMessage& message = messages[positions[i]++];
+        
+        writer.Write(message, ReadSpooledLine(*results[i].spool, message, cursors[i]));
+        
+        if (positions[i] < messages.size())
+        {
+            heap.push(MergeEntry(messages[positions[i]].packet_index, i));
+        }
+        else
+        {
+            vector<DecodedMessage>().swap(messages);
+            vector<char>().swap(cursors[i].buffer);
+        }
+    }
+}
+
+/*
+ * Decode the CIL messages of a capture file, and write them in capture order
+ */
+static void DecodeCapture(const char * filename, const DecoderOptions& options, MessageWriter& writer)
+{
+    CaptureReader reader(filename);
+    TcpFlowTable flow_table;
+    
+    CapturedPacket packet;
+    for (uint64_t packet_index = 0; reader.NextPacket(packet); packet_index++)
+    {
+        flow_table.AddPacket(packet, packet_index);
+    }
+    
+    // Find the flows on CIL ports, and their message types
+    vector<const TcpFlow *> flows;
+    vector<MessageType> types;
+    
+    for (size_t i = 0; i < flow_table.Flows().size(); i++)
+    {
+        const TcpFlow& flow = flow_table.Flows()[i];
+        uint16_t src_port = flow.key.src_port;
+        uint16_t dst_port = flow.key.dst_port;
+        
+        if (src_port == options.peer_port || dst_port == options.peer_port)
+        {
+            types.push_back(MESSAGE_CIL);
+        }
+        else if (src_port == options.server_port || dst_port == options.server_port)
+        {
+            types.push_back(MESSAGE_CLIENT);
+        }
+        else if (src_port == options.client_port || dst_port == options.client_port)
+        {
+            types.push_back(MESSAGE_SERVER);
+        }
+        else
+        {
+            continue;
+        }
+        
+        flows.push_back(&flow);
+    }
+    
+    size_t num_workers = max<size_t>(1, min<size_t>(options.num_threads, flows.size()));
+    
+    vector<FlowResult> results(flows.size());
+    atomic<size_t> next_flow(0);
+    vector<thread> workers;
+    
+    // Each thread spools the lines of the flows it decodes to its own file
+    vector<unique_ptr<MessageSpool> > spools;
+    for (size_t n = 0; n < num_workers; n++)
+    {
+        spools.emplace_back(new MessageSpool());
+    }
+    
+    for (size_t n = 0; n < num_workers; n++)
+    {
+        MessageSpool * spool = spools[n].get();
+        
+        workers.push_back(thread([&flows, &types, &results, &next_flow, &options, spool]()
+        {
+            size_t i;
+            while ((i = next_flow++) < flows.size())
+            {
+                try
+                {
+                    uint16_t dst_port = flows[i]->key.dst_port;
+                    bool force_zmtp = (dst_port == options.server_port || dst_port == options.client_port || dst_port == options.peer_port);
+                    
+                    results[i].spool = spool;
+                    DecodeFlow(*flows[i], types[i], force_zmtp, options, results[i]);
+                }
+                catch (...)
+                {
+                    results[i].error = current_exception();
+                }
+            }
+        }));
+    }
+    
+    for (size_t n = 0; n < num_workers; n++)
+    {
+        workers[n].join();
+    }
+    
+    // Report in flow order, so warnings and errors do not depend on thread timing
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        cerr << results[i].warnings.str();
+        
+        if (results[i].error)
+        {
+            rethrow_exception(results[i].error);
+        }
+    }
+    
+    for (size_t n = 0; n < num_workers; n++)
+    {
+        spools[n]->Flush();
+    }
+    
+    WriteFlowMessages(results, writer);
+}
+
+static void PrintUsage(const char * program)
+{
+    cerr << "Usage: " << program << " [options] <capture file>..." << endl
+        << endl
+        << "Decodes the CIL messages in pcap or pcapng capture files to NDJSON" << endl
+        << endl
+        << "Options:" << endl
+        << "  -h, --help              show usage help" << endl
+        << "  -j, --threads N         number of threads decoding TCP streams (default: number of cores)" << endl
+        << "  -o, --output-dir DIR    write cil_message.ndjson, client_msg.ndjson and server_msg.ndjson" << endl
+        << "                          to DIR, instead of all messages to stdout" << endl
+        << "      --server-port PORT  TCP port of the registration server (default: " << DEFAULT_SERVER_PORT << ")" << endl
+        << "      --client-port PORT  TCP port of registration clients (default: " << DEFAULT_CLIENT_PORT << ")" << endl
+        << "      --peer-port PORT    TCP port of CIL peers (default: " << DEFAULT_PEER_PORT << ")" << endl
+        << "  -p, --payload NAMES     only decode messages with these comma-separated payloads, such as" << endl
+        << "                          spectrum_usage,location_update (can be repeated)" << endl;
+}
+
+static unsigned long ParseNumber(const char * arg, unsigned long max_value)
+{
+    char * end;
+    unsigned long value = strtoul(arg, &end, 10);
+    
+    if (*arg == '\0' || *end != '\0' || value > max_value)
+    {
+        throw runtime_error("Invalid number " + string(arg) + "!");
+    }
+    
+    return value;
+}
+
+int main(int argc, char * argv[])
+{
+    enum
+    {
+        OPTION_SERVER_PORT = 256,
+        OPTION_CLIENT_PORT,
+        OPTION_PEER_PORT
+    };
+    
+    static const struct option long_options[] =
+    {
+        { "help", no_argument, NULL, 'h' },
+        { "threads", required_argument, NULL, 'j' },
+        { "output-dir", required_argument, NULL, 'o' },
+        { "server-port", required_argument, NULL, OPTION_SERVER_PORT },
+        { "client-port", required_argument, NULL, OPTION_CLIENT_PORT },
+        { "peer-port", required_argument, NULL, OPTION_PEER_PORT },
+        { "payload", required_argument, NULL, 'p' },
+        { NULL, 0, NULL, 0 }
+    };
+    
+    DecoderOptions options;
+    options.num_threads = max(1u, thread::hardware_concurrency());
+    options.server_port = DEFAULT_SERVER_PORT;
+    options.client_port = DEFAULT_CLIENT_PORT;
+    options.peer_port = DEFAULT_PEER_PORT;
+    options.filter_payloads = false;
+    
+    try
+    {
+        int opt;
+        while ((opt = getopt_long(argc, argv, "hj:o:p:", long_options, NULL)) != -1)
+        {
+            switch (opt)
+            {
+                case 'j':
+                    options.num_threads = max(1ul, ParseNumber(optarg, 1024));
+                    break;
+                case 'o':
+                    options.output_dir = optarg;
+                    break;
+                case 'p':
+                    AddPayloadFilter(optarg, options);
+                    break;
+                case OPTION_SERVER_PORT:
+                    options.server_port = ParseNumber(optarg, 65535);
+                    break;
+                case OPTION_CLIENT_PORT:
+                    options.client_port = ParseNumber(optarg, 65535);
+                    break;
+                case OPTION_PEER_PORT:
+                    options.peer_port = ParseNumber(optarg, 65535);
+                    break;
+                default:
+                    PrintUsage(argv[0]);
+                    return 1;
+            }
+        }
+        
+        if (optind >= argc)
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        
+        MessageWriter writer(options.output_dir);
+        
+        for (int i = optind; i < argc; i++)
+        {
+            DecodeCapture(argv[i], options, writer);
+        }
+        
+        writer.Close();
+    }
+    catch (const exception& err)
+    {
+        cerr << "Hit exception: " << err.what() << endl;
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+#include "cil_generator.h"
+
+#include <random>
+
+#include "cil.pb.h"
+
+using namespace std;
+
+namespace
+{
+    void SetTimeStamp(sc2::cil::TimeStamp * timestamp, double time)
+    {
+        timestamp->set_seconds((int32_t)time);
+        timestamp->set_picoseconds((int64_t)((time - (int32_t)time) * 1e12));
+    }
+    
+    // Fill a voxel of the flow'th 1 MHz channel, starting at the given time
+    void SetVoxel(sc2::cil::SpectrumVoxel * voxel, unsigned int flow, double time)
+    {
+        voxel->set_freq_start(1000e6 + flow * 1e6);
+        voxel->set_freq_end(1000e6 + (flow + 1) * 1e6);
+        SetTimeStamp(voxel->mutable_time_start(), time);
+        SetTimeStamp(voxel->mutable_time_end(), time + 1.0);
+        voxel->mutable_duty_cycle()->set_value(0.5);
+    }
+}
+
+CilGeneratorOptions::CilGeneratorOptions() :
+    num_nodes(10),
+    num_flows(10),
+    message_rate(3.0),
+    match_length(60.0),
+    seed(1)
+{
+}
+
+vector<string> GenerateCilMessages(const CilGeneratorOptions& options)
+{
+    mt19937 random(options.seed);
+    uniform_real_distribution<double> uniform(0.0, 1.0);
+    
+    vector<string> messages;
+    
+    unsigned int num_rounds = (unsigned int)(options.match_length * options.message_rate);
+    
+    for (unsigned int round = 0; round < num_rounds; round++)
+    {
+        for (unsigned int node = 0; node < options.num_nodes; node++)
+        {
+            double time = CIL_GENERATOR_START_TIME + (round + (double)node / options.num_nodes) / options.message_rate;
+            
+            sc2::cil::CilMessage message;
+            message.set_sender_network_id(0xac1e0000 + (node << 8) + 1);
+            message.set_msg_count(round + 1);
+            SetTimeStamp(message.mutable_timestamp(), time);
+            message.mutable_network_type()->set_network_type(sc2::cil::NetworkType::COMPETITOR);
+            
+            switch (round % 3)
+            {
+            case 0:
+            {
+                sc2::cil::SpectrumUsage * usage = message.mutable_spectrum_usage();
+                
+                for (unsigned int flow = 0; flow < options.num_flows; flow++)
+                {
+                    sc2::cil::SpectrumVoxelUsage * voxel = usage->add_voxels();
+                    SetVoxel(voxel->mutable_spectrum_voxel(), flow, time);
+                    
+                    voxel->mutable_transmitter_info()->set_radio_id(node * 10 + 1);
+                    voxel->mutable_transmitter_info()->mutable_power_db()->set_value(-10.0 * uniform(random));
+                    
+                    sc2::cil::ReceiverInfo * receiver = voxel->add_receiver_info();
+                    receiver->set_radio_id(node * 10 + 2 + flow % 8);
+                    receiver->mutable_power_db()->set_value(-40.0 - 20.0 * uniform(random));
+                    
+                    voxel->set_measured_data(true);
+                }
+                break;
+            }
+            case 1:
+            {
+                sc2::cil::LocationUpdate * update = message.mutable_location_update();
+                
+                for (unsigned int radio = 1; radio <= 10; radio++)
+                {
+                    sc2::cil::LocationInfo * info = update->add_locations();
+                    info->set_radio_id(node * 10 + radio);
+                    info->mutable_location()->set_latitude(40.0 + uniform(random));
+                    info->mutable_location()->set_longitude(-75.0 + uniform(random));
+                    info->mutable_location()->set_elevation(100.0 * uniform(random));
+                    SetTimeStamp(info->mutable_timestamp(), time);
+                }
+                break;
+            }
+            default:
+            {
+                sc2::cil::DetailedPerformance * performance = message.mutable_detailed_performance();
+                performance->set_mandate_count(options.num_flows);
+                SetTimeStamp(performance->mutable_timestamp(), time);
+                
+                unsigned int achieved = 0;
+                
+                for (unsigned int flow = 0; flow < options.num_flows; flow++)
+                {
+                    sc2::cil::MandatePerformance * mandate = performance->add_mandates();
+                    mandate->set_scalar_performance(uniform(random));
+                    mandate->add_radio_ids(node * 10 + 1);
+                    mandate->add_radio_ids(node * 10 + 2 + flow % 8);
+                    mandate->set_flow_id(5000 + flow);
+                    mandate->set_hold_period(10);
+                    mandate->set_achieved_duration((unsigned int)(20 * uniform(random)));
+                    mandate->set_point_value(1 + flow % 3);
+                    
+                    if (mandate->achieved_duration() >= mandate->hold_period())
+                    {
+                        achieved++;
+                    }
+                }
+                
+                performance->set_mandates_achieved(achieved);
+                performance->set_total_score_achieved(achieved * 2);
+                performance->set_scoring_point_threshold(options.num_flows);
+                break;
+            }
+            }
+            
+            messages.push_back(message.SerializeAsString());
+        }
+    }
+    
+    return messages;
+}
@@ -0,0 +1,56 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Seconds since the epoch of the first generated message
+#define CIL_GENERATOR_START_TIME 1556649000
+
+/*
+ * Parameters of a synthetic stream of CIL messages, used by the benchmarks.
+ * Each node sends its messages at a constant rate for the length of the
+ * match, cycling through spectrum_usage, location_update and
+ * detailed_performance payloads. Spectrum usage has a voxel, and detailed
+ * performance a mandate, for each flow.
+ */
+struct CilGeneratorOptions
+{
+    CilGeneratorOptions();
+    
+    unsigned int num_nodes;    // number of nodes sending messages
+    unsigned int num_flows;    // number of flows of each node
+    double message_rate;       // messages sent per second by each node
+    double match_length;       // seconds of messages sent by each node
+    unsigned int seed;         // seed of the random field values
+};
+
+// Generate serialized CilMessages of a synthetic match, in the order they are sent
+std::vector<std::string> GenerateCilMessages(const CilGeneratorOptions& options);
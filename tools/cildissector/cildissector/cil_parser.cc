@@ -28,17 +28,26 @@
 
 #include <sstream>
 #include <google/protobuf/text_format.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 
 using namespace std;
 using namespace google::protobuf;
 
-void GetFieldInfo(const Message& m, vector<FieldInfo>& field_info, const string& prefix) 
+void GetFieldInfo(const Message& m, vector<FieldInfo>& field_info, const string& prefix, FieldTable * field_table) 
 {
     const Descriptor * desc = m.GetDescriptor();
     const Reflection * refl = m.GetReflection();
     MessageFactory * factory = refl->GetMessageFactory();
     
     int field_count = desc->field_count();
+    
+    if (field_table)
+    {
+        field_table->field_index.resize(field_count);
+        field_table->children.resize(field_count);
+    }
+    
     for(int i=0; i<field_count; i++)
     {
         const FieldDescriptor * field = desc->field(i);
@@ -49,6 +58,13 @@ void GetFieldInfo(const Message& m, vector<FieldInfo>& field_info, const string&
         info.type = field->cpp_type_name();
         info.repeated = field->is_repeated();
         
+        FieldTable * child_table = NULL;
+        if (field_table)
+        {
+            field_table->field_index[i] = field_info.size();
+            child_table = &field_table->children[i];
+        }
+        
         field_info.push_back(info);
         
         if (field->type() == FieldDescriptor::TYPE_MESSAGE)
@@ -58,43 +74,80 @@ void GetFieldInfo(const Message& m, vector<FieldInfo>& field_info, const string&
             if (!field->is_repeated()) {
                 string new_prefix = info.path + ".";
                 const Message &message_field = refl->GetMessage(m, field);
-                GetFieldInfo(message_field, field_info, new_prefix);
+                GetFieldInfo(message_field, field_info, new_prefix, child_table);
             }
             else
             {
                 string new_prefix = info.path + ".";
                 const Descriptor * child_desc = field->message_type();
                 const Message * message_field = factory->GetPrototype(child_desc);
-                GetFieldInfo(*message_field, field_info, new_prefix);
+                GetFieldInfo(*message_field, field_info, new_prefix, child_table);
             }
         }
     }
 }
 
-void GetFieldValues(const Message& m, vector<FieldTreeNode>& field_values, const string& prefix, int& id, int parent_id) 
+static inline void SetSplitValue(FieldTreeNode& info, uint64_t value)
+{
+    info.low_bits = (uint32_t)value;
+    info.high_bits = (uint32_t)(value >> 32);
+}
+
+/*
+ * Set a node to the value of a field, or of one element of a repeated field.
+ * Only strings, bytes and messages are printed as text.
+ */
+static void SetFieldValue(const Message& m, const FieldDescriptor * field, int index, const TextFormat::Printer& printer, 
+    FieldTreeNode& info)
 {
-    const Descriptor * desc = m.GetDescriptor();
     const Reflection * refl = m.GetReflection();
     
-    FieldTreeNode info;
-    info.parent_id = parent_id;
-    
-    // Start off the tree with a JSON representation of the entire message
-    if (parent_id < 0)
+#define FIELD_VALUE(TYPE) ((index < 0) ? refl->Get##TYPE(m, field) : refl->GetRepeated##TYPE(m, field, index))
+
+    switch (field->cpp_type())
     {
-        info.name = "";
-        info.path = prefix;
-        info.type = "message";
-        info.repeated = false;
-        info.id = id++;
-        info.value = GetJSON(m);
-        
-        field_values.push_back(info);
+        case FieldDescriptor::CPPTYPE_INT32:
+            info.number = FIELD_VALUE(Int32);
+            break;
+        case FieldDescriptor::CPPTYPE_UINT32:
+            info.number = FIELD_VALUE(UInt32);
+            break;
+        case FieldDescriptor::CPPTYPE_INT64:
+            SetSplitValue(info, (uint64_t)FIELD_VALUE(Int64));
+            break;
+        case FieldDescriptor::CPPTYPE_UINT64:
+            SetSplitValue(info, FIELD_VALUE(UInt64));
+            break;
+        case FieldDescriptor::CPPTYPE_DOUBLE:
+            info.number = FIELD_VALUE(Double);
+            break;
+        case FieldDescriptor::CPPTYPE_FLOAT:
+            info.number = FIELD_VALUE(Float);
+            break;
+        case FieldDescriptor::CPPTYPE_BOOL:
+            info.number = FIELD_VALUE(Bool) ? 1 : 0;
+            break;
+        case FieldDescriptor::CPPTYPE_ENUM:
+        {
+            int enum_number = FIELD_VALUE(EnumValue);
+            const EnumValueDescriptor * enum_value = field->enum_type()->FindValueByNumber(enum_number);
+            
+            info.number = enum_number;
+            info.value = enum_value ? enum_value->name() : std::to_string(enum_number);
+            break;
+        }
+        default:
+            printer.PrintFieldValueToString(m, field, index, &info.value);
+            break;
     }
     
-    TextFormat::Printer printer;
-    printer.SetSingleLineMode(true);
-    printer.SetHideUnknownFields(false);
+#undef FIELD_VALUE
+}
+
+static void AddFieldValues(const Message& m, const FieldTable& field_table, const TextFormat::Printer& printer, 
+    vector<FieldTreeNode>& field_values, int& id, int parent_id) 
+{
+    const Reflection * refl = m.GetReflection();
     
     std::vector<const FieldDescriptor *> field_list;
     refl->ListFields(m, &field_list);
@@ -104,12 +157,17 @@ void GetFieldValues(const Message& m, vector<FieldTreeNode>& field_values, const
     {
         const FieldDescriptor * field = field_list[i];
         
+        // Extensions are not part of the message field info
+        if (field->is_extension())
+        {
+            continue;
+        }
+        
+        const FieldTable& child_table = field_table.children[field->index()];
+        
         FieldTreeNode info;
         info.parent_id = parent_id;
-        info.name = field->name();
-        info.path = prefix + field->name();
-        info.type = field->cpp_type_name();
-        info.repeated = field->is_repeated();
+        info.field_index = field_table.field_index[field->index()];
         
         if (field->is_repeated()) 
         {
@@ -117,33 +175,59 @@ void GetFieldValues(const Message& m, vector<FieldTreeNode>& field_values, const
             for (int index=0; index<field_size; index++) 
             {
                 info.id = id++;
-                printer.PrintFieldValueToString(m, field, index, &info.value);
+                SetFieldValue(m, field, index, printer, info);
                 field_values.push_back(info);
                 
                 if (field->type() == FieldDescriptor::TYPE_MESSAGE)
                 {
-                    string new_prefix = info.path + ".";
                     const Message &message_field = refl->GetRepeatedMessage(m, field, index);
-                    GetFieldValues(message_field, field_values, new_prefix, id, info.id);
+                    AddFieldValues(message_field, child_table, printer, field_values, id, info.id);
                 }
             }
         }
         else
         {
             info.id = id++;
-            printer.PrintFieldValueToString(m, field, -1, &info.value);
+            SetFieldValue(m, field, -1, printer, info);
             field_values.push_back(info);
             
             if (field->type() == FieldDescriptor::TYPE_MESSAGE)
             {
-                string new_prefix = info.path + ".";
                 const Message &message_field = refl->GetMessage(m, field);
-                GetFieldValues(message_field, field_values, new_prefix, id, info.id);
+                AddFieldValues(message_field, child_table, printer, field_values, id, info.id);
             }
         }
     }
 }
 
+void GetFieldValues(const Message& m, const FieldTable& field_table, vector<FieldTreeNode>& field_values, int& id, int parent_id, bool with_json) 
+{
+    // Start off the tree with a JSON representation of the entire message, if requested
+    if (parent_id < 0 && with_json)
+    {
+        FieldTreeNode info;
+        info.parent_id = parent_id;
+        info.field_index = -1;
+        info.id = id++;
+        info.value = GetJSON(m);
+        
+        field_values.push_back(info);
+    }
+    
+    TextFormat::Printer printer;
+    printer.SetSingleLineMode(true);
+    printer.SetHideUnknownFields(false);
+    
+    AddFieldValues(m, field_table, printer, field_values, id, parent_id);
+}
+
+Arena& GetDecodeArena()
+{
+    static thread_local char initial_block[DECODE_ARENA_BLOCK_SIZE];
+    static thread_local Arena arena(initial_block, sizeof(initial_block));
+    return arena;
+}
+
 std::string GetJSON(const google::protobuf::Message& m)
 {
     string json_string;
@@ -152,3 +236,43 @@ std::string GetJSON(const google::protobuf::Message& m)
     util::MessageToJsonString(m, &json_string, opts);
     return json_string;
 }
+
+bool PeekMessage(const unsigned char * data, int len, const Descriptor * desc, MessagePeek& peek)
+{
+    using internal::WireFormatLite;
+    
+    const OneofDescriptor * payload = desc->FindOneofByName("payload");
+    
+    peek = MessagePeek();
+    io::CodedInputStream input(data, len);
+    
+    uint32_t tag;
+    while ((tag = input.ReadTag()) != 0)
+    {
+        const FieldDescriptor * field = desc->FindFieldByNumber(WireFormatLite::GetTagFieldNumber(tag));
+        bool varint = (WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_VARINT);
+        
+        if (field && payload && field->containing_oneof() == payload)
+        {
+            peek.payload_field = field->number();
+            peek.payload_name = field->name();
+        }
+        else if (field && varint && field->name() == "sender_network_id")
+        {
+            if (!input.ReadVarint32(&peek.sender_network_id)) return false;
+            continue;
+        }
+        else if (field && varint && field->name() == "msg_count")
+        {
+            if (!input.ReadVarint32(&peek.msg_count)) return false;
+            continue;
+        }
+        
+        if (!WireFormatLite::SkipField(&input, tag))
+        {
+            return false;
+        }
+    }
+    
+    return input.ConsumedEntireMessage();
+}
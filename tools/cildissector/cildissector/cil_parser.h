@@ -27,12 +27,17 @@
 #pragma once
  
 #include <google/protobuf/util/json_util.h>
+#include <google/protobuf/arena.h>
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 #include "registration.pb.h"
 #include "cil.pb.h"
 
+// Size of each thread's preallocated decode arena block, enough for typical CIL messages
+#define DECODE_ARENA_BLOCK_SIZE (256 * 1024)
+
 struct FieldInfo 
 {
     std::string name; // Name of the field
@@ -43,19 +48,31 @@ struct FieldInfo
 
 struct FieldTreeNode 
 {
-    int id;            // Unique ID of the field within the current tree
-    int parent_id;     // ID of the parent message, or -1 if this is the top-level message
-    std::string name;  // Name of the field
-    std::string path;  // Full path to the field, separated by '.'
-    std::string type;  // Field type as a string, taken from FieldDescriptor::cpp_type_name
-    std::string value; // Field value as a string
-    bool repeated;     // True if the field is repeated
+    FieldTreeNode() : id(0), parent_id(-1), field_index(-1), number(0), low_bits(0), high_bits(0) {}
+
+    int id;             // Unique ID of the field within the current tree
+    int parent_id;      // ID of the parent message, or -1 if this is the top-level message
+    int field_index;    // Index of the field's FieldInfo in the message field info, or -1 for the top-level message
+    double number;      // Value of 32-bit integer, floating point and bool fields, or the number of an enum value
+    uint32_t low_bits;  // Low 32 bits of a 64-bit integer field value, which a Lua number cannot hold exactly
+    uint32_t high_bits; // High 32 bits of a 64-bit integer field value
+    std::string value;  // Value of string, bytes and message fields as text, or the name of an enum value
+};
+
+/*
+ * Index of each field of a message within the message field info, so that
+ * decoding does not have to build field paths for every packet
+ */
+struct FieldTable
+{
+    std::vector<int> field_index;     // FieldInfo index of each field, by FieldDescriptor::index
+    std::vector<FieldTable> children; // Table of each message field's own fields, empty for other fields
 };
 
 /*
- * Returns field names recursively
+ * Returns field names recursively, and optionally the table of their indexes
  */
-void GetFieldInfo(const google::protobuf::Message& m, std::vector<FieldInfo>& field_info, const std::string& prefix = "");
+void GetFieldInfo(const google::protobuf::Message& m, std::vector<FieldInfo>& field_info, const std::string& prefix = "", FieldTable * field_table = NULL);
 
 template<class T>
 inline std::vector<FieldInfo> GetMessageFieldInfo()
@@ -67,21 +84,83 @@ inline std::vector<FieldInfo> GetMessageFieldInfo()
 }
 
 /*
- * Recursively returns a flattened tree of field names, types, and values
+ * Returns the field table of a message type, built on first use
  */
-void GetFieldValues(const google::protobuf::Message& m, std::vector<FieldTreeNode>& field_values, const std::string& prefix, int& id, int parent_id);
+template<class T>
+inline const FieldTable& GetMessageFieldTable()
+{
+    static const FieldTable field_table = []()
+    {
+        T m;
+        std::vector<FieldInfo> field_info;
+        FieldTable table;
+        GetFieldInfo(m, field_info, "", &table);
+        return table;
+    }();
+    
+    return field_table;
+}
 
+/*
+ * Recursively returns a flattened tree of field indexes and values. If
+ * with_json is set, the top-level message is first added as a JSON string,
+ * which costs about as much as decoding all of the fields.
+ */
+void GetFieldValues(const google::protobuf::Message& m, const FieldTable& field_table, std::vector<FieldTreeNode>& field_values, int& id, int parent_id, bool with_json = false);
+
+/*
+ * Returns the decode arena of the current thread. Its first block is
+ * preallocated and kept across resets, so decoding into it does not
+ * allocate unless a message outgrows the block.
+ */
+google::protobuf::Arena& GetDecodeArena();
+
+/*
+ * Parse a message directly from a buffer into the reset decode arena of the
+ * current thread. The message is only valid until the next call on this thread.
+ */
 template<class T>
-inline std::vector<FieldTreeNode> DecodeFieldValues(unsigned char * data, int len)
+inline T& ParseArenaMessage(unsigned char * data, int len)
 {
-    T m;
-    std::string serialized((const char *)data, len);
-    m.ParseFromString(serialized);
+    google::protobuf::Arena& arena = GetDecodeArena();
+    arena.Reset();
+    
+    T * m = google::protobuf::Arena::CreateMessage<T>(&arena);
+    m->ParseFromArray(data, len);
+    return *m;
+}
+
+/*
+ * Decode a message into a flattened tree, reusing the storage of field_values
+ */
+template<class T>
+inline void DecodeFieldValuesInto(unsigned char * data, int len, std::vector<FieldTreeNode>& field_values, bool with_json = false)
+{
+    const T& m = ParseArenaMessage<T>(data, len);
     
     int id = 0;
+    field_values.clear();
+    GetFieldValues(m, GetMessageFieldTable<T>(), field_values, id, -1, with_json);
+}
+
+template<class T>
+inline std::vector<FieldTreeNode> DecodeFieldValues(unsigned char * data, int len, bool with_json = false)
+{
     std::vector<FieldTreeNode> field_values;
-    GetFieldValues(m, field_values, "", id, -1);
-    
+    DecodeFieldValuesInto<T>(data, len, field_values, with_json);
+    return field_values;
+}
+
+/*
+ * Decode a message into a flattened tree held by the current thread, which
+ * is only valid until the next call on this thread. Unlike DecodeFieldValues,
+ * this does not copy the tree when returning it to Lua.
+ */
+template<class T>
+inline const std::vector<FieldTreeNode>& ArenaDecodeFieldValues(unsigned char * data, int len, bool with_json = false)
+{
+    static thread_local std::vector<FieldTreeNode> field_values;
+    DecodeFieldValuesInto<T>(data, len, field_values, with_json);
     return field_values;
 }
 
@@ -94,8 +173,43 @@ std::string GetJSON(const google::protobuf::Message& m);
 template<class T>
 std::string DecodeAsJSON(unsigned char * data, int len)
 {
-    T m;
-    std::string serialized((const char *)data, len);
-    m.ParseFromString(serialized);
-    return GetJSON(m);
-}
\ No newline at end of file
+    return GetJSON(ParseArenaMessage<T>(data, len));
+}
+
+/*
+ * Top-level fields of a serialized message, read by PeekMessage without
+ * parsing the message
+ */
+struct MessagePeek
+{
+    MessagePeek() : payload_field(0), sender_network_id(0), msg_count(0) {}
+
+    int payload_field;          // Field number of the member set in the payload oneof, or 0 if none is set
+    std::string payload_name;   // Name of the member set in the payload oneof, or empty if none is set
+    uint32_t sender_network_id; // CilMessage envelope field, or 0 for other messages
+    uint32_t msg_count;         // CilMessage envelope field, or 0 for other messages
+};
+
+/*
+ * Scan the top-level wire format of a serialized message of type desc,
+ * skipping over the payload contents. As when parsing, the last payload
+ * member on the wire is the one which is set. Returns false if the message
+ * is malformed.
+ */
+bool PeekMessage(const unsigned char * data, int len, const google::protobuf::Descriptor * desc, MessagePeek& peek);
+
+/*
+ * Peek at a serialized message, for example to decode only the messages with
+ * an interesting payload. A malformed message peeks as having no payload.
+ */
+template<class T>
+inline MessagePeek PeekMessageFields(unsigned char * data, int len)
+{
+    MessagePeek peek;
+    if (!PeekMessage(data, len, T::descriptor(), peek))
+    {
+        peek = MessagePeek();
+    }
+    
+    return peek;
+}
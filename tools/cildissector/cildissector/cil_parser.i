@@ -31,8 +31,15 @@
 
 %include <std_string.i>
 %include <std_vector.i>
+%include <stdint.i>
 %include "bytearray.i"
 
+%ignore GetDecodeArena;
+%ignore PeekMessage;
+
+// A single wrapper per function, so with_json can be left out without overload dispatch on the ByteArray typemap
+%feature("compactdefaultargs");
+
 %include "cil_parser.h"
 
 /*
@@ -61,4 +68,19 @@
  */
 %template(TalkToServerDecodeValues) DecodeFieldValues<sc2::reg::TalkToServer>;
 %template(TellClientDecodeValues) DecodeFieldValues<sc2::reg::TellClient>;
-%template(CilMessageDecodeValues) DecodeFieldValues<sc2::cil::CilMessage>;
\ No newline at end of file
+%template(CilMessageDecodeValues) DecodeFieldValues<sc2::cil::CilMessage>;
+
+/*
+ * Expose functions for decoding a CIL message to a FieldTreeNodeVector which
+ * is reused by the next call, parsed on a reused arena
+ */
+%template(TalkToServerArenaDecodeValues) ArenaDecodeFieldValues<sc2::reg::TalkToServer>;
+%template(TellClientArenaDecodeValues) ArenaDecodeFieldValues<sc2::reg::TellClient>;
+%template(CilMessageArenaDecodeValues) ArenaDecodeFieldValues<sc2::cil::CilMessage>;
+
+/*
+ * Expose functions for reading the payload type of a CIL message without decoding it
+ */
+%template(TalkToServerPeek) PeekMessageFields<sc2::reg::TalkToServer>;
+%template(TellClientPeek) PeekMessageFields<sc2::reg::TellClient>;
+%template(CilMessagePeek) PeekMessageFields<sc2::cil::CilMessage>;
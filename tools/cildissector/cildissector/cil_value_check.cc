@@ -0,0 +1,167 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+/*
+ * Checks the typed values of decoded field trees against the TextFormat
+ * text the dissector used to show, on a synthetic match from
+ * GenerateCilMessages. Prints each mismatch, and exits non-zero if there
+ * were any.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#include <google/protobuf/text_format.h>
+
+#include "cil_parser.h"
+#include "cil_generator.h"
+
+using namespace std;
+using namespace google::protobuf;
+
+namespace
+{
+    // 64-bit value of a node, rebuilt from its two 32-bit words as the dissector does
+    uint64_t SplitValue(const FieldTreeNode& node)
+    {
+        return ((uint64_t)node.high_bits << 32) | node.low_bits;
+    }
+    
+    // True if the typed value of node matches the TextFormat text of the field
+    bool ValueMatches(const FieldDescriptor * field, const FieldTreeNode& node, const string& text)
+    {
+        switch (field->cpp_type())
+        {
+            case FieldDescriptor::CPPTYPE_INT32:
+                return text == to_string((int32_t)node.number);
+            case FieldDescriptor::CPPTYPE_UINT32:
+                return text == to_string((uint32_t)node.number);
+            case FieldDescriptor::CPPTYPE_INT64:
+                return text == to_string((int64_t)SplitValue(node));
+            case FieldDescriptor::CPPTYPE_UINT64:
+                return text == to_string(SplitValue(node));
+            case FieldDescriptor::CPPTYPE_DOUBLE:
+                return strtod(text.c_str(), NULL) == node.number;
+            case FieldDescriptor::CPPTYPE_FLOAT:
+                return strtof(text.c_str(), NULL) == (float)node.number;
+            case FieldDescriptor::CPPTYPE_BOOL:
+                return text == (node.number ? "true" : "false");
+            case FieldDescriptor::CPPTYPE_ENUM:
+                return text == node.value;
+            default:
+                return text == node.value;
+        }
+    }
+    
+    /*
+     * Compare the nodes of a message with its fields, visited in the same order
+     * as GetFieldValues. Returns the number of mismatches.
+     */
+    int CheckFieldValues(const Message& m, const vector<FieldTreeNode>& field_values, size_t& position, 
+        const TextFormat::Printer& printer)
+    {
+        const Reflection * refl = m.GetReflection();
+        
+        vector<const FieldDescriptor *> field_list;
+        refl->ListFields(m, &field_list);
+        
+        int mismatches = 0;
+        
+        for (size_t i = 0; i < field_list.size(); i++)
+        {
+            const FieldDescriptor * field = field_list[i];
+            
+            int field_size = field->is_repeated() ? refl->FieldSize(m, field) : 1;
+            for (int index = 0; index < field_size; index++)
+            {
+                int field_index = field->is_repeated() ? index : -1;
+                
+                if (position >= field_values.size())
+                {
+                    cerr << field->full_name() << ": missing from the field tree" << endl;
+                    return mismatches + 1;
+                }
+                
+                const FieldTreeNode& node = field_values[position++];
+                
+                string text;
+                printer.PrintFieldValueToString(m, field, field_index, &text);
+                
+                if (!ValueMatches(field, node, text))
+                {
+                    cerr << field->full_name() << ": decoded " << node.number << " (" << node.high_bits << ":" 
+                        << node.low_bits << ") \"" << node.value << "\", expected " << text << endl;
+                    mismatches++;
+                }
+                
+                if (field->type() == FieldDescriptor::TYPE_MESSAGE)
+                {
+                    const Message& message_field = field->is_repeated() ? refl->GetRepeatedMessage(m, field, index) : 
+                        refl->GetMessage(m, field);
+                    mismatches += CheckFieldValues(message_field, field_values, position, printer);
+                }
+            }
+        }
+        
+        return mismatches;
+    }
+}
+
+int main()
+{
+    CilGeneratorOptions options;
+    vector<string> serialized = GenerateCilMessages(options);
+    
+    TextFormat::Printer printer;
+    printer.SetSingleLineMode(true);
+    printer.SetHideUnknownFields(false);
+    
+    int mismatches = 0;
+    
+    for (size_t i = 0; i < serialized.size(); i++)
+    {
+        vector<unsigned char> data(serialized[i].begin(), serialized[i].end());
+        vector<FieldTreeNode> field_values = DecodeFieldValues<sc2::cil::CilMessage>(&data[0], data.size());
+        
+        sc2::cil::CilMessage m;
+        m.ParseFromString(serialized[i]);
+        
+        size_t position = 0;
+        mismatches += CheckFieldValues(m, field_values, position, printer);
+        
+        if (position != field_values.size())
+        {
+            cerr << "Message " << i << ": " << field_values.size() - position << " extra nodes in the field tree" << endl;
+            mismatches++;
+        }
+    }
+    
+    cout << "Checked " << serialized.size() << " messages, " << mismatches << " mismatches" << endl;
+    
+    return mismatches ? 1 : 0;
+}
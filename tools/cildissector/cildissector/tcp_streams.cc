@@ -0,0 +1,360 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+#include "tcp_streams.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+using namespace std;
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+
+#define IP_PROTOCOL_TCP 6
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_ACK 0x10
+
+static inline uint16_t ReadBE16(const uint8_t * p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static inline uint32_t ReadBE32(const uint8_t * p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static string FormatAddress(const uint8_t * addr, uint8_t addr_length)
+{
+    char buffer[INET6_ADDRSTRLEN];
+    inet_ntop((addr_length == 4) ? AF_INET : AF_INET6, addr, buffer, sizeof(buffer));
+    return buffer;
+}
+
+bool TcpFlowKey::operator==(const TcpFlowKey& other) const
+{
+    return src_port == other.src_port && dst_port == other.dst_port && addr_length == other.addr_length &&
+        memcmp(src_addr, other.src_addr, sizeof(src_addr)) == 0 && memcmp(dst_addr, other.dst_addr, sizeof(dst_addr)) == 0;
+}
+
+TcpFlowKey TcpFlowKey::Reversed() const
+{
+    TcpFlowKey key = *this;
+    memcpy(key.src_addr, dst_addr, sizeof(key.src_addr));
+    memcpy(key.dst_addr, src_addr, sizeof(key.dst_addr));
+    key.src_port = dst_port;
+    key.dst_port = src_port;
+    return key;
+}
+
+string TcpFlowKey::SrcAddress() const
+{
+    return FormatAddress(src_addr, addr_length);
+}
+
+string TcpFlowKey::DstAddress() const
+{
+    return FormatAddress(dst_addr, addr_length);
+}
+
+size_t TcpFlowKeyHash::operator()(const TcpFlowKey& key) const
+{
+    // FNV-1a over the used bytes of the key
+    uint64_t hash = 14695981039346656037ull;
+    
+    for (int i = 0; i < key.addr_length; i++)
+    {
+        hash = (hash ^ key.src_addr[i]) * 1099511628211ull;
+        hash = (hash ^ key.dst_addr[i]) * 1099511628211ull;
+    }
+    
+    hash = (hash ^ key.src_port) * 1099511628211ull;
+    hash = (hash ^ key.dst_port) * 1099511628211ull;
+    return hash;
+}
+
+TcpFlowTable::TcpFlowTable() :
+    m_num_streams(0)
+{
+}
+
+void TcpFlowTable::AddPacket(const CapturedPacket& packet, uint64_t packet_index)
+{
+    const uint8_t * p = packet.data;
+    size_t length = packet.length;
+    uint16_t ethertype;
+    
+    // Link layer
+    switch (packet.link_type)
+    {
+        case LINKTYPE_ETHERNET:
+            if (length < 14) return;
+            ethertype = ReadBE16(p + 12);
+            p += 14;
+            length -= 14;
+            
+            while (ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ)
+            {
+                if (length < 4) return;
+                ethertype = ReadBE16(p + 2);
+                p += 4;
+                length -= 4;
+            }
+            break;
+            
+        case LINKTYPE_LINUX_SLL:
+            if (length < 16) return;
+            ethertype = ReadBE16(p + 14);
+            p += 16;
+            length -= 16;
+            break;
+            
+        case LINKTYPE_LINUX_SLL2:
+            if (length < 20) return;
+            ethertype = ReadBE16(p);
+            p += 20;
+            length -= 20;
+            break;
+            
+        case LINKTYPE_NULL:
+            // The address family is in the byte order of the capturing host, and is 2 for IPv4 everywhere
+            if (length < 4) return;
+            ethertype = (p[0] == 2 || p[3] == 2) ? ETHERTYPE_IPV4 : ETHERTYPE_IPV6;
+            p += 4;
+            length -= 4;
+            break;
+            
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+        case LINKTYPE_IPV6:
+            if (length < 1) return;
+            ethertype = ((p[0] >> 4) == 4) ? ETHERTYPE_IPV4 : ETHERTYPE_IPV6;
+            break;
+            
+        default:
+            return;
+    }
+    
+    TcpFlowKey key;
+    memset(&key, 0, sizeof(key));
+    
+    // Network layer
+    if (ethertype == ETHERTYPE_IPV4)
+    {
+        if (length < 20 || (p[0] >> 4) != 4) return;
+        
+        size_t header_length = (p[0] & 0x0f) * 4;
+        size_t total_length = ReadBE16(p + 2);
+        
+        // Fragments are not reassembled
+        if (header_length < 20 || (ReadBE16(p + 6) & 0x3fff) != 0 || p[9] != IP_PROTOCOL_TCP) return;
+        
+        // Drop any link-layer padding
+        length = min(length, total_length);
+        if (length < header_length) return;
+        
+        key.addr_length = 4;
+        memcpy(key.src_addr, p + 12, 4);
+        memcpy(key.dst_addr, p + 16, 4);
+        
+        p += header_length;
+        length -= header_length;
+    }
+    else if (ethertype == ETHERTYPE_IPV6)
+    {
+        // Extension headers are not followed
+        if (length < 40 || (p[0] >> 4) != 6 || p[6] != IP_PROTOCOL_TCP) return;
+        
+        length = min<size_t>(length, 40 + ReadBE16(p + 4));
+        
+        key.addr_length = 16;
+        memcpy(key.src_addr, p + 8, 16);
+        memcpy(key.dst_addr, p + 24, 16);
+        
+        p += 40;
+        length -= 40;
+    }
+    else
+    {
+        return;
+    }
+    
+    // Transport layer
+    if (length < 20) return;
+    
+    size_t header_length = (p[12] >> 4) * 4;
+    if (header_length < 20 || length < header_length) return;
+    
+    key.src_port = ReadBE16(p);
+    key.dst_port = ReadBE16(p + 2);
+    
+    TcpSegment segment;
+    segment.packet_index = packet_index;
+    segment.time_ns = packet.time_ns;
+    segment.seq = ReadBE32(p + 4);
+    segment.syn = (p[13] & TCP_FLAG_SYN) != 0;
+    segment.ack = (p[13] & TCP_FLAG_ACK) != 0;
+    segment.data = p + header_length;
+    segment.length = length - header_length;
+    
+    // Bare acknowledgements carry nothing for the stream
+    if (segment.length == 0 && !segment.syn) return;
+    
+    AddSegment(key, segment);
+}
+
+void TcpFlowTable::AddSegment(const TcpFlowKey& key, const TcpSegment& segment)
+{
+    unordered_map<TcpFlowKey, size_t, TcpFlowKeyHash>::iterator it = m_flow_index.find(key);
+    
+    // A SYN which is not a retransmission of the flow's own SYN starts a new connection on the same ports
+    bool new_connection = segment.syn && (it == m_flow_index.end() || !m_flows[it->second].has_syn || 
+        m_flows[it->second].syn_seq != segment.seq);
+    
+    if (it == m_flow_index.end() || new_connection)
+    {
+        TcpFlow flow;
+        flow.key = key;
+        flow.has_syn = segment.syn;
+        flow.syn_seq = segment.syn ? segment.seq : 0;
+        
+        // Both directions of a connection share a stream index, which the initial SYN starts
+        unordered_map<TcpFlowKey, size_t, TcpFlowKeyHash>::iterator reverse_it = m_flow_index.find(key.Reversed());
+        bool initial_syn = segment.syn && !segment.ack;
+        
+        flow.tcp_stream = (reverse_it != m_flow_index.end() && !initial_syn) ? m_flows[reverse_it->second].tcp_stream : 
+            m_num_streams++;
+        
+        m_flow_index[key] = m_flows.size();
+        m_flows.push_back(flow);
+        
+        it = m_flow_index.find(key);
+    }
+    
+    m_flows[it->second].segments.push_back(segment);
+}
+
+TcpReassembler::TcpReassembler() :
+    m_started(false),
+    m_next_seq(0),
+    m_next_offset(0),
+    m_gap(false),
+    m_lost_bytes(0)
+{
+}
+
+void TcpReassembler::AddSegment(const TcpSegment& segment, vector<TcpStreamData>& stream_data)
+{
+    // Data follows the sequence number taken by a SYN
+    uint32_t data_seq = segment.syn ? segment.seq + 1 : segment.seq;
+    
+    if (!m_started)
+    {
+        // Without the SYN, the stream starts with the first segment captured
+        m_started = true;
+        m_next_seq = data_seq;
+    }
+    
+    if (segment.length == 0)
+    {
+        return;
+    }
+    
+    int64_t offset = m_next_offset + (int32_t)(data_seq - m_next_seq);
+    
+    if (offset <= m_next_offset)
+    {
+        Deliver(segment, offset, stream_data);
+        DeliverPending(stream_data);
+    }
+    else
+    {
+        m_pending.insert(make_pair(offset, &segment));
+        
+        if (m_pending.size() > TCP_MAX_PENDING_SEGMENTS)
+        {
+            SkipGap(stream_data);
+        }
+    }
+}
+
+void TcpReassembler::Flush(vector<TcpStreamData>& stream_data)
+{
+    while (!m_pending.empty())
+    {
+        SkipGap(stream_data);
+    }
+}
+
+void TcpReassembler::Deliver(const TcpSegment& segment, int64_t offset, vector<TcpStreamData>& stream_data)
+{
+    // Drop any data which was already delivered by an earlier segment
+    int64_t skip = m_next_offset - offset;
+    if (skip >= segment.length)
+    {
+        return;
+    }
+    
+    TcpStreamData data;
+    data.segment = &segment;
+    data.data = segment.data + skip;
+    data.length = segment.length - skip;
+    data.gap_before = m_gap;
+    
+    stream_data.push_back(data);
+    
+    m_gap = false;
+    m_next_offset += data.length;
+    m_next_seq += data.length;
+}
+
+void TcpReassembler::DeliverPending(vector<TcpStreamData>& stream_data)
+{
+    while (!m_pending.empty() && m_pending.begin()->first <= m_next_offset)
+    {
+        Deliver(*m_pending.begin()->second, m_pending.begin()->first, stream_data);
+        m_pending.erase(m_pending.begin());
+    }
+}
+
+void TcpReassembler::SkipGap(vector<TcpStreamData>& stream_data)
+{
+    int64_t offset = m_pending.begin()->first;
+    
+    if (offset > m_next_offset)
+    {
+        m_lost_bytes += offset - m_next_offset;
+        m_next_seq += (uint32_t)(offset - m_next_offset);
+        m_next_offset = offset;
+        m_gap = true;
+    }
+    
+    DeliverPending(stream_data);
+}
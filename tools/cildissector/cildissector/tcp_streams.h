@@ -0,0 +1,158 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "capture_reader.h"
+
+/*
+ * Addresses and ports of one direction of a TCP connection
+ */
+struct TcpFlowKey
+{
+    uint8_t src_addr[16]; // Source address, of which only the first addr_length bytes are used
+    uint8_t dst_addr[16]; // Destination address, of which only the first addr_length bytes are used
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t addr_length;  // 4 for IPv4, or 16 for IPv6
+    
+    bool operator==(const TcpFlowKey& other) const;
+    
+    // Key of the opposite direction of the connection
+    TcpFlowKey Reversed() const;
+    
+    std::string SrcAddress() const;
+    std::string DstAddress() const;
+};
+
+struct TcpFlowKeyHash
+{
+    size_t operator()(const TcpFlowKey& key) const;
+};
+
+/*
+ * One captured TCP segment. The data points into the capture file.
+ */
+struct TcpSegment
+{
+    uint64_t packet_index; // Index of the packet within the capture
+    int64_t time_ns;       // Capture time in nanoseconds since the epoch
+    uint32_t seq;          // Sequence number of the first data byte, or of the SYN
+    bool syn;              // True if the SYN flag is set
+    bool ack;              // True if the ACK flag is set
+    const uint8_t * data;  // TCP payload
+    uint32_t length;       // Captured length of the TCP payload
+};
+
+/*
+ * The segments of one direction of a TCP connection, in capture order
+ */
+struct TcpFlow
+{
+    TcpFlowKey key;
+    int tcp_stream;                    // Index of the connection in order of first appearance, as with tshark's tcp.stream
+    bool has_syn;                      // True if the SYN of the connection was captured
+    uint32_t syn_seq;                  // Sequence number of the SYN, if captured
+    std::vector<TcpSegment> segments;
+};
+
+/*
+ * Sorts the TCP segments of a capture into flows. A SYN with a new sequence
+ * number for addresses and ports already seen, such as from a reused client
+ * port, starts a new connection with its own flows and stream index.
+ */
+
+class TcpFlowTable
+{
+public:
+    TcpFlowTable();
+    
+    // Add a captured packet, which is ignored unless it is an unfragmented TCP segment over IPv4 or IPv6
+    void AddPacket(const CapturedPacket& packet, uint64_t packet_index);
+    
+    std::vector<TcpFlow>& Flows() { return m_flows; }
+    
+protected:
+    void AddSegment(const TcpFlowKey& key, const TcpSegment& segment);
+    
+    std::unordered_map<TcpFlowKey, size_t, TcpFlowKeyHash> m_flow_index; // index in m_flows of the latest flow of each key
+    std::vector<TcpFlow> m_flows;
+    int m_num_streams;
+};
+
+/*
+ * A contiguous piece of a reassembled TCP byte stream
+ */
+struct TcpStreamData
+{
+    const TcpSegment * segment; // Segment the data came from
+    const uint8_t * data;       // Data which has not been delivered before
+    uint32_t length;
+    bool gap_before;            // True if stream bytes before this data were never captured
+};
+
+// Out-of-order segments to hold while waiting for a missing one, before giving up on it
+#define TCP_MAX_PENDING_SEGMENTS 1024
+
+/*
+ * Reassembles the byte stream of one direction of a TCP connection from its
+ * segments in capture order, dropping retransmitted data and reordering
+ * segments which arrive out of order
+ */
+class TcpReassembler
+{
+public:
+    TcpReassembler();
+    
+    // Add the next segment, appending any data which now extends the stream in order
+    void AddSegment(const TcpSegment& segment, std::vector<TcpStreamData>& stream_data);
+    
+    // Append the remaining out-of-order data, skipping the bytes which were never captured
+    void Flush(std::vector<TcpStreamData>& stream_data);
+    
+    // Number of stream bytes skipped since they were never captured
+    uint64_t LostBytes() const { return m_lost_bytes; }
+    
+protected:
+    void Deliver(const TcpSegment& segment, int64_t offset, std::vector<TcpStreamData>& stream_data);
+    void DeliverPending(std::vector<TcpStreamData>& stream_data);
+    void SkipGap(std::vector<TcpStreamData>& stream_data);
+    
+    bool m_started;          // True once the initial sequence number is known
+    uint32_t m_next_seq;     // Sequence number of the next stream byte
+    int64_t m_next_offset;   // Offset of the next stream byte from the start of the stream
+    bool m_gap;              // True if bytes were skipped before the next stream byte
+    uint64_t m_lost_bytes;
+    
+    std::multimap<int64_t, const TcpSegment *> m_pending; // Out-of-order segments, by stream offset
+};
@@ -0,0 +1,161 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+#include "zmtp_parser.h"
+
+#include <string.h>
+
+using namespace std;
+
+#define ZMTP_FLAG_LONG 0x02
+#define ZMTP_FLAG_COMMAND 0x04
+
+ZmtpParser::ZmtpParser(bool force_zmtp) :
+    m_force_zmtp(force_zmtp),
+    m_state(STATE_UNKNOWN),
+    m_read_offset(0)
+{
+}
+
+void ZmtpParser::Append(const uint8_t * data, size_t length)
+{
+    if (m_state == STATE_ERROR)
+    {
+        return;
+    }
+    
+    // Compact the buffer once the read data dominates it, so frames stay contiguous without unbounded growth
+    if (m_read_offset > 0 && m_read_offset >= m_buffer.size() / 2)
+    {
+        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_read_offset);
+        m_read_offset = 0;
+    }
+    
+    m_buffer.insert(m_buffer.end(), data, data + length);
+}
+
+bool ZmtpParser::NextFrame(ZmtpFrame& frame)
+{
+    if (m_state == STATE_UNKNOWN)
+    {
+        CheckGreeting();
+    }
+    
+    while (m_state == STATE_VALID)
+    {
+        const uint8_t * p = m_buffer.data() + m_read_offset;
+        size_t available = m_buffer.size() - m_read_offset;
+        
+        if (available < 1)
+        {
+            return false;
+        }
+        
+        uint8_t flags = p[0];
+        uint64_t length;
+        size_t header_length;
+        
+        if ((flags & ZMTP_FLAG_LONG) == 0)
+        {
+            if (available < 2)
+            {
+                return false;
+            }
+            
+            length = p[1];
+            header_length = 2;
+        }
+        else
+        {
+            if (available < 9)
+            {
+                return false;
+            }
+            
+            length = 0;
+            for (int i = 1; i <= 8; i++)
+            {
+                length = (length << 8) | p[i];
+            }
+            
+            header_length = 9;
+        }
+        
+        if (available - header_length < length)
+        {
+            return false;
+        }
+        
+        Consume(header_length + length);
+        
+        if ((flags & ZMTP_FLAG_COMMAND) != 0)
+        {
+            continue;
+        }
+        
+        frame.payload = p + header_length;
+        frame.length = length;
+        frame.frame_length = header_length + length;
+        return true;
+    }
+    
+    return false;
+}
+
+void ZmtpParser::CheckGreeting()
+{
+    if (m_buffer.size() - m_read_offset < ZMTP_GREETING_SIZE)
+    {
+        return;
+    }
+    
+    const uint8_t * p = m_buffer.data() + m_read_offset;
+    
+    // Signature, version 3.0 or 3.1, and the NULL mechanism
+    static const uint8_t signature[10] = { 0xff, 0, 0, 0, 0, 0, 0, 0, 1, 0x7f };
+    
+    if (memcmp(p, signature, sizeof(signature)) == 0 && p[10] == 3 && p[11] <= 1 && memcmp(p + 12, "NULL", 4) == 0)
+    {
+        Consume(ZMTP_GREETING_SIZE);
+        m_state = STATE_VALID;
+    }
+    else if (m_force_zmtp && (p[0] & 0xfc) == 0)
+    {
+        // The greeting was probably missed, but this looks like a frame
+        m_state = STATE_VALID;
+    }
+    else
+    {
+        m_buffer.clear();
+        m_read_offset = 0;
+        m_state = STATE_ERROR;
+    }
+}
+
+void ZmtpParser::Consume(size_t length)
+{
+    m_read_offset += length;
+}
@@ -0,0 +1,85 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2019 Malcolm Stagg
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * This file is a part of the CIRN Interaction Language.
+ */
+ 
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the ZMTP 3.x greeting
+#define ZMTP_GREETING_SIZE 64
+
+/*
+ * A ZMTP data frame. The payload is only valid until the parser is next
+ * appended to.
+ */
+struct ZmtpFrame
+{
+    const uint8_t * payload;
+    uint64_t length;
+    uint64_t frame_length; // Length of the frame including its header, as with ciltool's tcp_length
+};
+
+/*
+ * Splits one direction of a ZMTP 3.x connection into data frames, as with
+ * ciltool's ZmqConn. Only the NULL security mechanism is supported. If the
+ * capture missed the greeting, a connection can still be forced to be
+ * treated as ZMTP, for example by its port.
+ */
+class ZmtpParser
+{
+public:
+    ZmtpParser(bool force_zmtp);
+    
+    // Append in-order stream data
+    void Append(const uint8_t * data, size_t length);
+    
+    // Get the next complete data frame, skipping command frames. Returns false if more data is needed.
+    bool NextFrame(ZmtpFrame& frame);
+    
+    // Stop parsing, for example after part of the stream was never captured
+    void SetError() { m_state = STATE_ERROR; }
+    
+    bool IsError() const { return m_state == STATE_ERROR; }
+    bool IsValid() const { return m_state == STATE_VALID; }
+    
+protected:
+    enum State
+    {
+        STATE_UNKNOWN, // Waiting for the greeting
+        STATE_VALID,   // Reading frames
+        STATE_ERROR    // Not a supported ZMTP stream
+    };
+    
+    void CheckGreeting();
+    void Consume(size_t length);
+    
+    bool m_force_zmtp;
+    State m_state;
+    std::vector<uint8_t> m_buffer; // Unread stream data from m_read_offset
+    size_t m_read_offset;
+};
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+
+#include "binary_results.h"
+
+#define BINARY_RESULTS_MAGIC "SC2STATS"
+#define BINARY_RESULTS_ALIGNMENT 8
+
+// Size of the buffer used to write each measurement period column
+#define BINARY_COLUMN_BUFFER_SIZE (16 * 1024)
+
+static_assert(sizeof(Binary_Results_Header) == 16, "Binary results header layout must not change");
+static_assert(sizeof(Binary_Table_Header) == 16, "Binary table header layout must not change");
+static_assert(sizeof(Binary_Flow_Record) == 88, "Binary flow record layout must not change");
+
+namespace
+{
+    inline bool Is_Little_Endian()
+    {
+        uint32_t value = 1;
+        return *(const uint8_t *)&value == 1;
+    }
+
+    // True if a flow has traffic events, as for the flows in the JSON output
+    inline bool Has_Traffic_Events(const Flow_Info& info)
+    {
+        return info.on_time || info.off_time || info.listen_time || !info.mp_stats.Empty();
+    }
+
+    void Write_Bytes(const void * data, size_t size, FILE * output)
+    {
+        if (size > 0 && fwrite(data, 1, size, output) != size)
+        {
+            throw std::runtime_error("Error writing binary output!");
+        }
+    }
+    
+    // Pad the output from a section of the given size up to the next alignment boundary
+    void Write_Padding(size_t size, FILE * output)
+    {
+        static const char zeros[BINARY_RESULTS_ALIGNMENT] = { 0 };
+        Write_Bytes(zeros, (BINARY_RESULTS_ALIGNMENT - size % BINARY_RESULTS_ALIGNMENT) % BINARY_RESULTS_ALIGNMENT, output);
+    }
+    
+    // Write one measurement period column of every flow with traffic events, in flow order
+    template<class T, class Get_Value>
+    void Write_Column(const Flow_Info_Map& flow_info, FILE * output, Get_Value get_value)
+    {
+        std::vector<T> buffer;
+        buffer.reserve(BINARY_COLUMN_BUFFER_SIZE);
+        
+        size_t column_size = 0;
+        
+        for (Flow_Info_Map::const_iterator it = flow_info.begin(); it != flow_info.end(); it++)
+        {
+            if (!Has_Traffic_Events(it->second))
+            {
+                continue;
+            }
+            
+            it->second.mp_stats.For_Each([&buffer, &column_size, output, &get_value](int mp_num, const Measurement_Period_Stats& stats)
+            {
+                buffer.push_back(get_value(mp_num, stats));
+                
+                if (buffer.size() == BINARY_COLUMN_BUFFER_SIZE)
+                {
+                    Write_Bytes(&buffer[0], buffer.size() * sizeof(T), output);
+                    column_size += buffer.size() * sizeof(T);
+                    buffer.clear();
+                }
+            });
+        }
+        
+        if (!buffer.empty())
+        {
+            Write_Bytes(&buffer[0], buffer.size() * sizeof(T), output);
+            column_size += buffer.size() * sizeof(T);
+        }
+        
+        Write_Padding(column_size, output);
+    }
+
+    void Write_Table(const std::string& name, const Flow_Info_Map& flow_info, FILE * output)
+    {
+        std::vector<Binary_Flow_Record> records;
+        uint64_t num_mps = 0;
+        
+        for (Flow_Info_Map::const_iterator it = flow_info.begin(); it != flow_info.end(); it++)
+        {
+            const Flow_Info& info = it->second;
+            
+            if (!Has_Traffic_Events(info))
+            {
+                continue;
+            }
+            
+            Binary_Flow_Record record;
+            memset(&record, 0, sizeof(record));
+            
+            record.flow = it->first;
+            
+            if (info.max_latency) { record.present |= BINARY_FLOW_MAX_LATENCY; record.max_latency = *info.max_latency; }
+            if (info.on_time)     { record.present |= BINARY_FLOW_ON_TIME;     record.on_time = *info.on_time; }
+            if (info.off_time)    { record.present |= BINARY_FLOW_OFF_TIME;    record.off_time = *info.off_time; }
+            if (info.listen_time) { record.present |= BINARY_FLOW_LISTEN_TIME; record.listen_time = *info.listen_time; }
+            if (info.size)        { record.present |= BINARY_FLOW_SIZE;        record.size = *info.size; }
+            if (info.tos)         { record.present |= BINARY_FLOW_TOS;         record.tos = *info.tos; }
+            if (info.srcAddr)     { record.present |= BINARY_FLOW_SRC_ADDR;    record.src_addr = *info.srcAddr; }
+            if (info.srcPort)     { record.present |= BINARY_FLOW_SRC_PORT;    record.src_port = *info.srcPort; }
+            if (info.dstAddr)     { record.present |= BINARY_FLOW_DST_ADDR;    record.dst_addr = *info.dstAddr; }
+            if (info.dstPort)     { record.present |= BINARY_FLOW_DST_PORT;    record.dst_port = *info.dstPort; }
+            
+            if (info.proto)
+            {
+                if (info.proto->size() > sizeof(record.proto))
+                {
+                    throw std::runtime_error("Protocol \"" + *info.proto + "\" is too long for binary output!");
+                }
+                
+                record.present |= BINARY_FLOW_PROTO;
+                memcpy(record.proto, info.proto->data(), info.proto->size());
+            }
+            
+            record.mp_offset = num_mps;
+            info.mp_stats.For_Each([&record](int, const Measurement_Period_Stats&) { record.mp_count++; });
+            num_mps += record.mp_count;
+            
+            records.push_back(record);
+        }
+        
+        Binary_Table_Header table_header;
+        table_header.name_size = name.size();
+        table_header.num_flows = records.size();
+        table_header.num_mps = num_mps;
+        
+        Write_Bytes(&table_header, sizeof(table_header), output);
+        Write_Bytes(name.data(), name.size(), output);
+        Write_Padding(name.size(), output);
+        Write_Bytes(records.data(), records.size() * sizeof(Binary_Flow_Record), output);
+        
+        Write_Column<int32_t>(flow_info, output, [](int mp_num, const Measurement_Period_Stats&) { return mp_num; });
+        Write_Column<uint32_t>(flow_info, output, [](int, const Measurement_Period_Stats& stats) { return stats.sent; });
+        Write_Column<uint32_t>(flow_info, output, [](int, const Measurement_Period_Stats& stats) { return stats.received; });
+        Write_Column<uint32_t>(flow_info, output, [](int, const Measurement_Period_Stats& stats) { return stats.duplicate; });
+        Write_Column<uint32_t>(flow_info, output, [](int, const Measurement_Period_Stats& stats) { return stats.late; });
+    }
+    
+    void Write_Header(uint32_t num_tables, FILE * output)
+    {
+        // Values are written in host byte order
+        if (!Is_Little_Endian())
+        {
+            throw std::runtime_error("Binary output is only supported on little-endian hosts!");
+        }
+        
+        Binary_Results_Header header;
+        memcpy(header.magic, BINARY_RESULTS_MAGIC, sizeof(header.magic));
+        header.version = BINARY_RESULTS_VERSION;
+        header.num_tables = num_tables;
+        
+        Write_Bytes(&header, sizeof(header), output);
+    }
+}
+
+void Write_Binary_Flow_Traffic_Stats(const Flow_Info_Map& flow_info, FILE * output)
+{
+    Write_Header(1, output);
+    Write_Table(std::string(), flow_info, output);
+    
+    if (fflush(output) != 0)
+    {
+        throw std::runtime_error("Error writing binary output!");
+    }
+}
+
+void Write_Binary_Match_Traffic_Stats(const Match_Flow_Info_Map& match_flow_info, FILE * output)
+{
+    Write_Header(match_flow_info.size(), output);
+    
+    for (Match_Flow_Info_Map::const_iterator it = match_flow_info.begin(); it != match_flow_info.end(); it++)
+    {
+        Write_Table(it->first, it->second, output);
+    }
+    
+    if (fflush(output) != 0)
+    {
+        throw std::runtime_error("Error writing binary output!");
+    }
+}
+
+std::string Get_Binary_Flow_Traffic_Stats(const Flow_Info_Map& flow_info)
+{
+    char * buffer = NULL;
+    size_t size = 0;
+    
+    FILE * output = open_memstream(&buffer, &size);
+    if (!output)
+    {
+        throw std::runtime_error("Cannot allocate binary output!");
+    }
+    
+    try
+    {
+        Write_Binary_Flow_Traffic_Stats(flow_info, output);
+    }
+    catch (...)
+    {
+        fclose(output);
+        free(buffer);
+        throw;
+    }
+    
+    fclose(output);
+    
+    std::string results(buffer, size);
+    free(buffer);
+    
+    return results;
+}
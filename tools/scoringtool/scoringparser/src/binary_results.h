@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "scoring_parser.h"
+
+// Version of the binary results layout, incremented whenever it changes
+#define BINARY_RESULTS_VERSION 1
+
+/*
+ * Binary columnar scoring results layout, for readers which map the
+ * statistics straight into arrays. All values are little-endian, and each
+ * section starts on an 8 byte boundary:
+ *
+ *   Binary_Results_Header
+ *   num_tables times:
+ *     Binary_Table_Header
+ *     char     name[name_size]            (send filename in batch mode, otherwise empty)
+ *     Binary_Flow_Record flows[num_flows]
+ *     int32_t  time[num_mps]              (measurement period number)
+ *     uint32_t sent, received, duplicate, late [num_mps each]
+ *
+ * The measurement periods of each flow are the range [mp_offset,
+ * mp_offset + mp_count) of its table's columns, in time order. Flows and
+ * measurement periods are the same as in the JSON output.
+ */
+struct Binary_Results_Header
+{
+    char magic[8];              // BINARY_RESULTS_MAGIC, "SC2STATS"
+    uint32_t version;           // BINARY_RESULTS_VERSION
+    uint32_t num_tables;        // number of flow tables following
+};
+
+struct Binary_Table_Header
+{
+    uint32_t name_size;         // size of the table name, in bytes
+    uint32_t num_flows;         // number of flow records
+    uint64_t num_mps;           // number of entries in each measurement period column
+};
+
+// Bits of Binary_Flow_Record::present, set for each flow parameter which is known
+enum Binary_Flow_Field
+{
+    BINARY_FLOW_MAX_LATENCY = 1 << 0,
+    BINARY_FLOW_ON_TIME     = 1 << 1,
+    BINARY_FLOW_OFF_TIME    = 1 << 2,
+    BINARY_FLOW_LISTEN_TIME = 1 << 3,
+    BINARY_FLOW_PROTO       = 1 << 4,
+    BINARY_FLOW_SIZE        = 1 << 5,
+    BINARY_FLOW_TOS         = 1 << 6,
+    BINARY_FLOW_SRC_ADDR    = 1 << 7,
+    BINARY_FLOW_SRC_PORT    = 1 << 8,
+    BINARY_FLOW_DST_ADDR    = 1 << 9,
+    BINARY_FLOW_DST_PORT    = 1 << 10
+};
+
+// Flow parameters, which are zero when not present
+struct Binary_Flow_Record
+{
+    uint32_t flow;              // flow UID
+    uint32_t present;           // Binary_Flow_Field bits
+    double max_latency;
+    double on_time;
+    double off_time;
+    double listen_time;
+    uint32_t size;
+    uint32_t tos;
+    uint32_t src_addr;          // IPv4 address, with the first octet in the most significant byte
+    uint32_t src_port;
+    uint32_t dst_addr;          // IPv4 address, with the first octet in the most significant byte
+    uint32_t dst_port;
+    char proto[8];              // protocol name, zero padded
+    uint64_t mp_offset;         // index of the flow's first measurement period in the columns
+    uint64_t mp_count;          // number of measurement periods of the flow
+};
+
+// Write the statistics of one flow table, with an empty table name
+void Write_Binary_Flow_Traffic_Stats(const Flow_Info_Map& flow_info, FILE * output);
+
+// Write the statistics of every DRC file pair in a match, as one table per send filename
+void Write_Binary_Match_Traffic_Stats(const Match_Flow_Info_Map& match_flow_info, FILE * output);
+
+// The same bytes as Write_Binary_Flow_Traffic_Stats, in memory
+std::string Get_Binary_Flow_Traffic_Stats(const Flow_Info_Map& flow_info);
@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <stdexcept>
+#include <string>
+
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compressed_reader.h"
+
+// Number of blocks in the ring between the decompression thread and the parser
+#define NUM_DECOMPRESSED_BLOCKS 4
+
+// Initial size of each decompressed block, in bytes
+#define DECOMPRESSED_BLOCK_SIZE (4 * 1024 * 1024)
+
+// Size of each read of compressed data, in bytes
+#define COMPRESSED_READ_SIZE (256 * 1024)
+
+namespace
+{
+    // Read compressed input, returning the number of bytes read or 0 at the end of the file
+    inline size_t Read_Input(int fd, void * buffer, size_t size)
+    {
+        ssize_t bytes_read;
+        do
+        {
+            bytes_read = read(fd, buffer, size);
+        } while (bytes_read < 0 && errno == EINTR);
+        
+        if (bytes_read < 0)
+        {
+            throw std::runtime_error(std::string("Cannot read compressed DRC file: ") + strerror(errno));
+        }
+        
+        return bytes_read;
+    }
+    
+    // Decompressor for gzip (and zlib) data, including concatenated gzip members
+    class Gzip_Decompressor : public Decompressor
+    {
+    public:
+        Gzip_Decompressor(int fd) :
+            m_fd(fd),
+            m_input(COMPRESSED_READ_SIZE),
+            m_input_eof(false),
+            m_in_member(false),
+            m_member_ended(false),
+            m_finished(false)
+        {
+            memset(&m_stream, 0, sizeof(m_stream));
+            
+            // Automatically detect a gzip or zlib header
+            if (inflateInit2(&m_stream, 15 + 32) != Z_OK)
+            {
+                throw std::runtime_error("Cannot initialize gzip decompression!");
+            }
+        }
+        
+        virtual ~Gzip_Decompressor()
+        {
+            inflateEnd(&m_stream);
+        }
+        
+        virtual bool Decompress(char * out, size_t out_size, size_t& produced)
+        {
+            m_stream.next_out = (Bytef *)out;
+            m_stream.avail_out = out_size;
+            
+            while (!m_finished && m_stream.avail_out > 0)
+            {
+                if (m_stream.avail_in == 0 && !m_input_eof)
+                {
+                    size_t input_size = Read_Input(m_fd, &m_input[0], m_input.size());
+                    m_input_eof = (input_size == 0);
+                    m_stream.next_in = &m_input[0];
+                    m_stream.avail_in = input_size;
+                }
+                
+                int ret = inflate(&m_stream, Z_NO_FLUSH);
+                
+                // Nothing has been decompressed from the current member if it is not a gzip header
+                bool at_member_boundary = m_member_ended && m_stream.total_out == 0;
+                
+                if (ret == Z_STREAM_END)
+                {
+                    // Another gzip member may follow
+                    m_in_member = false;
+                    m_member_ended = true;
+                    inflateReset(&m_stream);
+                }
+                else if (ret == Z_BUF_ERROR && m_stream.avail_in == 0 && m_input_eof)
+                {
+                    if (m_in_member && !at_member_boundary)
+                    {
+                        throw std::runtime_error("Compressed DRC file is truncated!");
+                    }
+                    
+                    if (m_in_member)
+                    {
+                        m_warning = "Ignored trailing data after the last gzip member";
+                    }
+                    
+                    m_finished = true;
+                }
+                else if (ret == Z_OK || ret == Z_BUF_ERROR)
+                {
+                    m_in_member = true;
+                }
+                else if (ret == Z_DATA_ERROR && at_member_boundary)
+                {
+                    // As with gzip -d, such as zero padding after the last member
+                    m_warning = "Ignored trailing data after the last gzip member";
+                    m_finished = true;
+                }
+                else
+                {
+                    throw std::runtime_error(std::string("Cannot decompress gzip DRC file: ") + (m_stream.msg ? m_stream.msg : "unknown error"));
+                }
+            }
+            
+            produced = out_size - m_stream.avail_out;
+            return !m_finished;
+        }
+        
+    protected:
+        int m_fd;
+        z_stream m_stream;
+        std::vector<unsigned char> m_input;
+        bool m_input_eof;       // true once all compressed input has been read
+        bool m_in_member;       // true while part way through a gzip member
+        bool m_member_ended;    // true once any gzip member has been completely decompressed
+        bool m_finished;        // true once all input has been decompressed
+    };
+    
+#ifdef HAVE_ZSTD
+    // Decompressor for zstd data, including concatenated frames
+    class Zstd_Decompressor : public Decompressor
+    {
+    public:
+        Zstd_Decompressor(int fd) :
+            m_fd(fd),
+            m_stream(ZSTD_createDStream()),
+            m_input(COMPRESSED_READ_SIZE),
+            m_input_eof(false),
+            m_frame_remaining(0),
+            m_finished(false)
+        {
+            if (!m_stream || ZSTD_isError(ZSTD_initDStream(m_stream)))
+            {
+                throw std::runtime_error("Cannot initialize zstd decompression!");
+            }
+            
+            m_in.src = &m_input[0];
+            m_in.size = 0;
+            m_in.pos = 0;
+        }
+        
+        virtual ~Zstd_Decompressor()
+        {
+            ZSTD_freeDStream(m_stream);
+        }
+        
+        virtual bool Decompress(char * out, size_t out_size, size_t& produced)
+        {
+            ZSTD_outBuffer out_buffer = { out, out_size, 0 };
+            
+            while (!m_finished && out_buffer.pos < out_buffer.size)
+            {
+                if (m_in.pos == m_in.size && !m_input_eof)
+                {
+                    m_in.size = Read_Input(m_fd, &m_input[0], m_input.size());
+                    m_in.pos = 0;
+                    m_input_eof = (m_in.size == 0);
+                }
+                
+                size_t previous_pos = out_buffer.pos;
+                size_t ret = ZSTD_decompressStream(m_stream, &out_buffer, &m_in);
+                
+                if (ZSTD_isError(ret))
+                {
+                    throw std::runtime_error(std::string("Cannot decompress zstd DRC file: ") + ZSTD_getErrorName(ret));
+                }
+                
+                m_frame_remaining = ret;
+                
+                if (m_in.pos == m_in.size && m_input_eof && out_buffer.pos == previous_pos)
+                {
+                    if (m_frame_remaining != 0)
+                    {
+                        throw std::runtime_error("Compressed DRC file is truncated!");
+                    }
+                    
+                    m_finished = true;
+                }
+            }
+            
+            produced = out_buffer.pos;
+            return !m_finished;
+        }
+        
+    protected:
+        int m_fd;
+        ZSTD_DStream * m_stream;
+        std::vector<char> m_input;
+        ZSTD_inBuffer m_in;
+        bool m_input_eof;           // true once all compressed input has been read
+        size_t m_frame_remaining;   // zero if the last frame was completely decoded
+        bool m_finished;            // true once all input has been decompressed
+    };
+#endif
+}
+
+Compressed_Reader::Compressed_Reader(int fd, Compression_Type type) :
+    m_fd(fd),
+    m_blocks(NUM_DECOMPRESSED_BLOCKS),
+    m_done(false),
+    m_stop(false)
+{
+    try
+    {
+        switch (type)
+        {
+        case COMPRESSION_GZIP:
+            m_decompressor.reset(new Gzip_Decompressor(fd));
+            break;
+#ifdef HAVE_ZSTD
+        case COMPRESSION_ZSTD:
+            m_decompressor.reset(new Zstd_Decompressor(fd));
+            break;
+#else
+        case COMPRESSION_ZSTD:
+            throw std::runtime_error("zstd compressed DRC files are not supported by this build!");
+#endif
+        default:
+            throw std::runtime_error("Unknown DRC file compression!");
+        }
+    }
+    catch (...)
+    {
+        close(m_fd);
+        throw;
+    }
+    
+    for (size_t i = 0; i < m_blocks.size(); i++)
+    {
+        m_blocks[i].data.resize(DECOMPRESSED_BLOCK_SIZE);
+        m_blocks[i].size = 0;
+        m_free_blocks.push_back(&m_blocks[i]);
+    }
+    
+    m_thread = std::thread(&Compressed_Reader::Run, this);
+}
+
+Compressed_Reader::~Compressed_Reader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    
+    m_condition.notify_all();
+    m_thread.join();
+    close(m_fd);
+}
+
+Compression_Type Compressed_Reader::Detect(int fd)
+{
+    unsigned char magic[4];
+    ssize_t magic_size = pread(fd, magic, sizeof(magic), 0);
+    
+    if (magic_size >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+    {
+        return COMPRESSION_GZIP;
+    }
+    
+    if (magic_size >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+    {
+        return COMPRESSION_ZSTD;
+    }
+    
+    return COMPRESSION_NONE;
+}
+
+const Decompressed_Block * Compressed_Reader::Next_Block()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    
+    while (m_filled_blocks.empty() && !m_done)
+    {
+        m_condition.wait(lock);
+    }
+    
+    if (!m_filled_blocks.empty())
+    {
+        Decompressed_Block * block = m_filled_blocks.front();
+        m_filled_blocks.pop_front();
+        return block;
+    }
+    
+    if (m_error)
+    {
+        std::exception_ptr error = m_error;
+        m_error = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+    
+    return NULL;
+}
+
+void Compressed_Reader::Release_Block(const Decompressed_Block * block)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free_blocks.push_back(const_cast<Decompressed_Block *>(block));
+    }
+    
+    m_condition.notify_all();
+}
+
+std::string Compressed_Reader::Warning()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_decompressor->Warning();
+}
+
+void Compressed_Reader::Run()
+{
+    std::vector<char> carry;    // partial line at the end of the previous block
+    bool more_input = true;
+    
+    try
+    {
+        while (more_input)
+        {
+            Decompressed_Block * block;
+            
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                
+                while (m_free_blocks.empty() && !m_stop)
+                {
+                    m_condition.wait(lock);
+                }
+                
+                if (m_stop)
+                {
+                    return;
+                }
+                
+                block = m_free_blocks.front();
+                m_free_blocks.pop_front();
+            }
+            
+            if (block->data.size() < carry.size() * 2)
+            {
+                block->data.resize(carry.size() * 2);
+            }
+            
+            if (!carry.empty())
+            {
+                memcpy(&block->data[0], &carry[0], carry.size());
+            }
+            
+            size_t filled = carry.size();
+            carry.clear();
+            
+            while (true)
+            {
+                while (more_input && filled < block->data.size())
+                {
+                    size_t produced;
+                    more_input = m_decompressor->Decompress(&block->data[filled], block->data.size() - filled, produced);
+                    filled += produced;
+                }
+                
+                if (!more_input)
+                {
+                    block->size = filled;
+                    break;
+                }
+                
+                const char * last_newline = (const char *)memrchr(&block->data[0], '\n', filled);
+                
+                if (last_newline)
+                {
+                    block->size = last_newline + 1 - &block->data[0];
+                    carry.assign(block->data.begin() + block->size, block->data.begin() + filled);
+                    break;
+                }
+                
+                // A single line is longer than the block
+                block->data.resize(block->data.size() * 2);
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                
+                if (block->size > 0)
+                {
+                    m_filled_blocks.push_back(block);
+                }
+                else
+                {
+                    m_free_blocks.push_back(block);
+                }
+            }
+            
+            m_condition.notify_all();
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = std::current_exception();
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    
+    m_condition.notify_all();
+}
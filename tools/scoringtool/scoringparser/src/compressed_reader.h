@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <string>
+
+enum Compression_Type
+{
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD
+};
+
+// Block of decompressed data, which always ends on a line boundary except at the end of the file
+struct Decompressed_Block
+{
+    std::vector<char> data;     // allocated buffer
+    size_t size;                // number of valid bytes in data
+};
+
+// Streaming decoder for one compression format
+class Decompressor
+{
+public:
+    virtual ~Decompressor() {}
+
+    // Decompress up to out_size bytes. Returns false once the end of the input has been reached.
+    virtual bool Decompress(char * out, size_t out_size, size_t& produced) = 0;
+
+    // Problem with the input which did not stop decompression, such as ignored trailing data, or empty if none
+    const std::string& Warning() const { return m_warning; }
+
+protected:
+    std::string m_warning;
+};
+
+/*
+ * Decompresses a file on a separate thread into a bounded ring of blocks,
+ * so decompression overlaps with parsing. Each block holds only complete
+ * lines, so it can be parsed in place.
+ */
+class Compressed_Reader
+{
+public:
+    // Takes ownership of the file descriptor
+    Compressed_Reader(int fd, Compression_Type type);
+    virtual ~Compressed_Reader();
+
+    // Detect the compression format of a file from its magic bytes
+    static Compression_Type Detect(int fd);
+
+    // Wait for the next block of lines. Returns NULL at the end of the file.
+    const Decompressed_Block * Next_Block();
+
+    // Return a block from Next_Block to be reused
+    void Release_Block(const Decompressed_Block * block);
+
+    // Warning of the decompressor, once Next_Block has returned NULL
+    std::string Warning();
+
+protected:
+    void Run();
+
+    int m_fd;
+    std::unique_ptr<Decompressor> m_decompressor;
+
+    std::vector<Decompressed_Block> m_blocks;           // storage for all blocks in the ring
+    std::deque<Decompressed_Block *> m_free_blocks;     // blocks waiting to be filled
+    std::deque<Decompressed_Block *> m_filled_blocks;   // blocks waiting to be parsed
+    bool m_done;                                        // true once the thread has filled its last block
+    bool m_stop;                                        // true if the thread should exit early
+    std::exception_ptr m_error;                         // error hit by the thread, if any
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::thread m_thread;
+
+private:
+    Compressed_Reader(const Compressed_Reader&);
+    Compressed_Reader& operator=(const Compressed_Reader&);
+};
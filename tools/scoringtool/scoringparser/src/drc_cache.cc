@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "drc_cache.h"
+
+#define DRC_CACHE_MAGIC "DRCCACHE"
+#define DRC_CACHE_BYTE_ORDER 0x01020304
+#define DRC_CACHE_ALIGNMENT 8
+
+static_assert(sizeof(DRC_Cache_Header) % DRC_CACHE_ALIGNMENT == 0, "DRC cache header must keep columns aligned");
+
+namespace
+{
+    // Round a size up to the cache column alignment
+    inline size_t Align(size_t size)
+    {
+        return (size + DRC_CACHE_ALIGNMENT - 1) & ~(size_t)(DRC_CACHE_ALIGNMENT - 1);
+    }
+    
+    // Map the next column of a cache, advancing offset past it. Returns NULL if the cache is too small.
+    template<class T>
+    inline const T * Map_Column(const char * data, size_t size, size_t& offset, size_t count)
+    {
+        size_t column_size = count * sizeof(T);
+        if (count > size / sizeof(T) || offset > size - column_size)
+        {
+            return NULL;
+        }
+        
+        const T * column = (const T *)(data + offset);
+        offset += Align(column_size);
+        return column;
+    }
+    
+    // Copy entries [begin, begin + count) of a mapped column into a batch column
+    template<class T>
+    inline void Copy_Column(std::vector<T>& dest, const T * column, size_t begin, size_t count)
+    {
+        memcpy(&dest[0], column + begin, count * sizeof(T));
+    }
+    
+    // Append the first count entries of a batch column to a builder column
+    template<class T>
+    inline void Append_Column(std::vector<T>& dest, const std::vector<T>& column, size_t count)
+    {
+        dest.insert(dest.end(), column.begin(), column.begin() + count);
+    }
+    
+    // Append a builder column to another, releasing its memory
+    template<class T>
+    inline void Move_Column(std::vector<T>& dest, std::vector<T>& column)
+    {
+        dest.insert(dest.end(), column.begin(), column.end());
+        std::vector<T>().swap(column);
+    }
+    
+    // Write a column followed by its alignment padding
+    template<class T>
+    inline bool Write_Column(FILE * file, const std::vector<T>& column)
+    {
+        static const char padding[DRC_CACHE_ALIGNMENT] = {0};
+        size_t column_size = column.size() * sizeof(T);
+        size_t padding_size = Align(column_size) - column_size;
+        
+        return (column.empty() || fwrite(&column[0], sizeof(T), column.size(), file) == column.size()) &&
+            (padding_size == 0 || fwrite(padding, 1, padding_size, file) == padding_size);
+    }
+}
+
+bool DRC_Cache_Source::Read(const char * drc_filename)
+{
+    struct stat file_stat;
+    if (stat(drc_filename, &file_stat) != 0)
+    {
+        return false;
+    }
+    
+    size = file_stat.st_size;
+    mtime_sec = file_stat.st_mtim.tv_sec;
+    mtime_nsec = file_stat.st_mtim.tv_nsec;
+    return true;
+}
+
+bool DRC_Cache_Source::operator==(const DRC_Cache_Source& other) const
+{
+    return size == other.size && mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+}
+
+DRC_Cache::DRC_Cache(const char * cache_filename, const char * drc_filename) :
+    m_data(NULL),
+    m_map_size(0),
+    m_mapped(false),
+    m_header(NULL),
+    m_num_events(0),
+    m_pos(0),
+    m_end(0)
+{
+    DRC_Cache_Source source;
+    if (!source.Read(drc_filename))
+    {
+        return;
+    }
+    
+    int fd = open(cache_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && (size_t)file_stat.st_size >= sizeof(DRC_Cache_Header))
+    {
+        void * mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            madvise(mapping, file_stat.st_size, MADV_SEQUENTIAL);
+            m_data = (const char *)mapping;
+            m_map_size = file_stat.st_size;
+            m_mapped = true;
+        }
+    }
+    
+    close(fd);
+    
+    if (!m_mapped)
+    {
+        return;
+    }
+    
+    const DRC_Cache_Header * header = (const DRC_Cache_Header *)m_data;
+    DRC_Cache_Source cached_source = { header->source_size, header->source_mtime_sec, header->source_mtime_nsec };
+    
+    if (memcmp(header->magic, DRC_CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != DRC_CACHE_VERSION ||
+        header->byte_order != DRC_CACHE_BYTE_ORDER ||
+        !(cached_source == source) ||
+        !Map_Columns())
+    {
+        return;
+    }
+    
+    m_header = header;
+    m_end = m_num_events;
+}
+
+DRC_Cache::DRC_Cache(const DRC_Cache& source, size_t range_begin, size_t range_end) :
+    m_data(source.m_data),
+    m_map_size(source.m_map_size),
+    m_mapped(false),
+    m_header(source.m_header),
+    m_num_events(source.m_num_events),
+    m_pos(std::min(range_begin, source.m_num_events)),
+    m_end(std::min(range_end, source.m_num_events)),
+    m_time(source.m_time),
+    m_sent(source.m_sent),
+    m_fields(source.m_fields),
+    m_port(source.m_port),
+    m_flow(source.m_flow),
+    m_seq(source.m_seq),
+    m_frag(source.m_frag),
+    m_tos(source.m_tos),
+    m_dstAddr(source.m_dstAddr),
+    m_dstPort(source.m_dstPort),
+    m_srcAddr(source.m_srcAddr),
+    m_srcPort(source.m_srcPort),
+    m_size(source.m_size),
+    m_proto(source.m_proto),
+    m_action(source.m_action),
+    m_strings(source.m_strings)
+{
+}
+
+DRC_Cache::~DRC_Cache()
+{
+    if (m_mapped)
+    {
+        munmap((void *)m_data, m_map_size);
+    }
+}
+
+bool DRC_Cache::Map_Columns()
+{
+    const DRC_Cache_Header * header = (const DRC_Cache_Header *)m_data;
+    size_t offset = sizeof(DRC_Cache_Header);
+    size_t count = header->num_events;
+    
+    m_time = Map_Column<double>(m_data, m_map_size, offset, count);
+    m_sent = Map_Column<double>(m_data, m_map_size, offset, count);
+    m_fields = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_port = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_flow = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_seq = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_frag = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_tos = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_dstAddr = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_dstPort = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_srcAddr = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_srcPort = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_size = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_proto = Map_Column<uint32_t>(m_data, m_map_size, offset, count);
+    m_action = Map_Column<uint8_t>(m_data, m_map_size, offset, count);
+    
+    const uint32_t * string_offsets = Map_Column<uint32_t>(m_data, m_map_size, offset, header->num_strings + (size_t)1);
+    const char * strings = Map_Column<char>(m_data, m_map_size, offset, header->strings_size);
+    
+    if (!m_time || !m_sent || !m_fields || !m_port || !m_flow || !m_seq || !m_frag || !m_tos ||
+        !m_dstAddr || !m_dstPort || !m_srcAddr || !m_srcPort || !m_size || !m_proto || !m_action ||
+        !string_offsets || !strings || offset != Align(m_map_size))
+    {
+        return false;
+    }
+    
+    m_strings.clear();
+    for (uint32_t i = 0; i < header->num_strings; i++)
+    {
+        if (string_offsets[i] > string_offsets[i + 1] || string_offsets[i + 1] > header->strings_size)
+        {
+            return false;
+        }
+        
+        m_strings.push_back(boost::string_ref(strings + string_offsets[i], string_offsets[i + 1] - string_offsets[i]));
+    }
+    
+    // Only proto indices need checking, every other column is valid for any value
+    for (size_t i = 0; i < count; i++)
+    {
+        if ((m_fields[i] & TRAFFIC_FIELD_PROTO) && m_proto[i] >= header->num_strings)
+        {
+            return false;
+        }
+    }
+    
+    m_num_events = count;
+    return true;
+}
+
+bool DRC_Cache::Next_Batch(Traffic_Event_Batch& batch)
+{
+    size_t count = std::min(batch.Capacity(), m_end - m_pos);
+    batch.count = count;
+    
+    if (count == 0)
+    {
+        return false;
+    }
+    
+    Copy_Column(batch.action, m_action, m_pos, count);
+    Copy_Column(batch.fields, m_fields, m_pos, count);
+    Copy_Column(batch.time, m_time, m_pos, count);
+    Copy_Column(batch.sent, m_sent, m_pos, count);
+    Copy_Column(batch.port, m_port, m_pos, count);
+    Copy_Column(batch.flow, m_flow, m_pos, count);
+    Copy_Column(batch.seq, m_seq, m_pos, count);
+    Copy_Column(batch.frag, m_frag, m_pos, count);
+    Copy_Column(batch.tos, m_tos, m_pos, count);
+    Copy_Column(batch.dstAddr, m_dstAddr, m_pos, count);
+    Copy_Column(batch.dstPort, m_dstPort, m_pos, count);
+    Copy_Column(batch.srcAddr, m_srcAddr, m_pos, count);
+    Copy_Column(batch.srcPort, m_srcPort, m_pos, count);
+    Copy_Column(batch.size, m_size, m_pos, count);
+    
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t n = m_pos + i;
+        batch.proto[i] = (m_fields[n] & TRAFFIC_FIELD_PROTO) ? m_strings[m_proto[n]] : boost::string_ref();
+    }
+    
+    m_pos += count;
+    return true;
+}
+
+DRC_Cache_Builder::DRC_Cache_Builder() :
+    m_has_source(false)
+{
+}
+
+bool DRC_Cache_Builder::Set_Source(const char * drc_filename)
+{
+    m_has_source = m_source.Read(drc_filename);
+    return m_has_source;
+}
+
+uint32_t DRC_Cache_Builder::Intern(const boost::string_ref& value)
+{
+    // Only a handful of distinct strings (UDP/TCP) are expected
+    for (size_t i = 0; i < m_strings.size(); i++)
+    {
+        if (m_strings[i] == value)
+        {
+            return i;
+        }
+    }
+    
+    m_strings.push_back(value.to_string());
+    return m_strings.size() - 1;
+}
+
+void DRC_Cache_Builder::Append(const Traffic_Event_Batch& batch)
+{
+    size_t count = batch.count;
+    
+    Append_Column(m_action, batch.action, count);
+    Append_Column(m_fields, batch.fields, count);
+    Append_Column(m_time, batch.time, count);
+    Append_Column(m_sent, batch.sent, count);
+    Append_Column(m_port, batch.port, count);
+    Append_Column(m_flow, batch.flow, count);
+    Append_Column(m_seq, batch.seq, count);
+    Append_Column(m_frag, batch.frag, count);
+    Append_Column(m_tos, batch.tos, count);
+    Append_Column(m_dstAddr, batch.dstAddr, count);
+    Append_Column(m_dstPort, batch.dstPort, count);
+    Append_Column(m_srcAddr, batch.srcAddr, count);
+    Append_Column(m_srcPort, batch.srcPort, count);
+    Append_Column(m_size, batch.size, count);
+    
+    for (size_t i = 0; i < count; i++)
+    {
+        m_proto.push_back((batch.fields[i] & TRAFFIC_FIELD_PROTO) ? Intern(batch.proto[i]) : 0);
+    }
+}
+
+void DRC_Cache_Builder::Append(DRC_Cache_Builder& other)
+{
+    for (size_t i = 0; i < other.m_proto.size(); i++)
+    {
+        if (other.m_fields[i] & TRAFFIC_FIELD_PROTO)
+        {
+            m_proto.push_back(Intern(other.m_strings[other.m_proto[i]]));
+        }
+        else
+        {
+            m_proto.push_back(0);
+        }
+    }
+    std::vector<uint32_t>().swap(other.m_proto);
+    
+    Move_Column(m_action, other.m_action);
+    Move_Column(m_fields, other.m_fields);
+    Move_Column(m_time, other.m_time);
+    Move_Column(m_sent, other.m_sent);
+    Move_Column(m_port, other.m_port);
+    Move_Column(m_flow, other.m_flow);
+    Move_Column(m_seq, other.m_seq);
+    Move_Column(m_frag, other.m_frag);
+    Move_Column(m_tos, other.m_tos);
+    Move_Column(m_dstAddr, other.m_dstAddr);
+    Move_Column(m_dstPort, other.m_dstPort);
+    Move_Column(m_srcAddr, other.m_srcAddr);
+    Move_Column(m_srcPort, other.m_srcPort);
+    Move_Column(m_size, other.m_size);
+}
+
+bool DRC_Cache_Builder::Write(const char * cache_filename, const char * drc_filename) const
+{
+    // A source which changed while it was parsed may not match the events read from it
+    DRC_Cache_Source source;
+    if (!m_has_source || !source.Read(drc_filename) || !(source == m_source))
+    {
+        return false;
+    }
+    
+    std::vector<uint32_t> string_offsets(1, 0);
+    std::vector<char> strings;
+    for (size_t i = 0; i < m_strings.size(); i++)
+    {
+        strings.insert(strings.end(), m_strings[i].begin(), m_strings[i].end());
+        string_offsets.push_back(strings.size());
+    }
+    
+    DRC_Cache_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DRC_CACHE_MAGIC, sizeof(header.magic));
+    header.version = DRC_CACHE_VERSION;
+    header.byte_order = DRC_CACHE_BYTE_ORDER;
+    header.source_size = m_source.size;
+    header.source_mtime_sec = m_source.mtime_sec;
+    header.source_mtime_nsec = m_source.mtime_nsec;
+    header.num_events = m_action.size();
+    header.num_strings = m_strings.size();
+    header.strings_size = strings.size();
+    
+    // Write to a temporary file first, so a partially written cache is never read
+    std::string temp_filename = std::string(cache_filename) + ".tmp";
+    FILE * file = fopen(temp_filename.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        Write_Column(file, m_time) &&
+        Write_Column(file, m_sent) &&
+        Write_Column(file, m_fields) &&
+        Write_Column(file, m_port) &&
+        Write_Column(file, m_flow) &&
+        Write_Column(file, m_seq) &&
+        Write_Column(file, m_frag) &&
+        Write_Column(file, m_tos) &&
+        Write_Column(file, m_dstAddr) &&
+        Write_Column(file, m_dstPort) &&
+        Write_Column(file, m_srcAddr) &&
+        Write_Column(file, m_srcPort) &&
+        Write_Column(file, m_size) &&
+        Write_Column(file, m_proto) &&
+        Write_Column(file, m_action) &&
+        Write_Column(file, string_offsets) &&
+        Write_Column(file, strings);
+    
+    if (fclose(file) != 0 || !written || rename(temp_filename.c_str(), cache_filename) != 0)
+    {
+        remove(temp_filename.c_str());
+        return false;
+    }
+    
+    return true;
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "traffic_parser.h"
+
+// Suffix appended to a DRC filename to give its cache filename
+#define DRC_CACHE_SUFFIX ".cache"
+
+// Version of the cache file layout, incremented whenever it changes
+#define DRC_CACHE_VERSION 1
+
+/*
+ * Binary columnar DRC cache file layout. All values are in host byte order,
+ * and each column starts on an 8 byte boundary:
+ *
+ *   DRC_Cache_Header
+ *   double   time[num_events]
+ *   double   sent[num_events]      (event time when no sent timestamp is present)
+ *   uint32_t fields[num_events]    (Traffic_Field bits)
+ *   uint32_t port, flow, seq, frag, tos, dstAddr, dstPort, srcAddr, srcPort, size [num_events each]
+ *   uint32_t proto[num_events]     (index into the string table)
+ *   uint8_t  action[num_events]    (Traffic_Action)
+ *   uint32_t string_offsets[num_strings + 1]
+ *   char     strings[strings_size]
+ *
+ * A cache holds the events of a complete, successful parse of its source
+ * file, which is identified by its size and modification time.
+ */
+struct DRC_Cache_Header
+{
+    char magic[8];              // DRC_CACHE_MAGIC
+    uint32_t version;           // DRC_CACHE_VERSION
+    uint32_t byte_order;        // DRC_CACHE_BYTE_ORDER as written by the host which created the cache
+    uint64_t source_size;       // size of the source DRC file, in bytes
+    int64_t source_mtime_sec;   // modification time of the source DRC file, seconds
+    int64_t source_mtime_nsec;  // modification time of the source DRC file, nanoseconds
+    uint64_t num_events;        // number of events in each column
+    uint32_t num_strings;       // number of entries in the string table
+    uint32_t strings_size;      // size of the string table contents, in bytes
+};
+
+// Identity of a DRC file, used to check that a cache is still valid
+struct DRC_Cache_Source
+{
+    bool Read(const char * drc_filename);
+    bool operator==(const DRC_Cache_Source& other) const;
+
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+/*
+ * Memory-mapped cache file, read in batches as with Traffic_Parser. A cache
+ * may also be restricted to a range of another cache's events, which must
+ * outlive it.
+ */
+class DRC_Cache
+{
+public:
+    // Map the cache of a DRC file. Is_Valid() is false if it is missing, out of date or unreadable.
+    DRC_Cache(const char * cache_filename, const char * drc_filename);
+
+    // Read only the events [range_begin, range_end) of another cache
+    DRC_Cache(const DRC_Cache& source, size_t range_begin, size_t range_end);
+
+    virtual ~DRC_Cache();
+
+    bool Is_Valid() const { return m_header != NULL; }
+
+    // Number of events in the cache
+    size_t Size() const { return m_num_events; }
+
+    // Index of the next event to be read
+    size_t Position() const { return m_pos; }
+
+    // True once every event in the cache's range has been read
+    bool At_End() const { return m_pos >= m_end; }
+
+    // A cache only holds the events before any line which stopped its parse, so it never stops early
+    bool Stopped_At_Line() const { return false; }
+
+    // Fills up to batch.Capacity() events. Returns false once no events remain.
+    bool Next_Batch(Traffic_Event_Batch& batch);
+
+protected:
+    bool Map_Columns();
+
+    const char * m_data;            // start of the mapping
+    size_t m_map_size;              // size of the mapping, in bytes
+    bool m_mapped;                  // true if m_data is a memory mapping owned by this cache
+    const DRC_Cache_Header * m_header;
+
+    size_t m_num_events;
+    size_t m_pos;                   // index of the next event to be read
+    size_t m_end;                   // end of the range of events to be read
+
+    const double * m_time;
+    const double * m_sent;
+    const uint32_t * m_fields;
+    const uint32_t * m_port;
+    const uint32_t * m_flow;
+    const uint32_t * m_seq;
+    const uint32_t * m_frag;
+    const uint32_t * m_tos;
+    const uint32_t * m_dstAddr;
+    const uint32_t * m_dstPort;
+    const uint32_t * m_srcAddr;
+    const uint32_t * m_srcPort;
+    const uint32_t * m_size;
+    const uint32_t * m_proto;
+    const uint8_t * m_action;
+    std::vector<boost::string_ref> m_strings;   // string table entries, referring into the mapping
+
+private:
+    DRC_Cache(const DRC_Cache&);
+    DRC_Cache& operator=(const DRC_Cache&);
+};
+
+/*
+ * Accumulates the events of a DRC file as they are parsed, to be written
+ * out as a cache once the whole file has been parsed successfully.
+ */
+class DRC_Cache_Builder
+{
+public:
+    DRC_Cache_Builder();
+
+    // Record the identity of the source DRC file, before it is parsed
+    bool Set_Source(const char * drc_filename);
+
+    // Append the events of a batch
+    void Append(const Traffic_Event_Batch& batch);
+
+    // Append all events from another builder, releasing its memory
+    void Append(DRC_Cache_Builder& other);
+
+    // Write the cache file, unless the source has changed since Set_Source. Returns false on failure.
+    bool Write(const char * cache_filename, const char * drc_filename) const;
+
+protected:
+    uint32_t Intern(const boost::string_ref& value);
+
+    bool m_has_source;
+    DRC_Cache_Source m_source;
+
+    std::vector<double> m_time;
+    std::vector<double> m_sent;
+    std::vector<uint32_t> m_fields;
+    std::vector<uint32_t> m_port;
+    std::vector<uint32_t> m_flow;
+    std::vector<uint32_t> m_seq;
+    std::vector<uint32_t> m_frag;
+    std::vector<uint32_t> m_tos;
+    std::vector<uint32_t> m_dstAddr;
+    std::vector<uint32_t> m_dstPort;
+    std::vector<uint32_t> m_srcAddr;
+    std::vector<uint32_t> m_srcPort;
+    std::vector<uint32_t> m_size;
+    std::vector<uint32_t> m_proto;
+    std::vector<uint8_t> m_action;
+    std::vector<std::string> m_strings;     // string table, in order of first use
+};
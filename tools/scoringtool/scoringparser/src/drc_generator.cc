@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <functional>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "drc_generator.h"
+
+namespace
+{
+    // A packet received by the listening node, waiting until the send file catches up with it
+    struct Pending_Receive
+    {
+        bool operator>(const Pending_Receive& other) const { return time > other.time; }
+
+        double time;        // time the packet is received
+        double sent;        // time the packet was sent
+        unsigned int flow;  // flow number
+        unsigned int seq;   // sequence number
+    };
+
+    // Writes DRC lines to a file, counting the lines and bytes written
+    class DRC_Writer
+    {
+    public:
+        DRC_Writer(const char * filename) :
+            m_filename(filename),
+            m_events(0),
+            m_bytes(0)
+        {
+            m_file = fopen(filename, "w");
+            if (!m_file)
+            {
+                throw std::runtime_error("Cannot open " + m_filename + " for writing!");
+            }
+        }
+
+        ~DRC_Writer()
+        {
+            if (m_file)
+            {
+                fclose(m_file);
+            }
+        }
+
+        void Write(const char * line, int length)
+        {
+            if (length < 0 || fwrite(line, 1, length, m_file) != (size_t)length)
+            {
+                throw std::runtime_error("Cannot write to " + m_filename + "!");
+            }
+
+            m_events++;
+            m_bytes += length;
+        }
+
+        void Close()
+        {
+            int result = fclose(m_file);
+            m_file = NULL;
+
+            if (result != 0)
+            {
+                throw std::runtime_error("Cannot write to " + m_filename + "!");
+            }
+        }
+
+        size_t Events() const { return m_events; }
+        size_t Bytes() const { return m_bytes; }
+
+    protected:
+        std::string m_filename;
+        FILE * m_file;
+        size_t m_events;
+        size_t m_bytes;
+    };
+
+    // Destination address of a flow, as the last octet of 192.168.1.x
+    inline unsigned int Flow_Host(unsigned int flow)
+    {
+        return flow % 250 + 1;
+    }
+}
+
+DRC_Generator_Options::DRC_Generator_Options() :
+    num_flows(10),
+    packet_rate(100.0),
+    match_length(60.0),
+    loss_fraction(0.05),
+    duplicate_fraction(0.01),
+    late_fraction(0.05),
+    max_latency(0.5),
+    seed(1)
+{
+}
+
+std::string Format_DRC_Timestamp(double time)
+{
+    double seconds = floor(time);
+    long microseconds = lround((time - seconds) * 1e6);
+
+    if (microseconds >= 1000000)
+    {
+        seconds += 1;
+        microseconds -= 1000000;
+    }
+
+    time_t epoch = (time_t)seconds;
+    struct tm date;
+    gmtime_r(&epoch, &date);
+
+    char timestamp[64];
+    size_t length = strftime(timestamp, sizeof(timestamp), "%Y-%m-%d_%H:%M:%S", &date);
+    snprintf(timestamp + length, sizeof(timestamp) - length, ".%06ld", microseconds);
+
+    return timestamp;
+}
+
+DRC_Generator_Counts Generate_DRC_Files(const DRC_Generator_Options& options, const char * send_filename, 
+    const char * listen_filename)
+{
+    if (options.num_flows == 0 || !(options.packet_rate > 0) || !(options.match_length > 0) || !(options.max_latency > 0))
+    {
+        throw std::runtime_error("Generated matches need at least one flow and a positive packet rate, length and latency!");
+    }
+
+    DRC_Writer send(send_filename);
+    DRC_Writer listen(listen_filename);
+
+    std::mt19937 random(options.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    const double start = DRC_GENERATOR_START_TIMESTAMP;
+    const unsigned int first_flow = DRC_GENERATOR_FIRST_FLOW;
+    const unsigned int last_flow = first_flow + options.num_flows - 1;
+    const unsigned int num_packets = (unsigned int)(options.match_length * options.packet_rate);
+
+    char line[512];
+    int length;
+
+    for (unsigned int flow = first_flow; flow <= last_flow; flow++)
+    {
+        length = snprintf(line, sizeof(line), "%s LISTEN proto>UDP port>%u\n", 
+            Format_DRC_Timestamp(start - 5.0).c_str(), flow);
+        listen.Write(line, length);
+    }
+
+    for (unsigned int flow = first_flow; flow <= last_flow; flow++)
+    {
+        length = snprintf(line, sizeof(line), "%s ON flow>%u srcPort>%u dst>192.168.1.%u/%u\n", 
+            Format_DRC_Timestamp(start - 1.0).c_str(), flow, flow, Flow_Host(flow), flow);
+        send.Write(line, length);
+    }
+
+    std::priority_queue<Pending_Receive, std::vector<Pending_Receive>, std::greater<Pending_Receive> > pending;
+
+    // Packet seq of every flow is sent in turn, so both files are in time order without sorting
+    for (unsigned int seq = 1; seq <= num_packets + 1; seq++)
+    {
+        double send_time = start + (seq - 1) / options.packet_rate;
+
+        // Write the packets received before this round of sends
+        while (!pending.empty() && (seq > num_packets || pending.top().time < send_time))
+        {
+            const Pending_Receive& recv = pending.top();
+            std::string sent = Format_DRC_Timestamp(recv.sent);
+            unsigned int host = Flow_Host(recv.flow);
+
+            length = snprintf(line, sizeof(line), "%s RECV proto>UDP flow>%u seq>%u src>10.0.0.%u/%u dst>192.168.1.%u/%u "
+                "sent>%s size>%u frag>0 TOS>0 gps>INVALID,0.0,0.0\n", Format_DRC_Timestamp(recv.time).c_str(), 
+                recv.flow, recv.seq, host, recv.flow, host, recv.flow, sent.c_str(), 100 + recv.flow % 7);
+            listen.Write(line, length);
+
+            pending.pop();
+        }
+
+        if (seq > num_packets)
+        {
+            break;
+        }
+
+        for (unsigned int flow = first_flow; flow <= last_flow; flow++)
+        {
+            double sent = send_time + (flow - first_flow) / (options.packet_rate * options.num_flows);
+            std::string timestamp = Format_DRC_Timestamp(sent);
+
+            length = snprintf(line, sizeof(line), "%s SEND proto>UDP flow>%u seq>%u frag>0 TOS>0 srcPort>%u "
+                "dst>192.168.1.%u/%u size>%u gps>INVALID\n", timestamp.c_str(), flow, seq, flow, Flow_Host(flow), 
+                flow, 100 + flow % 7);
+            send.Write(line, length);
+
+            if (uniform(random) < options.loss_fraction)
+            {
+                continue;
+            }
+
+            // Received packets meet the latency with a margin, and late packets miss it with one, 
+            // so rounding to microseconds never changes which they are
+            double latency = (uniform(random) < options.late_fraction) ? 
+                options.max_latency * (1.1 + 2.0 * uniform(random)) : 
+                options.max_latency * (0.05 + 0.85 * uniform(random));
+
+            // Timestamps are rounded to microseconds, so the received packet keeps the rounded sent time
+            double rounded_sent = floor(sent * 1e6 + 0.5) / 1e6;
+
+            Pending_Receive recv = { rounded_sent + latency, rounded_sent, flow, seq };
+            pending.push(recv);
+
+            if (uniform(random) < options.duplicate_fraction)
+            {
+                recv.time += options.max_latency * 0.05 * uniform(random);
+                pending.push(recv);
+            }
+        }
+    }
+
+    double end = start + options.match_length + 1.0;
+
+    for (unsigned int flow = first_flow; flow <= last_flow; flow++)
+    {
+        length = snprintf(line, sizeof(line), "%s OFF flow>%u srcPort>%u dst>192.168.1.%u/%u\n", 
+            Format_DRC_Timestamp(end).c_str(), flow, flow, Flow_Host(flow), flow);
+        send.Write(line, length);
+    }
+
+    send.Close();
+    listen.Close();
+
+    DRC_Generator_Counts counts;
+    counts.send_events = send.Events();
+    counts.listen_events = listen.Events();
+    counts.send_bytes = send.Bytes();
+    counts.listen_bytes = listen.Bytes();
+
+    return counts;
+}
+
+std::string Generate_Mandates_JSON(const DRC_Generator_Options& options)
+{
+    std::ostringstream json;
+    json << "[{\"timestamp\": 0, \"scenario_goals\": [";
+
+    for (unsigned int i = 0; i < options.num_flows; i++)
+    {
+        json << (i > 0 ? ", " : "") << "{\"flow_uid\": " << (DRC_GENERATOR_FIRST_FLOW + i) 
+             << ", \"requirements\": {\"max_latency_s\": " << options.max_latency << "}}";
+    }
+
+    json << "]}]";
+    return json.str();
+}
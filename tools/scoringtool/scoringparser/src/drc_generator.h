@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+// Start of the generated traffic, as seconds since the epoch
+#define DRC_GENERATOR_START_TIMESTAMP 1556649000.0
+
+// Flow numbers of generated flows start from here, as with the colosseum's destination ports
+#define DRC_GENERATOR_FIRST_FLOW 5000
+
+/*
+ * Parameters of a synthetic match, used by the benchmarks. Each flow sends
+ * packets at a constant rate for the length of the match, and each packet
+ * is lost, received once, or received twice. Received packets meet the
+ * flow's maximum latency unless they are late.
+ */
+struct DRC_Generator_Options
+{
+    DRC_Generator_Options();
+
+    unsigned int num_flows;         // number of flows sent from one node to another
+    double packet_rate;             // packets sent per second by each flow
+    double match_length;            // seconds of traffic sent by each flow
+    double loss_fraction;           // fraction of packets which are never received
+    double duplicate_fraction;      // fraction of received packets which are received twice
+    double late_fraction;           // fraction of received packets which exceed the maximum latency
+    double max_latency;             // maximum latency of every flow, in seconds
+    unsigned int seed;              // seed of the random loss, duplicates and latencies
+};
+
+// Number of events written to a send and listen DRC file pair
+struct DRC_Generator_Counts
+{
+    DRC_Generator_Counts() : send_events(0), listen_events(0), send_bytes(0), listen_bytes(0) {}
+
+    size_t send_events;
+    size_t listen_events;
+    size_t send_bytes;
+    size_t listen_bytes;
+};
+
+// Format seconds since the epoch as a DRC timestamp, YYYY-MM-DD_HH:MM:SS.ffffff
+std::string Format_DRC_Timestamp(double time);
+
+// Write the send and listen DRC files of a synthetic match, with every line in time order
+DRC_Generator_Counts Generate_DRC_Files(const DRC_Generator_Options& options, const char * send_filename, 
+    const char * listen_filename);
+
+// Mandates JSON giving the maximum latency of every generated flow, as accepted by Parse_Max_Latency_Per_Flow
+std::string Generate_Mandates_JSON(const DRC_Generator_Options& options);
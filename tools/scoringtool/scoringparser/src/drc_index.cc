@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+
+#include "drc_index.h"
+
+#define DRC_INDEX_MAGIC "DRCINDEX"
+#define DRC_INDEX_BYTE_ORDER 0x01020304
+
+DRC_Index::DRC_Index(const char * index_filename, const char * drc_filename) :
+    m_valid(false)
+{
+    DRC_Cache_Source source;
+    if (!source.Read(drc_filename))
+    {
+        return;
+    }
+    
+    FILE * file = fopen(index_filename, "rb");
+    if (!file)
+    {
+        return;
+    }
+    
+    DRC_Index_Header header;
+    memset(&header, 0, sizeof(header));
+    bool valid = fread(&header, sizeof(header), 1, file) == 1;
+    
+    DRC_Cache_Source indexed_source = { header.source_size, header.source_mtime_sec, header.source_mtime_nsec };
+    
+    valid = valid && 
+        memcmp(header.magic, DRC_INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == DRC_INDEX_VERSION &&
+        header.byte_order == DRC_INDEX_BYTE_ORDER &&
+        indexed_source == source &&
+        header.num_blocks <= source.size;
+    
+    if (valid && header.num_blocks > 0)
+    {
+        m_blocks.resize(header.num_blocks);
+        valid = fread(&m_blocks[0], sizeof(DRC_Index_Block), m_blocks.size(), file) == m_blocks.size();
+    }
+    
+    fclose(file);
+    
+    if (!valid)
+    {
+        m_blocks.clear();
+        return;
+    }
+    
+    m_valid = true;
+}
+
+std::vector<DRC_Index_Range> DRC_Index::Find_Ranges(double begin_time, double end_time) const
+{
+    std::vector<DRC_Index_Range> ranges;
+    
+    for (size_t i = 0; i < m_blocks.size(); i++)
+    {
+        const DRC_Index_Block& block = m_blocks[i];
+        
+        if (block.num_flow_events == 0 && (block.max_time < begin_time || block.min_time >= end_time))
+        {
+            continue;
+        }
+        
+        if (!ranges.empty() && ranges.back().end == block.begin)
+        {
+            ranges.back().end = block.end;
+        }
+        else
+        {
+            DRC_Index_Range range = { block.begin, block.end };
+            ranges.push_back(range);
+        }
+    }
+    
+    return ranges;
+}
+
+DRC_Index_Builder::DRC_Index_Builder() :
+    m_has_source(false)
+{
+}
+
+bool DRC_Index_Builder::Set_Source(const char * drc_filename)
+{
+    m_has_source = m_source.Read(drc_filename);
+    return m_has_source;
+}
+
+void DRC_Index_Builder::Append(uint64_t begin, uint64_t end, const Traffic_Event_Batch& batch)
+{
+    if (batch.count == 0)
+    {
+        return;
+    }
+    
+    DRC_Index_Block block = { begin, end, 0, 0, 0 };
+    
+    for (size_t i = 0; i < batch.count; i++)
+    {
+        uint8_t action = batch.action[i];
+        if (action == TRAFFIC_ACTION_ON || action == TRAFFIC_ACTION_OFF || action == TRAFFIC_ACTION_LISTEN)
+        {
+            block.num_flow_events++;
+        }
+        
+        double time = Traffic_Period_Time(batch.action[i], batch.time[i], batch.sent[i]);
+        
+        if (i == 0 || time < block.min_time)
+        {
+            block.min_time = time;
+        }
+        
+        if (i == 0 || time > block.max_time)
+        {
+            block.max_time = time;
+        }
+    }
+    
+    m_blocks.push_back(block);
+}
+
+void DRC_Index_Builder::Append(DRC_Index_Builder& other)
+{
+    m_blocks.insert(m_blocks.end(), other.m_blocks.begin(), other.m_blocks.end());
+    std::vector<DRC_Index_Block>().swap(other.m_blocks);
+}
+
+bool DRC_Index_Builder::Write(const char * index_filename, const char * drc_filename) const
+{
+    // A source which changed while it was parsed may not match the blocks read from it
+    DRC_Cache_Source source;
+    if (!m_has_source || !source.Read(drc_filename) || !(source == m_source))
+    {
+        return false;
+    }
+    
+    DRC_Index_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DRC_INDEX_MAGIC, sizeof(header.magic));
+    header.version = DRC_INDEX_VERSION;
+    header.byte_order = DRC_INDEX_BYTE_ORDER;
+    header.source_size = m_source.size;
+    header.source_mtime_sec = m_source.mtime_sec;
+    header.source_mtime_nsec = m_source.mtime_nsec;
+    header.num_blocks = m_blocks.size();
+    
+    // Write to a temporary file first, so a partially written index is never read
+    std::string temp_filename = std::string(index_filename) + ".tmp";
+    FILE * file = fopen(temp_filename.c_str(), "wb");
+    if (!file)
+    {
+        return false;
+    }
+    
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        (m_blocks.empty() || fwrite(&m_blocks[0], sizeof(DRC_Index_Block), m_blocks.size(), file) == m_blocks.size());
+    
+    if (fclose(file) != 0 || !written || rename(temp_filename.c_str(), index_filename) != 0)
+    {
+        remove(temp_filename.c_str());
+        return false;
+    }
+    
+    return true;
+}
+
+bool Build_DRC_Index(const char * drc_filename, const char * index_filename)
+{
+    DRC_Index_Builder index_builder;
+    if (!index_builder.Set_Source(drc_filename))
+    {
+        return false;
+    }
+    
+    Traffic_Parser traffic_parser(drc_filename);
+    if (traffic_parser.Is_Compressed())
+    {
+        throw std::runtime_error("Cannot index compressed DRC file " + std::string(drc_filename) + "!");
+    }
+    
+    Traffic_Event_Batch batch;
+    size_t block_begin = traffic_parser.Position();
+    
+    while (traffic_parser.Next_Batch(batch))
+    {
+        size_t block_end = traffic_parser.Position();
+        index_builder.Append(block_begin, block_end, batch);
+        block_begin = block_end;
+    }
+    
+    return index_builder.Write(index_filename, drc_filename);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "traffic_parser.h"
+#include "drc_cache.h"
+
+// Suffix appended to a DRC filename to give its index filename
+#define DRC_INDEX_SUFFIX ".index"
+
+// Version of the index file layout, incremented whenever it changes
+#define DRC_INDEX_VERSION 2
+
+/*
+ * Sparse time index of an uncompressed DRC file. Each block covers the
+ * lines of one Traffic_Event_Batch, up to TRAFFIC_EVENT_BATCH_SIZE events,
+ * and records the range of measurement period times of its events (see
+ * Traffic_Period_Time), and how many ON, OFF and LISTEN events it holds.
+ * RECV events are keyed by their sent time, so blocks of a listen file may
+ * overlap in time and are not sorted by it. All values are in host byte
+ * order:
+ *
+ *   DRC_Index_Header
+ *   DRC_Index_Block blocks[num_blocks]
+ *
+ * Blocks are contiguous and in file order. As with a cache, an index 
+ * describes a complete, successful parse of its source file, which is 
+ * identified by its size and modification time.
+ */
+struct DRC_Index_Header
+{
+    char magic[8];              // DRC_INDEX_MAGIC
+    uint32_t version;           // DRC_INDEX_VERSION
+    uint32_t byte_order;        // DRC_INDEX_BYTE_ORDER as written by the host which created the index
+    uint64_t source_size;       // size of the source DRC file, in bytes
+    int64_t source_mtime_sec;   // modification time of the source DRC file, seconds
+    int64_t source_mtime_nsec;  // modification time of the source DRC file, nanoseconds
+    uint64_t num_blocks;        // number of blocks following the header
+};
+
+struct DRC_Index_Block
+{
+    uint64_t begin;             // byte offset of the first line of the block
+    uint64_t end;               // byte offset just past the last line of the block
+    double min_time;            // lowest measurement period time of an event in the block
+    double max_time;            // highest measurement period time of an event in the block
+    uint64_t num_flow_events;   // number of ON, OFF and LISTEN events in the block, which every window includes
+};
+
+// Byte range of a DRC file holding every event within a time window, and flow events
+struct DRC_Index_Range
+{
+    uint64_t begin;
+    uint64_t end;
+};
+
+/*
+ * Index file of a DRC file, read into memory. Is_Valid() is false if it is
+ * missing, out of date or unreadable.
+ */
+class DRC_Index
+{
+public:
+    DRC_Index(const char * index_filename, const char * drc_filename);
+
+    bool Is_Valid() const { return m_valid; }
+
+    const std::vector<DRC_Index_Block>& Blocks() const { return m_blocks; }
+
+    // Byte ranges of the blocks which may hold events with measurement period times within [begin_time, end_time), 
+    // or which hold ON, OFF or LISTEN events, with adjacent blocks merged into one range
+    std::vector<DRC_Index_Range> Find_Ranges(double begin_time, double end_time) const;
+
+protected:
+    bool m_valid;
+    std::vector<DRC_Index_Block> m_blocks;
+};
+
+/*
+ * Accumulates the blocks of a DRC file as it is parsed, to be written out
+ * as an index once the whole file has been parsed successfully.
+ */
+class DRC_Index_Builder
+{
+public:
+    DRC_Index_Builder();
+
+    // Record the identity of the source DRC file, before it is parsed
+    bool Set_Source(const char * drc_filename);
+
+    // Append a block of the events of a batch, read from the lines in [begin, end) of the file
+    void Append(uint64_t begin, uint64_t end, const Traffic_Event_Batch& batch);
+
+    // Append all blocks from another builder, releasing its memory
+    void Append(DRC_Index_Builder& other);
+
+    // Write the index file, unless the source has changed since Set_Source. Returns false on failure.
+    bool Write(const char * index_filename, const char * drc_filename) const;
+
+protected:
+    bool m_has_source;
+    DRC_Cache_Source m_source;
+    std::vector<DRC_Index_Block> m_blocks;
+};
+
+// Parse a whole DRC file to write its index. Throws if it is compressed, and returns false if the index cannot be written.
+bool Build_DRC_Index(const char * drc_filename, const char * index_filename);
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+/*
+ * Map stored as a vector of entries sorted by key, for small maps which are
+ * looked up far more often than they are inserted into. The interface is
+ * the subset of std::map used by the scoring code. Unlike std::map,
+ * inserting an entry invalidates references to the other entries.
+ */
+template<class Key, class Value>
+class Flat_Map
+{
+public:
+    typedef std::pair<Key, Value> value_type;
+    typedef typename std::vector<value_type>::iterator iterator;
+    typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+    Value& operator[](const Key& key)
+    {
+        iterator it = Lower_Bound(key);
+        
+        if (it == m_entries.end() || it->first != key)
+        {
+            it = m_entries.insert(it, value_type(key, Value()));
+        }
+        
+        return it->second;
+    }
+
+    iterator find(const Key& key)
+    {
+        iterator it = Lower_Bound(key);
+        return (it != m_entries.end() && it->first == key) ? it : m_entries.end();
+    }
+
+    const_iterator find(const Key& key) const
+    {
+        const_iterator it = std::lower_bound(m_entries.begin(), m_entries.end(), key, Key_Less());
+        return (it != m_entries.end() && it->first == key) ? it : m_entries.end();
+    }
+
+    iterator begin() { return m_entries.begin(); }
+    iterator end() { return m_entries.end(); }
+    const_iterator begin() const { return m_entries.begin(); }
+    const_iterator end() const { return m_entries.end(); }
+
+    size_t size() const { return m_entries.size(); }
+    bool empty() const { return m_entries.empty(); }
+
+protected:
+    struct Key_Less
+    {
+        bool operator()(const value_type& entry, const Key& key) const { return entry.first < key; }
+    };
+
+    iterator Lower_Bound(const Key& key)
+    {
+        return std::lower_bound(m_entries.begin(), m_entries.end(), key, Key_Less());
+    }
+
+    std::vector<value_type> m_entries;  // entries in key order
+};
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "latency_histogram.h"
+
+static_assert(LATENCY_MAX_BITS < 64, "Latency buckets must fit in 64 bit values");
+
+void Latency_Histogram::Add(const Latency_Histogram& other)
+{
+    if (other.m_count == 0)
+    {
+        return;
+    }
+    
+    if (other.m_counts.size() > m_counts.size())
+    {
+        m_counts.resize(other.m_counts.size());
+    }
+    
+    for (size_t i = 0; i < other.m_counts.size(); i++)
+    {
+        m_counts[i] += other.m_counts[i];
+    }
+    
+    if (m_count == 0 || other.m_max > m_max)
+    {
+        m_max = other.m_max;
+    }
+    
+    m_count += other.m_count;
+}
+
+double Latency_Histogram::Percentile(double percentage) const
+{
+    // Rank of the latency within the recorded latencies, counting from one
+    uint64_t rank = (uint64_t)ceil(percentage / 100.0 * m_count);
+    rank = std::min<uint64_t>(std::max<uint64_t>(rank, 1), m_count);
+    
+    uint64_t cumulative = 0;
+    
+    for (size_t i = 0; i < m_counts.size(); i++)
+    {
+        cumulative += m_counts[i];
+        
+        if (cumulative >= rank)
+        {
+            return std::min(Bucket_Highest_Latency(i), m_max);
+        }
+    }
+    
+    return m_max;
+}
+
+double Latency_Histogram::Bucket_Highest_Latency(size_t index)
+{
+    uint64_t highest_value;
+    
+    if (index < LATENCY_SUB_BUCKETS)
+    {
+        highest_value = index;
+    }
+    else
+    {
+        unsigned int shift = index / LATENCY_SUB_BUCKETS - 1;
+        uint64_t top_bits = index - (size_t)shift * LATENCY_SUB_BUCKETS;
+        highest_value = ((top_bits + 1) << shift) - 1;
+    }
+    
+    return highest_value / LATENCY_UNITS_PER_SECOND;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+// Each power of two range of latencies is split into 2^LATENCY_SUB_BUCKET_BITS buckets, 
+// so a bucket is at most 1/32 of its values wide
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+
+// Latencies are bucketed in microseconds, up to 2^(LATENCY_MAX_BITS) - 1 (about 19 hours)
+#define LATENCY_MAX_BITS 36
+#define LATENCY_UNITS_PER_SECOND 1e6
+#define LATENCY_MAX_BUCKETS (LATENCY_SUB_BUCKETS * (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS + 1))
+
+/*
+ * Log-linear histogram of packet latencies, in the style of HdrHistogram.
+ * Latencies below LATENCY_SUB_BUCKETS microseconds have their own bucket,
+ * and longer latencies share buckets of bounded relative width. The bucket
+ * count only grows up to the highest latency recorded, and never beyond
+ * LATENCY_MAX_BUCKETS, however many latencies are recorded. The exact
+ * maximum latency is kept alongside the buckets.
+ */
+class Latency_Histogram
+{
+public:
+    Latency_Histogram() :
+        m_count(0),
+        m_max(0)
+    {
+    }
+
+    // Record a latency, in seconds. Negative latencies share the bucket of zero.
+    void Record(double latency)
+    {
+        size_t index = Bucket_Index(latency);
+        
+        if (index >= m_counts.size())
+        {
+            m_counts.resize(index + 1);
+        }
+        
+        m_counts[index]++;
+        
+        if (m_count == 0 || latency > m_max)
+        {
+            m_max = latency;
+        }
+        
+        m_count++;
+    }
+
+    // Add the latencies recorded by another histogram
+    void Add(const Latency_Histogram& other);
+
+    // True if no latencies have been recorded
+    bool Empty() const { return m_count == 0; }
+    
+    // Number of latencies recorded
+    uint64_t Count() const { return m_count; }
+    
+    // Maximum latency recorded, in seconds, which is only valid if the histogram is not empty
+    double Max() const { return m_max; }
+    
+    // Latency in seconds which the given percentage of recorded latencies are at or below, as the highest
+    // latency of its bucket, and never more than the maximum. Only valid if the histogram is not empty.
+    double Percentile(double percentage) const;
+
+protected:
+    static size_t Bucket_Index(double latency)
+    {
+        uint64_t value = 0;
+        
+        if (latency > 0)
+        {
+            double units = latency * LATENCY_UNITS_PER_SECOND + 0.5;
+            value = (units < (double)((uint64_t)1 << LATENCY_MAX_BITS)) ? (uint64_t)units : ((uint64_t)1 << LATENCY_MAX_BITS) - 1;
+        }
+        
+        if (value < LATENCY_SUB_BUCKETS)
+        {
+            return value;
+        }
+        
+        // The top LATENCY_SUB_BUCKET_BITS + 1 bits of the value select the bucket
+        unsigned int shift = (63 - __builtin_clzll(value)) - LATENCY_SUB_BUCKET_BITS;
+        return (size_t)shift * LATENCY_SUB_BUCKETS + (size_t)(value >> shift);
+    }
+    
+    // Highest latency of a bucket, in seconds
+    static double Bucket_Highest_Latency(size_t index);
+
+    std::vector<uint32_t> m_counts; // number of latencies recorded in each bucket
+    uint64_t m_count;               // total number of latencies recorded
+    double m_max;                   // maximum latency recorded, in seconds
+};
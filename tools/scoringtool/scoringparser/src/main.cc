@@ -16,28 +16,110 @@
  */
  
 #include <cstdlib>
+#include <cstdio>
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <string>
+#include <memory>
+#include <limits>
+#include <thread>
+#include <chrono>
 #include <boost/program_options.hpp>
 
 #include "traffic_parser.h"
 #include "scoring_parser.h"
+#include "match_scorer.h"
+#include "binary_results.h"
+#include "drc_index.h"
+#include "parse_stats.h"
 
 namespace po = boost::program_options;
 
+namespace
+{
+    // Write the metrics of a run to stderr, or to a file if one is given
+    void Write_Stats(Parse_Stats& parse_stats, const std::string& stats_file)
+    {
+        if (stats_file.empty())
+        {
+            parse_stats.Write_JSON(stderr);
+            return;
+        }
+        
+        FILE * output = fopen(stats_file.c_str(), "w");
+        if (!output)
+        {
+            throw std::runtime_error("Cannot open stats file " + stats_file + "!");
+        }
+        
+        try
+        {
+            parse_stats.Write_JSON(output);
+        }
+        catch (...)
+        {
+            fclose(output);
+            throw;
+        }
+        
+        if (fclose(output) != 0)
+        {
+            throw std::runtime_error("Error writing stats file " + stats_file + "!");
+        }
+    }
+}
+
 int main(int argc, char * argv[])
 {
     std::vector<std::string> input_files;
     double start_timestamp;
     std::string json_flow_mandates;
+    std::string mandates_file;
+    std::string traffic_logs_dir;
+    std::string mandates_dir;
+    unsigned int num_threads;
+    bool use_cache;
+    bool use_index;
+    bool build_index;
+    double window_from;
+    double window_to;
+    bool follow;
+    double follow_interval;
+    std::string output_format;
+    double mp_duration;
+    std::vector<unsigned int> mp_rollups;
+    bool latency_histograms;
+    bool stream;
+    double finalize_margin;
+    bool stats;
+    std::string stats_file;
 
     po::options_description params("Parameters");
     params.add_options()
         ("help,h", "show usage help")
-        ("input,i", po::value<std::vector<std::string> >(&input_files)->multitoken()->required(), "input drc traffic file (multiple can be specified)")
+        ("input,i", po::value<std::vector<std::string> >(&input_files)->multitoken(), "input drc traffic file (multiple can be specified)")
         ("timestamp,t", po::value<double>(&start_timestamp)->required(), "match start timestamp")
-        ("mandates,m", po::value<std::string>(&json_flow_mandates)->required(), "list of mandates in a json format")
+        ("mandates,m", po::value<std::string>(&json_flow_mandates), "list of mandates in a json format")
+        ("mandates-file", po::value<std::string>(&mandates_file), "json file holding the list of mandates, instead of --mandates")
+        ("traffic-logs,l", po::value<std::string>(&traffic_logs_dir), "traffic_logs directory of a match, to score every send/listen drc file pair instead of the input files")
+        ("mandates-dir", po::value<std::string>(&mandates_dir), "mandated outcomes directory holding the mandates of each node, used with --traffic-logs")
+        ("threads,j", po::value<unsigned int>(&num_threads)->default_value(1), "number of threads used to parse each input file, or the whole match with --traffic-logs")
+        ("cache,c", po::bool_switch(&use_cache), "read events from a binary .cache file next to each input file, creating it if missing or out of date")
+        ("index", po::bool_switch(&use_index), "seek to the --from/--to window with a sparse time .index file next to each uncompressed input file, creating it if missing or out of date")
+        ("build-index", po::bool_switch(&build_index), "write the .index file of each input file and exit, without needing --timestamp or mandates")
+        ("from", po::value<double>(&window_from), "only score events from this many seconds after the match start, by sent time for RECV events")
+        ("to", po::value<double>(&window_to), "only score events before this many seconds after the match start, by sent time for RECV events")
+        ("follow,f", po::bool_switch(&follow), "keep following the input files as they grow, printing a json line of the changed measurement periods after each update")
+        ("interval", po::value<double>(&follow_interval)->default_value(1.0), "polling interval in seconds when following")
+        ("mp-duration", po::value<double>(&mp_duration)->default_value(DEFAULT_MP_DURATION), "duration of a measurement period in seconds")
+        ("mp-rollup", po::value<std::vector<unsigned int> >(&mp_rollups)->multitoken(), "also output stats_<n> arrays of periods n times the measurement period duration (multiple can be specified)")
+        ("latency", po::bool_switch(&latency_histograms), "add a latency summary (count, p50, p90, p99 and max in seconds) to each flow and measurement period")
+        ("stream", po::bool_switch(&stream), "merge the input files in time order with bounded memory, printing a json line of the measurement periods as they are finalized")
+        ("finalize-margin", po::value<double>(&finalize_margin)->default_value(1.0), "seconds beyond a flow's max latency to wait before finalizing a measurement period when streaming")
+        ("output-format", po::value<std::string>(&output_format)->default_value("json"), "output format: json, or binary for the columnar layout described in binary_results.h")
+        ("stats", po::bool_switch(&stats), "write a json line of metrics to stderr when done: wall and cpu time of each phase, events and bytes per second of each input file, event counts by action, flow, measurement period and received sequence counts, and peak rss")
+        ("stats-file", po::value<std::string>(&stats_file), "write the --stats metrics to a file instead of stderr")
     ;
 
     try
@@ -50,20 +132,260 @@ int main(int argc, char * argv[])
             return 1;
         }
         
+        // Indexing only needs the input files, so it is done before required options are checked
+        if (vm["build-index"].as<bool>())
+        {
+            if (!vm.count("input"))
+            {
+                throw std::runtime_error("--input is required with --build-index!");
+            }
+            
+            std::vector<std::string> index_inputs = vm["input"].as<std::vector<std::string> >();
+            
+            for (size_t n = 0; n < index_inputs.size(); n++)
+            {
+                std::string index_file = index_inputs[n] + DRC_INDEX_SUFFIX;
+                
+                if (!Build_DRC_Index(index_inputs[n].c_str(), index_file.c_str()))
+                {
+                    throw std::runtime_error("Unable to write DRC index file " + index_file + "!");
+                }
+            }
+            
+            return 0;
+        }
+        
         po::notify(vm);
+        
+        if (output_format != "json" && output_format != "binary")
+        {
+            throw std::runtime_error("Unknown output format \"" + output_format + "\"!");
+        }
+        
+        bool binary_output = (output_format == "binary");
+        
+        if (follow && binary_output)
+        {
+            throw std::runtime_error("Follow mode only supports json output!");
+        }
+        
+        if (follow && (use_cache || num_threads > 1))
+        {
+            throw std::runtime_error("Follow mode reads each input file as it grows, so it cannot be combined with --cache or --threads!");
+        }
+        
+        if (!mp_rollups.empty() && binary_output)
+        {
+            throw std::runtime_error("Measurement period rollups are only supported with json output!");
+        }
+        
+        if (latency_histograms && binary_output)
+        {
+            throw std::runtime_error("Latency histograms are only supported with json output!");
+        }
+        
+        if (stream && (follow || binary_output || !traffic_logs_dir.empty()))
+        {
+            throw std::runtime_error("Stream mode cannot be combined with --follow, --traffic-logs or binary output!");
+        }
+        
+        if (stream && (use_cache || num_threads > 1))
+        {
+            throw std::runtime_error("Stream mode reads each input file in a single pass, so it cannot be combined with --cache or --threads!");
+        }
+        
+        if (stream && !mp_rollups.empty())
+        {
+            throw std::runtime_error("Measurement period rollups are not supported when streaming!");
+        }
+        
+        bool windowed = vm.count("from") || vm.count("to");
+        
+        if ((windowed || use_index) && (follow || stream))
+        {
+            throw std::runtime_error("--from, --to and --index cannot be combined with --follow or --stream!");
+        }
+        
+        if (!vm.count("from"))
+        {
+            window_from = -std::numeric_limits<double>::infinity();
+        }
+        
+        if (!vm.count("to"))
+        {
+            window_to = std::numeric_limits<double>::infinity();
+        }
+        
+        bool record_stats = stats || !stats_file.empty();
+        
+        if (record_stats && follow)
+        {
+            throw std::runtime_error("Stats are not supported when following, which runs until interrupted!");
+        }
+        
+        Parse_Stats parse_stats;
+        Parse_Counters * stats_counters = record_stats ? &parse_stats.Counters() : NULL;
+        
+        if (!traffic_logs_dir.empty())
+        {
+            if (mandates_dir.empty())
+            {
+                throw std::runtime_error("--mandates-dir is required with --traffic-logs!");
+            }
+            
+            if (follow)
+            {
+                throw std::runtime_error("Cannot follow a traffic_logs directory!");
+            }
+            
+            Match_Scorer match_scorer;
+            match_scorer.Set_Num_Threads(num_threads);
+            match_scorer.Set_Use_Cache(use_cache);
+            match_scorer.Set_Use_Index(use_index);
+            match_scorer.Set_MP_Duration(mp_duration);
+            match_scorer.Set_Latency_Histograms(latency_histograms);
+            
+            if (windowed)
+            {
+                match_scorer.Set_Time_Window(window_from, window_to);
+            }
+            
+            if (record_stats)
+            {
+                match_scorer.Set_Stats(parse_stats);
+            }
+            
+            std::vector<Traffic_Log_Pair> pairs = Match_Scorer::Find_Traffic_Log_Pairs(traffic_logs_dir.c_str(), mandates_dir.c_str());
+            
+            Match_Flow_Info_Map match_flow_info;
+            match_scorer.Parse_Match_Traffic_Stats(pairs, start_timestamp, match_flow_info);
+            
+            Phase_Timer output_timer(stats_counters, PARSE_PHASE_OUTPUT);
+            
+            if (binary_output)
+            {
+                Write_Binary_Match_Traffic_Stats(match_flow_info, stdout);
+            }
+            else
+            {
+                Scoring_Parser scoring_parser;
+                scoring_parser.Set_MP_Rollups(mp_rollups);
+                scoring_parser.Write_JSON_Match_Traffic_Stats(match_flow_info, stdout);
+                fputc('\n', stdout);
+            }
+            
+            if (record_stats)
+            {
+                fflush(stdout);
+                output_timer.Stop();
+                
+                for (Match_Flow_Info_Map::const_iterator it = match_flow_info.begin(); it != match_flow_info.end(); it++)
+                {
+                    parse_stats.Count_Flows(it->second);
+                }
+                
+                Write_Stats(parse_stats, stats_file);
+            }
+            
+            return 0;
+        }
+        
+        if (input_files.empty() || vm.count("mandates") == vm.count("mandates-file"))
+        {
+            throw std::runtime_error("--input and one of --mandates or --mandates-file are required unless --traffic-logs is given!");
+        }
 
         Scoring_Parser scoring_parser;
+        scoring_parser.Set_Num_Threads(num_threads);
+        scoring_parser.Set_Use_Cache(use_cache);
+        scoring_parser.Set_Use_Index(use_index);
+        scoring_parser.Set_MP_Duration(mp_duration);
+        scoring_parser.Set_MP_Rollups(mp_rollups);
+        scoring_parser.Set_Latency_Histograms(latency_histograms);
+        
+        if (windowed)
+        {
+            scoring_parser.Set_Time_Window(window_from, window_to);
+        }
+        
+        if (record_stats)
+        {
+            scoring_parser.Set_Stats(parse_stats);
+        }
         
-        std::map<unsigned int, Flow_Info> flow_info_map;
-        scoring_parser.Parse_Max_Latency_Per_Flow(json_flow_mandates.c_str(), flow_info_map);
+        Flow_Info_Map flow_info_map;
+        if (!mandates_file.empty())
+        {
+            Max_Latency_Map max_latency;
+            scoring_parser.Parse_Max_Latency_File(mandates_file.c_str(), max_latency);
+            scoring_parser.Apply_Max_Latency_Map(max_latency, flow_info_map);
+        }
+        else
+        {
+            scoring_parser.Parse_Max_Latency_Per_Flow(json_flow_mandates.c_str(), flow_info_map);
+        }
+        
+        if (follow)
+        {
+            std::vector<std::unique_ptr<Traffic_Follower> > followers;
+            for (int n=0; n<input_files.size(); n++) {
+                followers.emplace_back(new Traffic_Follower(input_files[n].c_str()));
+            }
+            
+            // Runs until interrupted
+            while (true)
+            {
+                Flow_Changes changes;
+                for (int n=0; n<followers.size(); n++) {
+                    scoring_parser.Parse_New_Traffic_Stats(*followers[n], start_timestamp, flow_info_map, changes);
+                }
+                
+                if (!changes.empty())
+                {
+                    std::cout << scoring_parser.Get_JSON_Flow_Traffic_Changes(flow_info_map, changes) << std::endl;
+                }
+                
+                std::this_thread::sleep_for(std::chrono::duration<double>(follow_interval));
+            }
+        }
+        
+        if (stream)
+        {
+            scoring_parser.Stream_Flow_Traffic_Stats(input_files, start_timestamp, finalize_margin, flow_info_map, stdout);
+            
+            if (record_stats)
+            {
+                parse_stats.Count_Flows(flow_info_map);
+                Write_Stats(parse_stats, stats_file);
+            }
+            
+            return 0;
+        }
         
         for (int n=0; n<input_files.size(); n++) {
             scoring_parser.Parse_Flow_Traffic_Stats(input_files[n].c_str(), start_timestamp, flow_info_map);
         }
         
-        std::string json_output = scoring_parser.Get_JSON_Flow_Traffic_Stats(flow_info_map);
+        Phase_Timer output_timer(stats_counters, PARSE_PHASE_OUTPUT);
+        
+        if (binary_output)
+        {
+            Write_Binary_Flow_Traffic_Stats(flow_info_map, stdout);
+        }
+        else
+        {
+            scoring_parser.Write_JSON_Flow_Traffic_Stats(flow_info_map, stdout);
+            fputc('\n', stdout);
+        }
+        
+        if (record_stats)
+        {
+            fflush(stdout);
+            output_timer.Stop();
             
-        std::cout << json_output << std::endl;
+            parse_stats.Count_Flows(flow_info_map);
+            Write_Stats(parse_stats, stats_file);
+        }
     }
     catch (const std::exception& err) 
     {
@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "match_scorer.h"
+
+#define SEND_DRC_PREFIX "send_"
+#define LISTEN_DRC_PREFIX "listen_"
+#define DRC_SUFFIX ".drc"
+#define RECV_NODE_TAG "RECNODE-"
+
+namespace
+{
+    // Parse results of one send/listen pair
+    struct Pair_Result
+    {
+        Flow_Info_Map flow_info;        // flows parsed from the pair
+        std::ostringstream warnings;    // warnings hit while parsing the pair
+        std::exception_ptr error;       // exception hit while parsing the pair, if any
+    };
+
+    inline bool Starts_With(const std::string& str, const std::string& prefix)
+    {
+        return str.compare(0, prefix.size(), prefix) == 0;
+    }
+    
+    inline bool Ends_With(const std::string& str, const std::string& suffix)
+    {
+        return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+    
+    inline bool Is_File(const std::string& path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+    }
+
+    // Sorted names of the entries in a directory
+    std::vector<std::string> List_Directory(const char * dir)
+    {
+        DIR * dir_handle = opendir(dir);
+        if (!dir_handle)
+        {
+            throw std::runtime_error("Cannot open directory " + std::string(dir) + "!");
+        }
+        
+        std::vector<std::string> names;
+        
+        struct dirent * entry;
+        while ((entry = readdir(dir_handle)) != NULL)
+        {
+            names.push_back(entry->d_name);
+        }
+        
+        closedir(dir_handle);
+        
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+}
+
+Match_Scorer::Match_Scorer() :
+    m_num_threads(1),
+    m_use_cache(false),
+    m_use_index(false),
+    m_windowed(false),
+    m_window_from(0),
+    m_window_to(0),
+    m_mp_duration(DEFAULT_MP_DURATION),
+    m_latency_histograms(false),
+    m_stats(NULL)
+{
+}
+
+Match_Scorer::~Match_Scorer()
+{
+}
+
+void Match_Scorer::Set_Num_Threads(unsigned int num_threads)
+{
+    m_num_threads = (num_threads > 0) ? num_threads : 1;
+}
+
+void Match_Scorer::Set_Use_Cache(bool use_cache)
+{
+    m_use_cache = use_cache;
+}
+
+void Match_Scorer::Set_Use_Index(bool use_index)
+{
+    m_use_index = use_index;
+}
+
+void Match_Scorer::Set_Time_Window(double from, double to)
+{
+    if (!(to > from))
+    {
+        throw std::runtime_error("Time window must end after it begins!");
+    }
+    
+    m_windowed = true;
+    m_window_from = from;
+    m_window_to = to;
+}
+
+void Match_Scorer::Set_MP_Duration(double mp_duration)
+{
+    if (!(mp_duration > 0))
+    {
+        throw std::runtime_error("Measurement period duration must be positive!");
+    }
+    
+    m_mp_duration = mp_duration;
+}
+
+void Match_Scorer::Set_Latency_Histograms(bool latency_histograms)
+{
+    m_latency_histograms = latency_histograms;
+}
+
+void Match_Scorer::Set_Stats(Parse_Stats& stats)
+{
+    m_stats = &stats;
+}
+
+std::vector<Traffic_Log_Pair> Match_Scorer::Find_Traffic_Log_Pairs(const char * traffic_logs_dir, const char * mandates_dir)
+{
+    std::vector<std::string> traffic_logs = List_Directory(traffic_logs_dir);
+    std::vector<std::string> mandates = List_Directory(mandates_dir);
+    
+    std::vector<Traffic_Log_Pair> pairs;
+    
+    for (size_t i = 0; i < traffic_logs.size(); i++)
+    {
+        const std::string& send_filename = traffic_logs[i];
+        
+        if (!Starts_With(send_filename, SEND_DRC_PREFIX) || !Ends_With(send_filename, DRC_SUFFIX))
+        {
+            continue;
+        }
+        
+        Traffic_Log_Pair pair;
+        pair.send_filename = send_filename;
+        pair.send_path = std::string(traffic_logs_dir) + "/" + send_filename;
+        pair.listen_path = std::string(traffic_logs_dir) + "/" + LISTEN_DRC_PREFIX + send_filename.substr(strlen(SEND_DRC_PREFIX));
+        
+        if (!Is_File(pair.send_path))
+        {
+            throw std::runtime_error(pair.send_path + " is not a file!");
+        }
+        
+        if (!Is_File(pair.listen_path))
+        {
+            throw std::runtime_error(pair.listen_path + " is not a file!");
+        }
+        
+        size_t recv_node_pos = send_filename.find(RECV_NODE_TAG);
+        if (recv_node_pos == std::string::npos)
+        {
+            throw std::runtime_error("Unexpected DRC filename " + send_filename + "!");
+        }
+        
+        recv_node_pos += strlen(RECV_NODE_TAG);
+        size_t recv_node_end = send_filename.find_first_not_of("0123456789", recv_node_pos);
+        
+        if (recv_node_end == recv_node_pos)
+        {
+            throw std::runtime_error("Unexpected DRC filename " + send_filename + "!");
+        }
+        
+        std::string recv_node = send_filename.substr(recv_node_pos, recv_node_end - recv_node_pos);
+        pair.recv_node = strtoul(recv_node.c_str(), NULL, 10);
+        
+        // The first matching mandates file of the receiving node, as with the shell glob in usage_demo.sh
+        std::string mandates_prefix = "Node" + recv_node + "MandatedOutcomes";
+        
+        for (size_t j = 0; j < mandates.size(); j++)
+        {
+            if (Starts_With(mandates[j], mandates_prefix) && Ends_With(mandates[j], ".json"))
+            {
+                pair.mandates_path = std::string(mandates_dir) + "/" + mandates[j];
+                break;
+            }
+        }
+        
+        if (pair.mandates_path.empty())
+        {
+            throw std::runtime_error("Could not find mandates " + mandates_prefix + "*.json for " + send_filename + "!");
+        }
+        
+        pairs.push_back(pair);
+    }
+    
+    return pairs;
+}
+
+void Match_Scorer::Parse_Match_Traffic_Stats(const std::vector<Traffic_Log_Pair>& pairs, double start_timestamp, 
+    Match_Flow_Info_Map& match_flow_info)
+{
+    if (pairs.empty())
+    {
+        return;
+    }
+
+    // Parse the mandates of each receiving node exactly once, before they are shared by the workers
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        if (m_node_max_latency.find(pairs[i].recv_node) == m_node_max_latency.end())
+        {
+            Scoring_Parser scoring_parser;
+            
+            if (m_stats)
+            {
+                scoring_parser.Set_Stats(*m_stats);
+            }
+            
+            scoring_parser.Parse_Max_Latency_File(pairs[i].mandates_path.c_str(), m_node_max_latency[pairs[i].recv_node]);
+        }
+    }
+
+    // Threads beyond one per pair are spent splitting each pair's DRC files into chunks
+    size_t num_workers = std::min<size_t>(m_num_threads, pairs.size());
+    unsigned int threads_per_pair = m_num_threads / num_workers;
+    
+    std::vector<Pair_Result> results(pairs.size());
+    std::atomic<size_t> next_pair(0);
+    std::vector<std::thread> workers;
+    
+    for (size_t n = 0; n < num_workers; n++)
+    {
+        workers.push_back(std::thread([this, &pairs, &results, &next_pair, start_timestamp, threads_per_pair]()
+        {
+            size_t i;
+            while ((i = next_pair++) < pairs.size())
+            {
+                Pair_Result& result = results[i];
+                
+                try
+                {
+                    Scoring_Parser scoring_parser;
+                    scoring_parser.Set_Num_Threads(threads_per_pair);
+                    scoring_parser.Set_Use_Cache(m_use_cache);
+                    scoring_parser.Set_Use_Index(m_use_index);
+                    scoring_parser.Set_MP_Duration(m_mp_duration);
+                    scoring_parser.Set_Latency_Histograms(m_latency_histograms);
+                    scoring_parser.Set_Warning_Stream(result.warnings);
+                    
+                    if (m_windowed)
+                    {
+                        scoring_parser.Set_Time_Window(m_window_from, m_window_to);
+                    }
+                    
+                    if (m_stats)
+                    {
+                        scoring_parser.Set_Stats(*m_stats);
+                    }
+                    
+                    scoring_parser.Apply_Max_Latency_Map(m_node_max_latency.find(pairs[i].recv_node)->second, result.flow_info);
+                    
+                    scoring_parser.Parse_Flow_Traffic_Stats(pairs[i].send_path.c_str(), start_timestamp, result.flow_info);
+                    scoring_parser.Parse_Flow_Traffic_Stats(pairs[i].listen_path.c_str(), start_timestamp, result.flow_info);
+                }
+                catch (...)
+                {
+                    result.error = std::current_exception();
+                }
+            }
+        }));
+    }
+    
+    for (size_t n = 0; n < num_workers; n++)
+    {
+        workers[n].join();
+    }
+    
+    // Report in pair order, so warnings and errors do not depend on thread timing
+    for (size_t i = 0; i < pairs.size(); i++)
+    {
+        std::cerr << results[i].warnings.str();
+        
+        if (results[i].error)
+        {
+            std::rethrow_exception(results[i].error);
+        }
+        
+        match_flow_info[pairs[i].send_filename] = std::move(results[i].flow_info);
+    }
+}
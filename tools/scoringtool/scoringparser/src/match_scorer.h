@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "scoring_parser.h"
+
+// A send DRC file, its matching listen DRC file, and the mandates of the receiving node
+struct Traffic_Log_Pair
+{
+    std::string send_filename;  // send DRC filename without its directory, which keys the results
+    std::string send_path;      // path of the send DRC file
+    std::string listen_path;    // path of the listen DRC file
+    unsigned int recv_node;     // receiving node ID from the RECNODE tag of the send filename
+    std::string mandates_path;  // path of the mandates JSON file of the receiving node
+};
+
+/*
+ * Scores every send/listen DRC file pair of a match within one process.
+ * Pairs are parsed concurrently by a pool of threads, each pair into its
+ * own flow table, so the results are the same as parsing each pair alone.
+ */
+class Match_Scorer
+{
+public:
+    Match_Scorer();
+    virtual ~Match_Scorer();
+    
+    // Set the total number of threads used to parse the match (default 1)
+    void Set_Num_Threads(unsigned int num_threads);
+    
+    // Read events from a valid DRC cache file next to each DRC file, writing one when it is missing or out of date
+    void Set_Use_Cache(bool use_cache);
+
+    // Read or write a DRC index file next to each uncompressed DRC file, as with Scoring_Parser::Set_Use_Index
+    void Set_Use_Index(bool use_index);
+
+    // Only aggregate events within a time window of the match start, as with Scoring_Parser::Set_Time_Window
+    void Set_Time_Window(double from, double to);
+
+    // Set the duration of a measurement period, in seconds (default DEFAULT_MP_DURATION)
+    void Set_MP_Duration(double mp_duration);
+
+    // Record latency histograms of each flow, as with Scoring_Parser::Set_Latency_Histograms
+    void Set_Latency_Histograms(bool latency_histograms);
+
+    // Record the time of each phase and the events of each DRC file parsed, from every thread
+    void Set_Stats(Parse_Stats& stats);
+
+    // Pair each send_*.drc file in a traffic_logs directory with its listen_*.drc file, and with the 
+    // Node<RECNODE>MandatedOutcomes*.json file of its receiving node in a mandates directory
+    static std::vector<Traffic_Log_Pair> Find_Traffic_Log_Pairs(const char * traffic_logs_dir, const char * mandates_dir);
+    
+    // Parse the statistics of every pair, replacing any previous statistics of the same send filename. 
+    // The mandates of each receiving node are parsed once and kept for later calls.
+    void Parse_Match_Traffic_Stats(const std::vector<Traffic_Log_Pair>& pairs, double start_timestamp, 
+        Match_Flow_Info_Map& match_flow_info);
+
+protected:
+    unsigned int m_num_threads; // total number of threads used to parse the match
+    bool m_use_cache;           // true to read and write DRC cache files
+    bool m_use_index;           // true to read and write DRC index files
+    bool m_windowed;            // true if a time window has been set
+    double m_window_from;       // start of the time window, in seconds from the match start
+    double m_window_to;         // end of the time window, in seconds from the match start
+    double m_mp_duration;       // duration of a measurement period, in seconds
+    bool m_latency_histograms;  // true to record latency histograms
+    Parse_Stats * m_stats;      // stats being recorded, or NULL
+    
+    std::map<unsigned int, Max_Latency_Map> m_node_max_latency; // parsed mandates of each receiving node
+};
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "parse_stats.h"
+
+#include "rapidjson/writer.h"
+#include "rapidjson/filewritestream.h"
+
+// Size of the buffer used to write the stats JSON
+#define STATS_OUTPUT_BUFFER_SIZE (4 * 1024)
+
+namespace
+{
+    // JSON keys of each Parse_Phase
+    const char * const PHASE_NAMES[] = { "mandates", "open", "tokenize", "aggregate", "cache", "output" };
+    
+    static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) == PARSE_PHASE_COUNT, "Every Parse_Phase needs a name!");
+    
+    // JSON keys of each Traffic_Action
+    const char * const ACTION_NAMES[] = { "OTHER", "ON", "OFF", "LISTEN", "SEND", "RECV" };
+    
+    static_assert(sizeof(ACTION_NAMES) / sizeof(ACTION_NAMES[0]) == TRAFFIC_ACTION_RECV + 1, "Every Traffic_Action needs a name!");
+    
+    inline double Clock_Seconds(clockid_t clock)
+    {
+        struct timespec ts;
+        clock_gettime(clock, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+    
+    inline double Timeval_Seconds(const struct timeval& tv)
+    {
+        return tv.tv_sec + tv.tv_usec * 1e-6;
+    }
+    
+    // Rate of a count over a time, or zero if no time was measured
+    inline double Rate(double count, double time)
+    {
+        return (time > 0) ? count / time : 0;
+    }
+    
+    template<class Writer>
+    void Write_Phase_Time(Writer& writer, const Phase_Time& time)
+    {
+        writer.StartObject();
+        writer.Key("wall_time");
+        writer.Double(time.wall);
+        writer.Key("cpu_time");
+        writer.Double(time.cpu);
+        writer.EndObject();
+    }
+    
+    // Write the phases and event counts of a Parse_Counters as members of the current object
+    template<class Writer>
+    void Write_Counters(Writer& writer, const Parse_Counters& counters)
+    {
+        writer.Key("phases");
+        writer.StartObject();
+        
+        for (int phase = 0; phase < PARSE_PHASE_COUNT; phase++)
+        {
+            writer.Key(PHASE_NAMES[phase]);
+            Write_Phase_Time(writer, counters.phases[phase]);
+        }
+        
+        writer.EndObject();
+        
+        writer.Key("events");
+        writer.Uint64(counters.events);
+        
+        writer.Key("actions");
+        writer.StartObject();
+        
+        for (int action = 0; action <= TRAFFIC_ACTION_RECV; action++)
+        {
+            writer.Key(ACTION_NAMES[action]);
+            writer.Uint64(counters.action_events[action]);
+        }
+        
+        writer.EndObject();
+    }
+}
+
+Parse_Counters::Parse_Counters() :
+    events(0)
+{
+    for (int action = 0; action <= TRAFFIC_ACTION_RECV; action++)
+    {
+        action_events[action] = 0;
+    }
+}
+
+void Parse_Counters::Add(const Parse_Counters& other)
+{
+    for (int phase = 0; phase < PARSE_PHASE_COUNT; phase++)
+    {
+        phases[phase].Add(other.phases[phase]);
+    }
+    
+    events += other.events;
+    
+    for (int action = 0; action <= TRAFFIC_ACTION_RECV; action++)
+    {
+        action_events[action] += other.action_events[action];
+    }
+}
+
+void Parse_Counters::Count_Batch(const Traffic_Event_Batch& batch)
+{
+    events += batch.count;
+    
+    for (size_t i = 0; i < batch.count; i++)
+    {
+        action_events[batch.action[i]]++;
+    }
+}
+
+Phase_Timer::Phase_Timer(Parse_Counters * counters, Parse_Phase phase) :
+    m_time(counters ? &counters->phases[phase] : NULL),
+    m_wall_start(m_time ? Wall_Clock() : 0),
+    m_cpu_start(m_time ? Thread_CPU_Clock() : 0)
+{
+}
+
+Phase_Timer::~Phase_Timer()
+{
+    Stop();
+}
+
+void Phase_Timer::Stop()
+{
+    if (m_time)
+    {
+        m_time->wall += Wall_Clock() - m_wall_start;
+        m_time->cpu += Thread_CPU_Clock() - m_cpu_start;
+        m_time = NULL;
+    }
+}
+
+double Phase_Timer::Wall_Clock()
+{
+    return Clock_Seconds(CLOCK_MONOTONIC);
+}
+
+double Phase_Timer::Thread_CPU_Clock()
+{
+    return Clock_Seconds(CLOCK_THREAD_CPUTIME_ID);
+}
+
+Parse_Stats::Parse_Stats() :
+    m_wall_start(Phase_Timer::Wall_Clock()),
+    m_flows(0),
+    m_mps(0),
+    m_received_seqs(0),
+    m_max_received_seqs(0)
+{
+}
+
+void Parse_Stats::Add_Input_File(const Input_File_Stats& file_stats)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_files.push_back(file_stats);
+}
+
+void Parse_Stats::Count_Flows(const Flow_Info_Map& flow_info)
+{
+    for (Flow_Info_Map::const_iterator it = flow_info.begin(); it != flow_info.end(); it++)
+    {
+        uint64_t& mps = m_mps;
+        it->second.mp_stats.For_Each([&mps](int, const Measurement_Period_Stats&) { mps++; });
+        
+        uint64_t received_seqs = it->second.received_seqs.Size();
+        m_received_seqs += received_seqs;
+        m_max_received_seqs = std::max(m_max_received_seqs, received_seqs);
+    }
+    
+    m_flows += flow_info.size();
+}
+
+void Parse_Stats::Write_JSON(FILE * output)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    
+    double wall_time = Phase_Timer::Wall_Clock() - m_wall_start;
+    
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    
+    // Totals over the whole run, including every input file
+    Parse_Counters totals = m_counters;
+    uint64_t total_bytes = 0;
+    
+    for (size_t i = 0; i < m_files.size(); i++)
+    {
+        totals.Add(m_files[i].counters);
+        total_bytes += m_files[i].bytes;
+    }
+    
+    char buffer[STATS_OUTPUT_BUFFER_SIZE];
+    rapidjson::FileWriteStream stream(output, buffer, sizeof(buffer));
+    rapidjson::Writer<rapidjson::FileWriteStream> writer(stream);
+    
+    writer.StartObject();
+    
+    writer.Key("wall_time");
+    writer.Double(wall_time);
+    writer.Key("user_time");
+    writer.Double(Timeval_Seconds(usage.ru_utime));
+    writer.Key("system_time");
+    writer.Double(Timeval_Seconds(usage.ru_stime));
+    writer.Key("peak_rss");
+    writer.Uint64((uint64_t)usage.ru_maxrss * 1024);
+    
+    Write_Counters(writer, totals);
+    
+    writer.Key("bytes");
+    writer.Uint64(total_bytes);
+    
+    writer.Key("files");
+    writer.StartArray();
+    
+    for (size_t i = 0; i < m_files.size(); i++)
+    {
+        const Input_File_Stats& file = m_files[i];
+        
+        double cpu_time = 0;
+        for (int phase = 0; phase < PARSE_PHASE_COUNT; phase++)
+        {
+            cpu_time += file.counters.phases[phase].cpu;
+        }
+        
+        writer.StartObject();
+        writer.Key("filename");
+        writer.String(file.filename.c_str());
+        writer.Key("source");
+        writer.String(file.from_cache ? "cache" : "drc");
+        writer.Key("bytes");
+        writer.Uint64(file.bytes);
+        writer.Key("wall_time");
+        writer.Double(file.wall_time);
+        writer.Key("cpu_time");
+        writer.Double(cpu_time);
+        writer.Key("events_per_second");
+        writer.Double(Rate(file.counters.events, file.wall_time));
+        writer.Key("bytes_per_second");
+        writer.Double(Rate(file.bytes, file.wall_time));
+        Write_Counters(writer, file.counters);
+        writer.EndObject();
+    }
+    
+    writer.EndArray();
+    
+    writer.Key("flows");
+    writer.Uint64(m_flows);
+    writer.Key("measurement_periods");
+    writer.Uint64(m_mps);
+    writer.Key("received_seqs");
+    writer.Uint64(m_received_seqs);
+    writer.Key("max_received_seqs");
+    writer.Uint64(m_max_received_seqs);
+    
+    writer.EndObject();
+    
+    stream.Put('\n');
+    stream.Flush();
+    
+    if (ferror(output))
+    {
+        throw std::runtime_error("Error writing stats output!");
+    }
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "traffic_parser.h"
+#include "scoring_parser.h"
+
+// Phases of a scoring run timed by Parse_Stats
+enum Parse_Phase
+{
+    PARSE_PHASE_MANDATES,   // reading and parsing mandates JSON
+    PARSE_PHASE_OPEN,       // opening DRC and cache files, reading them in if they cannot be mapped
+    PARSE_PHASE_TOKENIZE,   // splitting DRC lines into events, including page faults of mapped files
+    PARSE_PHASE_AGGREGATE,  // updating flow statistics from events, and merging the chunks of each file
+    PARSE_PHASE_CACHE,      // collecting events for and writing DRC cache files
+    PARSE_PHASE_OUTPUT,     // writing the JSON or binary results
+    PARSE_PHASE_COUNT
+};
+
+// Wall and CPU time spent in a phase, in seconds
+struct Phase_Time
+{
+    Phase_Time() : wall(0), cpu(0) {}
+
+    void Add(const Phase_Time& other)
+    {
+        wall += other.wall;
+        cpu += other.cpu;
+    }
+
+    double wall;    // elapsed time, summed over the threads running the phase
+    double cpu;     // CPU time of the threads running the phase
+};
+
+/*
+ * Time and event counts of a parse. Each thread keeps its own counters,
+ * which are added together once it has finished.
+ */
+struct Parse_Counters
+{
+    Parse_Counters();
+
+    void Add(const Parse_Counters& other);
+
+    // Count the events of a batch by action
+    void Count_Batch(const Traffic_Event_Batch& batch);
+
+    Phase_Time phases[PARSE_PHASE_COUNT];           // time spent in each phase
+    uint64_t events;                                // number of events parsed
+    uint64_t action_events[TRAFFIC_ACTION_RECV + 1]; // number of events parsed of each Traffic_Action
+};
+
+/*
+ * Adds the wall and CPU time of its own lifetime to a phase, on the thread
+ * which created it. Does nothing if given no counters.
+ */
+class Phase_Timer
+{
+public:
+    Phase_Timer(Parse_Counters * counters, Parse_Phase phase);
+    ~Phase_Timer();
+
+    // Add the time so far to the phase, and stop timing
+    void Stop();
+
+    // Monotonic wall clock, in seconds
+    static double Wall_Clock();
+
+    // CPU time of the calling thread, in seconds
+    static double Thread_CPU_Clock();
+
+protected:
+    Phase_Time * m_time;    // phase to add to, or NULL
+    double m_wall_start;
+    double m_cpu_start;
+
+private:
+    Phase_Timer(const Phase_Timer&);
+    Phase_Timer& operator=(const Phase_Timer&);
+};
+
+// Statistics of one DRC file parsed
+struct Input_File_Stats
+{
+    Input_File_Stats() : from_cache(false), bytes(0), wall_time(0) {}
+
+    std::string filename;       // DRC file name
+    bool from_cache;            // true if the events were read from the file's DRC cache
+    uint64_t bytes;             // size of the file read, compressed or cached
+    double wall_time;           // elapsed time from opening the file to merging its events
+    Parse_Counters counters;    // time of each phase and events of the file
+};
+
+/*
+ * Timing, throughput and memory metrics of a scoring run, written as one
+ * JSON object by Write_JSON. Input files may be added from several threads.
+ */
+class Parse_Stats
+{
+public:
+    // Starts the run's wall clock
+    Parse_Stats();
+
+    // Counters of the phases which are not part of an input file, such as mandates and output
+    Parse_Counters& Counters() { return m_counters; }
+
+    void Add_Input_File(const Input_File_Stats& file_stats);
+
+    // Count the flows, measurement periods and received sequence numbers of the results
+    void Count_Flows(const Flow_Info_Map& flow_info);
+
+    // Count measurement periods which were released from the results before Count_Flows, as in a streaming parse
+    void Count_Released_Periods(uint64_t mps) { m_mps += mps; }
+
+    void Write_JSON(FILE * output);
+
+protected:
+    std::mutex m_mutex;                     // guards m_files
+    double m_wall_start;                    // wall clock at the start of the run
+    Parse_Counters m_counters;              // counters of the phases outside of input files
+    std::vector<Input_File_Stats> m_files;  // statistics of each input file, in the order parsed
+    uint64_t m_flows;                       // number of flows in the results
+    uint64_t m_mps;                         // number of measurement periods with statistics, over all flows
+    uint64_t m_received_seqs;               // received sequence numbers held, over all flows
+    uint64_t m_max_received_seqs;           // most received sequence numbers held by one flow
+};
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <benchmark/benchmark.h>
+
+#include "traffic_parser.h"
+#include "scoring_parser.h"
+#include "drc_generator.h"
+
+/*
+ * Benchmarks of the DRC parsing and scoring hot paths, on synthetic matches
+ * from Generate_DRC_Files. Matches are described by the benchmark arguments 
+ * flows, rate (packets per second per flow), dup and late (percent of 
+ * received packets) and length (seconds), and each is generated once into a 
+ * temporary directory. Every benchmark reports events/s and bytes/s of DRC 
+ * input, and peak_rss, the peak resident set size of the whole process so 
+ * far. Run one benchmark at a time with --benchmark_filter to measure its 
+ * own peak memory.
+ */
+
+namespace
+{
+    // A generated send and listen DRC file pair
+    struct Generated_Match
+    {
+        DRC_Generator_Options options;
+        DRC_Generator_Counts counts;
+        std::string send_filename;
+        std::string listen_filename;
+        std::string mandates;
+    };
+
+    // Generated matches, removed along with their directory when the benchmarks exit
+    class Match_Cache
+    {
+    public:
+        ~Match_Cache()
+        {
+            for (std::map<std::string, Generated_Match>::iterator it = m_matches.begin(); it != m_matches.end(); ++it)
+            {
+                unlink(it->second.send_filename.c_str());
+                unlink(it->second.listen_filename.c_str());
+            }
+            
+            if (!m_dir.empty())
+            {
+                rmdir(m_dir.c_str());
+            }
+        }
+
+        const Generated_Match& Get(const DRC_Generator_Options& options)
+        {
+            std::ostringstream key;
+            key << options.num_flows << "_" << options.packet_rate << "_" << options.duplicate_fraction << "_" 
+                << options.late_fraction << "_" << options.match_length;
+            
+            std::map<std::string, Generated_Match>::iterator it = m_matches.find(key.str());
+            if (it != m_matches.end())
+            {
+                return it->second;
+            }
+            
+            if (m_dir.empty())
+            {
+                const char * tmpdir = getenv("TMPDIR");
+                std::string dir_template = std::string(tmpdir ? tmpdir : "/tmp") + "/scoring_benchmark_XXXXXX";
+                
+                std::vector<char> dir(dir_template.begin(), dir_template.end());
+                dir.push_back('\0');
+                
+                if (!mkdtemp(&dir[0]))
+                {
+                    throw std::runtime_error("Cannot create benchmark directory " + dir_template + "!");
+                }
+                
+                m_dir = &dir[0];
+            }
+            
+            Generated_Match& match = m_matches[key.str()];
+            match.options = options;
+            match.send_filename = m_dir + "/send_" + key.str() + ".drc";
+            match.listen_filename = m_dir + "/listen_" + key.str() + ".drc";
+            match.counts = Generate_DRC_Files(options, match.send_filename.c_str(), match.listen_filename.c_str());
+            match.mandates = Generate_Mandates_JSON(options);
+            
+            return match;
+        }
+
+    protected:
+        std::string m_dir;
+        std::map<std::string, Generated_Match> m_matches;
+    };
+
+    Match_Cache match_cache;
+
+    // Match described by the benchmark arguments flows, rate, dup, late and length
+    const Generated_Match& Get_Match(const benchmark::State& state)
+    {
+        DRC_Generator_Options options;
+        options.num_flows = state.range(0);
+        options.packet_rate = state.range(1);
+        options.duplicate_fraction = state.range(2) / 100.0;
+        options.late_fraction = state.range(3) / 100.0;
+        options.match_length = state.range(4);
+        
+        return match_cache.Get(options);
+    }
+
+    // Report throughput of the events and bytes processed per iteration, and the peak resident set size
+    void Set_Counters(benchmark::State& state, size_t events, size_t bytes)
+    {
+        state.SetBytesProcessed(state.iterations() * bytes);
+        state.counters["events"] = benchmark::Counter(events * (double)state.iterations(), benchmark::Counter::kIsRate);
+        
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        state.counters["peak_rss"] = benchmark::Counter(usage.ru_maxrss * 1024.0, benchmark::Counter::kDefaults, 
+            benchmark::Counter::OneK::kIs1024);
+    }
+
+    // Synthetic matches: flows, rate, dup, late, length
+    void Match_Arguments(benchmark::internal::Benchmark * benchmark)
+    {
+        benchmark->ArgNames({"flows", "rate", "dup", "late", "length"});
+        benchmark->Args({1, 100, 0, 0, 60});
+        benchmark->Args({10, 100, 0, 0, 60});
+        benchmark->Args({10, 100, 5, 10, 60});
+        benchmark->Args({100, 100, 1, 5, 60});
+        benchmark->Args({10, 1000, 1, 5, 600});
+        benchmark->Unit(benchmark::kMillisecond);
+    }
+}
+
+// DRC timestamp decoding, over consecutive timestamps with the same date
+static void BM_DRC_Timestamp_Decode(benchmark::State& state)
+{
+    std::vector<std::string> timestamps;
+    for (size_t i = 0; i < 4096; i++)
+    {
+        timestamps.push_back(Format_DRC_Timestamp(DRC_GENERATOR_START_TIMESTAMP + i * 0.0137));
+    }
+    
+    size_t bytes = 0;
+    for (size_t i = 0; i < timestamps.size(); i++)
+    {
+        bytes += timestamps[i].size();
+    }
+    
+    DRC_Timestamp_Decoder decoder;
+    
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < timestamps.size(); i++)
+        {
+            const std::string& timestamp = timestamps[i];
+            benchmark::DoNotOptimize(decoder.Decode(timestamp.data(), timestamp.data() + timestamp.size()));
+        }
+    }
+    
+    Set_Counters(state, timestamps.size(), bytes);
+}
+BENCHMARK(BM_DRC_Timestamp_Decode);
+
+// Compatibility interface of Traffic_Parser, copying every event of the listen file
+static void BM_Traffic_Parser_Next(benchmark::State& state)
+{
+    const Generated_Match& match = Get_Match(state);
+    
+    for (auto _ : state)
+    {
+        Traffic_Parser parser(match.listen_filename.c_str());
+        Traffic_Event event;
+        
+        while (parser.Next(event))
+        {
+            benchmark::DoNotOptimize(event.time);
+        }
+    }
+    
+    Set_Counters(state, match.counts.listen_events, match.counts.listen_bytes);
+}
+BENCHMARK(BM_Traffic_Parser_Next)->Apply(Match_Arguments);
+
+// Batched zero-copy interface of Traffic_Parser, over the listen file
+static void BM_Traffic_Parser_Next_Batch(benchmark::State& state)
+{
+    const Generated_Match& match = Get_Match(state);
+    Traffic_Event_Batch batch;
+    
+    for (auto _ : state)
+    {
+        Traffic_Parser parser(match.listen_filename.c_str());
+        
+        while (parser.Next_Batch(batch))
+        {
+            benchmark::DoNotOptimize(batch.count);
+        }
+    }
+    
+    Set_Counters(state, match.counts.listen_events, match.counts.listen_bytes);
+}
+BENCHMARK(BM_Traffic_Parser_Next_Batch)->Apply(Match_Arguments);
+
+// Measurement period statistics of a send and listen file pair
+static void BM_Parse_Flow_Traffic_Stats(benchmark::State& state)
+{
+    const Generated_Match& match = Get_Match(state);
+    std::ostringstream warnings;
+    
+    for (auto _ : state)
+    {
+        Scoring_Parser scoring_parser;
+        scoring_parser.Set_Warning_Stream(warnings);
+        
+        Flow_Info_Map flow_info;
+        scoring_parser.Parse_Max_Latency_Per_Flow(match.mandates.c_str(), flow_info);
+        scoring_parser.Parse_Flow_Traffic_Stats(match.send_filename.c_str(), DRC_GENERATOR_START_TIMESTAMP, flow_info);
+        scoring_parser.Parse_Flow_Traffic_Stats(match.listen_filename.c_str(), DRC_GENERATOR_START_TIMESTAMP, flow_info);
+        
+        benchmark::DoNotOptimize(flow_info);
+        warnings.str("");
+    }
+    
+    Set_Counters(state, match.counts.send_events + match.counts.listen_events, 
+        match.counts.send_bytes + match.counts.listen_bytes);
+}
+BENCHMARK(BM_Parse_Flow_Traffic_Stats)->Apply(Match_Arguments);
+
+// JSON output of the statistics of a send and listen file pair. Bytes are those of the JSON.
+static void BM_Get_JSON_Flow_Traffic_Stats(benchmark::State& state)
+{
+    const Generated_Match& match = Get_Match(state);
+    std::ostringstream warnings;
+    
+    Scoring_Parser scoring_parser;
+    scoring_parser.Set_Warning_Stream(warnings);
+    
+    Flow_Info_Map flow_info;
+    scoring_parser.Parse_Max_Latency_Per_Flow(match.mandates.c_str(), flow_info);
+    scoring_parser.Parse_Flow_Traffic_Stats(match.send_filename.c_str(), DRC_GENERATOR_START_TIMESTAMP, flow_info);
+    scoring_parser.Parse_Flow_Traffic_Stats(match.listen_filename.c_str(), DRC_GENERATOR_START_TIMESTAMP, flow_info);
+    
+    size_t json_size = 0;
+    
+    for (auto _ : state)
+    {
+        std::string json = scoring_parser.Get_JSON_Flow_Traffic_Stats(flow_info);
+        json_size = json.size();
+        benchmark::DoNotOptimize(json);
+    }
+    
+    Set_Counters(state, match.counts.send_events + match.counts.listen_events, json_size);
+}
+BENCHMARK(BM_Get_JSON_Flow_Traffic_Stats)->Apply(Match_Arguments);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdexcept>
+
+#include "scoring_native.h"
+#include "binary_results.h"
+
+namespace
+{
+    // Bytes of the first count entries of a column
+    template<class T>
+    inline std::string Column_Bytes(const std::vector<T>& column, size_t count)
+    {
+        return std::string((const char *)column.data(), count * sizeof(T));
+    }
+}
+
+void Traffic_Stats::Parse_Mandates(const std::string& json_flow_mandates)
+{
+    m_parser.Parse_Max_Latency_Per_Flow(json_flow_mandates.c_str(), m_flow_info);
+}
+
+void Traffic_Stats::Parse_Mandates_File(const std::string& mandates_file)
+{
+    Max_Latency_Map max_latency;
+    m_parser.Parse_Max_Latency_File(mandates_file.c_str(), max_latency);
+    m_parser.Apply_Max_Latency_Map(max_latency, m_flow_info);
+}
+
+void Traffic_Stats::Parse_DRC_File(const std::string& drc_file, double start_timestamp)
+{
+    m_parser.Parse_Flow_Traffic_Stats(drc_file.c_str(), start_timestamp, m_flow_info);
+}
+
+std::string Traffic_Stats::Get_Binary() const
+{
+    return Get_Binary_Flow_Traffic_Stats(m_flow_info);
+}
+
+std::string Traffic_Stats::Get_JSON()
+{
+    return m_parser.Get_JSON_Flow_Traffic_Stats(m_flow_info);
+}
+
+Traffic_Reader::Traffic_Reader(const std::string& drc_file, size_t batch_size) :
+    m_parser(drc_file.c_str()),
+    m_batch(batch_size)
+{
+}
+
+size_t Traffic_Reader::Next_Batch()
+{
+    if (!m_parser.Next_Batch(m_batch))
+    {
+        m_batch.count = 0;
+    }
+    
+    return m_batch.count;
+}
+
+std::string Traffic_Reader::Get_Column(const std::string& name) const
+{
+    size_t count = m_batch.count;
+    
+    if (name == "action")  return Column_Bytes(m_batch.action, count);
+    if (name == "fields")  return Column_Bytes(m_batch.fields, count);
+    if (name == "time")    return Column_Bytes(m_batch.time, count);
+    if (name == "sent")    return Column_Bytes(m_batch.sent, count);
+    if (name == "port")    return Column_Bytes(m_batch.port, count);
+    if (name == "flow")    return Column_Bytes(m_batch.flow, count);
+    if (name == "seq")     return Column_Bytes(m_batch.seq, count);
+    if (name == "frag")    return Column_Bytes(m_batch.frag, count);
+    if (name == "tos")     return Column_Bytes(m_batch.tos, count);
+    if (name == "dstAddr") return Column_Bytes(m_batch.dstAddr, count);
+    if (name == "dstPort") return Column_Bytes(m_batch.dstPort, count);
+    if (name == "srcAddr") return Column_Bytes(m_batch.srcAddr, count);
+    if (name == "srcPort") return Column_Bytes(m_batch.srcPort, count);
+    if (name == "size")    return Column_Bytes(m_batch.size, count);
+    
+    throw std::runtime_error("Unknown traffic event column \"" + name + "\"!");
+}
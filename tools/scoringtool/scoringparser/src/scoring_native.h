@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "traffic_parser.h"
+#include "scoring_parser.h"
+
+/*
+ * Classes exposed to python by the scoring_native extension module (see
+ * scoring_native.i), so DRC files can be scored in-process rather than by
+ * running scoring_parser. Binary results and event columns are returned
+ * as bytes in host byte order, and the methods which parse release the
+ * GIL, so separate objects may be used from separate python threads.
+ */
+
+/*
+ * Flow statistics of a send/listen DRC file pair, as produced by
+ * scoring_parser for its --input files.
+ */
+class Traffic_Stats
+{
+public:
+    void Set_Num_Threads(unsigned int num_threads) { m_parser.Set_Num_Threads(num_threads); }
+    void Set_Use_Cache(bool use_cache) { m_parser.Set_Use_Cache(use_cache); }
+    void Set_MP_Duration(double mp_duration) { m_parser.Set_MP_Duration(mp_duration); }
+
+    // Set the maximum latency of each flow from a mandates JSON list, as with --mandates
+    void Parse_Mandates(const std::string& json_flow_mandates);
+
+    // Set the maximum latency of each flow from a mandates JSON file, as with --mandates-file
+    void Parse_Mandates_File(const std::string& mandates_file);
+
+    // Add the events of a DRC file to the statistics
+    void Parse_DRC_File(const std::string& drc_file, double start_timestamp);
+
+    // Statistics in the layout of binary_results.h, as with --output-format binary
+    std::string Get_Binary() const;
+
+    // Statistics as JSON, as with --output-format json
+    std::string Get_JSON();
+
+protected:
+    Scoring_Parser m_parser;
+    Flow_Info_Map m_flow_info;
+};
+
+/*
+ * Reads the events of a DRC file in batches of columns, as with
+ * Traffic_Parser::Next_Batch.
+ */
+class Traffic_Reader
+{
+public:
+    Traffic_Reader(const std::string& drc_file, size_t batch_size = TRAFFIC_EVENT_BATCH_SIZE);
+
+    // Read the next batch of events. Returns the number of events read, or zero at the end of the file.
+    size_t Next_Batch();
+
+    // Contents of a column of the current batch, one entry per event. The columns are the numeric 
+    // columns of Traffic_Event_Batch: action (uint8), fields, port, flow, seq, frag, tos, dstAddr, 
+    // dstPort, srcAddr, srcPort and size (uint32), and time and sent (double).
+    std::string Get_Column(const std::string& name) const;
+
+protected:
+    Traffic_Parser m_parser;
+    Traffic_Event_Batch m_batch;    // current batch, with a count of zero at the end of the file
+};
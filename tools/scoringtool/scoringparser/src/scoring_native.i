@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Wrappers release the GIL only where declared with %thread below
+%module(threads="1") scoring_native
+%{
+#include "scoring_native.h"
+%}
+
+%include <std_string.i>
+%include <exception.i>
+
+%nothread;
+
+// Parse errors are raised as RuntimeError
+%exception {
+    try {
+        $action
+    } catch (const std::exception& err) {
+        SWIG_exception(SWIG_RuntimeError, err.what());
+    }
+}
+
+// Binary results and event columns are returned as bytes, which numpy.frombuffer reads without copying
+%typemap(out) std::string Get_Binary, std::string Get_Column %{
+    $result = PyBytes_FromStringAndSize($1.data(), $1.size());
+%}
+
+%thread Traffic_Stats::Parse_Mandates;
+%thread Traffic_Stats::Parse_Mandates_File;
+%thread Traffic_Stats::Parse_DRC_File;
+%thread Traffic_Stats::Get_Binary;
+%thread Traffic_Stats::Get_JSON;
+%thread Traffic_Reader::Traffic_Reader;
+%thread Traffic_Reader::Next_Batch;
+
+%include "scoring_native.h"
@@ -18,22 +18,52 @@
 #include <sstream>
 #include <iomanip>
 #include <iostream>
+#include <fstream>
+#include <iterator>
 #include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <limits>
 #include <math.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "scoring_parser.h"
 #include "traffic_parser.h"
+#include "drc_cache.h"
+#include "drc_index.h"
+#include "parse_stats.h"
 
 #include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
+#include "rapidjson/filewritestream.h"
 
-// Duration of a measurement period, in seconds
-#define MP_DURATION 1.0
 #define MGEN_DUMMY_MESSAGE_PORT 1000
 
+// Minimum size of a DRC file chunk parsed by its own thread, in bytes
+#define MIN_CHUNK_SIZE (4 * 1024 * 1024)
+
+// Minimum number of cached events in a chunk processed by its own thread
+#define MIN_CHUNK_EVENTS (256 * 1024)
+
+// Size of the buffer used to stream JSON output to a file
+#define JSON_OUTPUT_BUFFER_SIZE (64 * 1024)
+
 namespace
 {
+    // Get the next batch of events from a Traffic_Parser or DRC_Cache, timed as tokenizing
+    template<class Event_Source>
+    inline bool Timed_Next_Batch(Event_Source& event_source, Traffic_Event_Batch& batch, Parse_Counters * counters)
+    {
+        Phase_Timer timer(counters, PARSE_PHASE_TOKENIZE);
+        return event_source.Next_Batch(batch);
+    }
+    
     // Return a string representation of a value
     template<class T>
     inline std::string to_string(const T& value)
@@ -57,329 +87,1540 @@ namespace
             param = new_value;
         }
     }
-}
-
-Scoring_Parser::Scoring_Parser()
-{
-}
-
-Scoring_Parser::~Scoring_Parser()
-{
-}
-
-void Scoring_Parser::Parse_Max_Latency_Per_Flow(const char * json_flow_mandates, std::map<unsigned int, Flow_Info>& flow_info)
-{
-    rapidjson::Document mandates;
-    mandates.Parse(json_flow_mandates);
-
-    if (!mandates.IsArray())
+    
+    // Set a string flow parameter from a view into the DRC file, only copying it when first set
+    inline void Update_Flow_Parameter(unsigned int flow_uid, const std::string& field_name, boost::optional<std::string>& param, const boost::string_ref& new_value)
     {
-        throw std::runtime_error("Array expected for JSON flow mandates!");
+        if (param && *param != new_value)
+        {
+            throw std::runtime_error("Error updating parameter \"" + field_name + "\" in flow " + 
+                to_string(flow_uid) + ": changed from \"" + *param + "\" to \"" + new_value.to_string() + "\"!");
+        }
+        else if (!param)
+        {
+            param = new_value.to_string();
+        }
     }
-
-    for (rapidjson::SizeType i = 0; i < mandates.Size(); i++) 
+    
+    // Set an IPv4 address flow parameter, checking it has not changed if it already exists
+    inline void Update_Flow_Address(unsigned int flow_uid, const std::string& field_name, boost::optional<uint32_t>& param, uint32_t new_value)
+    {
+        if (param && *param != new_value)
+        {
+            throw std::runtime_error("Error updating parameter \"" + field_name + "\" in flow " + 
+                to_string(flow_uid) + ": changed from \"" + Format_IPv4_Address(*param) + "\" to \"" + Format_IPv4_Address(new_value) + "\"!");
+        }
+        else if (!param)
+        {
+            param = new_value;
+        }
+    }
+    
+    // Build the signature of a SEND or RECV event. Returns false if the event cannot have one, so its
+    // parameters must always be checked in full.
+    inline bool Get_Flow_Signature(const Traffic_Event_Batch& batch, size_t i, bool with_src_addr, Flow_Signature& signature)
     {
-        if (!mandates[i].HasMember("scenario_goals") || !mandates[i]["scenario_goals"].IsArray())
+        const boost::string_ref& proto = batch.proto[i];
+        if (proto.size() > sizeof(signature.proto))
         {
-            throw std::runtime_error("Mandate does not have \"scenario_goals\" array!");
+            return false;
         }
         
-        const rapidjson::Value& scenario_goals = mandates[i]["scenario_goals"];
-
-        for (rapidjson::SizeType j = 0; j < scenario_goals.Size(); j++) 
+        signature.bound = true;
+        signature.proto = 0;
+        memcpy(&signature.proto, proto.data(), proto.size());
+        signature.tos = batch.tos[i];
+        signature.size = batch.size[i];
+        signature.srcAddr = with_src_addr ? batch.srcAddr[i] : 0;
+        signature.srcPort = batch.srcPort[i];
+        signature.dstAddr = batch.dstAddr[i];
+        signature.dstPort = batch.dstPort[i];
+        return true;
+    }
+    
+    // First receipt of a sequence number within a chunk of a DRC file
+    struct First_Receipt
+    {
+        unsigned int seq;   // sequence number received
+        int mp_num;         // measurement period the receipt was counted in
+        bool late;          // true if counted as late, false if counted as received
+        double latency;     // latency of the receipt, in seconds
+    };
+    
+    typedef std::map<unsigned int, std::vector<First_Receipt> > First_Receipt_Map;
+    
+    // Partial statistics from parsing one chunk of a DRC file
+    struct Chunk_Result
+    {
+        Chunk_Result() : stopped(false) {}
+        
+        Flow_Info_Map flow_info;                      // flow statistics for the chunk only
+        First_Receipt_Map first_receipts;             // sequence numbers first received in the chunk, in file order
+        std::ostringstream warnings;                  // warnings to be reported once the chunk is merged
+        std::exception_ptr error;                     // exception hit while parsing the chunk, if any
+        bool stopped;                                 // true if parsing ended before the end of the chunk
+        DRC_Cache_Builder cache_builder;              // events parsed from the chunk, if a cache is being built
+        DRC_Index_Builder index_builder;              // blocks parsed from the chunk, if an index is being built
+        Parse_Counters counters;                      // time and events of the chunk, if stats are being recorded
+    };
+    
+    // Settings controlling how traffic events are aggregated into measurement periods
+    struct Aggregation_Settings
+    {
+        double start_timestamp;     // match start time, which begins measurement period zero
+        double mp_duration;         // duration of a measurement period, in seconds
+        bool latency_histograms;    // true to record the latency of each received and late packet
+        bool windowed;              // true to only aggregate events within the time window
+        double window_begin;        // start of the time window, compared with Traffic_Period_Time
+        double window_end;          // end of the time window, which is not included
+    };
+    
+    // Per-event values computed for a whole batch before it is aggregated
+    struct Batch_Columns
+    {
+        std::vector<int> mp_nums;       // measurement period of each event, by sent time for RECV events
+        std::vector<double> latencies;  // latency of each event, zero unless a sent time is present
+    };
+    
+    // Update flow statistics from a batch of traffic events, optionally recording first receipts of each sequence number.
+    // The parser has already checked each event against its action's schema, so the fields used are always present.
+    void Process_Traffic_Batch(const Traffic_Event_Batch& batch, Batch_Columns& columns, const Aggregation_Settings& settings, 
+        Flow_Info_Map& flow_info, std::ostream& warnings, First_Receipt_Map * first_receipts)
+    {
+        size_t count = batch.count;
+        columns.mp_nums.resize(batch.Capacity());
+        columns.latencies.resize(batch.Capacity());
+        
+        int * mp_nums = &columns.mp_nums[0];
+        double * latencies = &columns.latencies[0];
+        const uint8_t * actions = &batch.action[0];
+        const double * times = &batch.time[0];
+        const double * sents = &batch.sent[0];
+        double start_timestamp = settings.start_timestamp;
+        double mp_duration = settings.mp_duration;
+        
+        // Branch-free passes over whole columns
+        for (size_t i = 0; i < count; i++)
         {
-            const rapidjson::Value& goal = scenario_goals[j];
-                
-            if (!goal.HasMember("requirements") || !goal["requirements"].IsObject())
+            double mp_time = Traffic_Period_Time(actions[i], times[i], sents[i]);
+            mp_nums[i] = floor((mp_time - start_timestamp) / mp_duration);
+        }
+        
+        for (size_t i = 0; i < count; i++)
+        {
+            latencies[i] = times[i] - sents[i];
+        }
+        
+        for (size_t i = 0; i < count; i++)
+        {
+            switch (batch.action[i])
             {
-                throw std::runtime_error("Goal \"requirements\" are missing or incorrect type!");
+            case TRAFFIC_ACTION_ON:
+            {
+                unsigned int flow_uid = batch.flow[i];
+                
+                Flow_Info& info = flow_info[flow_uid];
+                info.on_time = batch.time[i];
+                
+                Update_Flow_Parameter(flow_uid, "srcPort", info.srcPort, batch.srcPort[i]);
+                Update_Flow_Address(flow_uid, "dstAddr", info.dstAddr, batch.dstAddr[i]);
+                Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, batch.dstPort[i]);
+                break;
             }
-            
-            const rapidjson::Value& requirements = goal["requirements"];
-            
-            if (!goal.HasMember("flow_uid") || !goal["flow_uid"].IsUint())
+            case TRAFFIC_ACTION_OFF:
             {
-                throw std::runtime_error("Goal \"flow_uid\" is missing or incorrect type!");
+                unsigned int flow_uid = batch.flow[i];
+                
+                Flow_Info& info = flow_info[flow_uid];
+                info.off_time = batch.time[i];
+                
+                Update_Flow_Parameter(flow_uid, "srcPort", info.srcPort, batch.srcPort[i]);
+                Update_Flow_Address(flow_uid, "dstAddr", info.dstAddr, batch.dstAddr[i]);
+                Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, batch.dstPort[i]);
+                break;
             }
-            
-            unsigned int flow_uid = goal["flow_uid"].GetUint();
-
-            if (requirements.HasMember("file_transfer_deadline_s") && requirements["file_transfer_deadline_s"].IsDouble())
+            case TRAFFIC_ACTION_LISTEN:
             {
-                Update_Flow_Parameter(
-                    flow_uid, 
-                    "max_latency", 
-                    flow_info[flow_uid].max_latency, 
-                    requirements["file_transfer_deadline_s"].GetDouble()
-                    );
+                unsigned int flow_uid = batch.port[i];
+                
+                Flow_Info& info = flow_info[flow_uid];
+                info.listen_time = batch.time[i];
+                
+                Update_Flow_Parameter(flow_uid, "proto", info.proto, batch.proto[i]);
+                Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, batch.port[i]);
+                break;
             }
-            else if (requirements.HasMember("max_latency_s") && requirements["max_latency_s"].IsDouble())
+            case TRAFFIC_ACTION_SEND:
             {
-                Update_Flow_Parameter(
-                    flow_uid, 
-                    "max_latency", 
-                    flow_info[flow_uid].max_latency, 
-                    requirements["max_latency_s"].GetDouble()
-                    );
+                unsigned int flow_uid = batch.flow[i];
+                
+                int mp_num = mp_nums[i];
+                if (mp_num < 0)
+                {
+                    if (batch.dstPort[i] != MGEN_DUMMY_MESSAGE_PORT) {
+                        warnings << "SEND measurement period for flow " << flow_uid
+                            << " with timestamp " << batch.time[i]
+                            << " occurred before start time!" << std::endl;
+                    }
+                    break;
+                }
+                
+                Flow_Info& info = flow_info[flow_uid];
+                if (mp_num <= info.finalized_mp_num)
+                {
+                    info.num_dropped++;
+                    break;
+                }
+                
+                Measurement_Period_Stats& stats = info.mp_stats[mp_num];
+                stats.sent++;
+                
+                Flow_Signature signature;
+                bool has_signature = Get_Flow_Signature(batch, i, false, signature);
+                
+                if (!has_signature || !(signature == info.send_signature))
+                {
+                    Update_Flow_Parameter(flow_uid, "proto", info.proto, batch.proto[i]);
+                    Update_Flow_Parameter(flow_uid, "tos", info.tos, batch.tos[i]);
+                    Update_Flow_Parameter(flow_uid, "size", info.size, batch.size[i]);
+                    Update_Flow_Parameter(flow_uid, "srcPort", info.srcPort, batch.srcPort[i]);
+                    Update_Flow_Address(flow_uid, "dstAddr", info.dstAddr, batch.dstAddr[i]);
+                    Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, batch.dstPort[i]);
+                    
+                    if (has_signature)
+                    {
+                        info.send_signature = signature;
+                    }
+                }
+                break;
             }
-            else
+            case TRAFFIC_ACTION_RECV:
             {
-                throw std::runtime_error("Expected \"max_latency_s\" or \"file_transfer_deadline_s\" of numerical type!");
+                unsigned int flow_uid = batch.flow[i];
+                
+                int mp_num = mp_nums[i];
+                if (mp_num < 0)
+                {
+                    if (batch.dstPort[i] != MGEN_DUMMY_MESSAGE_PORT) {
+                        warnings << "RECV measurement period for flow " << flow_uid
+                            << " with sent timestamp " << batch.sent[i]
+                            << " occurred before start time!" << std::endl;
+                    }
+                    break;
+                }
+                
+                Flow_Info& info = flow_info[flow_uid];
+                if (mp_num <= info.finalized_mp_num)
+                {
+                    info.num_dropped++;
+                    break;
+                }
+                
+                if (!info.max_latency)
+                {
+                    throw std::runtime_error("Max latency is missing for flow " + to_string(flow_uid) + "!");
+                }
+                
+                bool duplicate = !info.received_seqs.Insert(batch.seq[i]);
+                bool late = (latencies[i] > *info.max_latency);
+                
+                if (!duplicate && first_receipts)
+                {
+                    First_Receipt receipt = { batch.seq[i], mp_num, late, latencies[i] };
+                    (*first_receipts)[flow_uid].push_back(receipt);
+                }
+                
+                // Latencies of first receipts within a chunk are recorded once the chunk is merged, 
+                // when they are known not to duplicate a receipt in a preceding chunk
+                if (!duplicate && !first_receipts && settings.latency_histograms)
+                {
+                    info.latency.Record(latencies[i]);
+                    info.mp_latency[mp_num].Record(latencies[i]);
+                }
+                
+                Measurement_Period_Stats& stats = info.mp_stats[mp_num];
+                
+                if (duplicate)
+                {
+                    stats.duplicate++;
+                }
+                else if (late)
+                {
+                    stats.late++;
+                }
+                else
+                {
+                    stats.received++;
+                }
+                
+                Flow_Signature signature;
+                bool has_signature = Get_Flow_Signature(batch, i, true, signature);
+                
+                if (!has_signature || !(signature == info.recv_signature))
+                {
+                    Update_Flow_Parameter(flow_uid, "proto", info.proto, batch.proto[i]);
+                    Update_Flow_Parameter(flow_uid, "tos", info.tos, batch.tos[i]);
+                    Update_Flow_Parameter(flow_uid, "size", info.size, batch.size[i]);
+                    Update_Flow_Address(flow_uid, "srcAddr", info.srcAddr, batch.srcAddr[i]);
+                    Update_Flow_Parameter(flow_uid, "srcPort", info.srcPort, batch.srcPort[i]);
+                    Update_Flow_Address(flow_uid, "dstAddr", info.dstAddr, batch.dstAddr[i]);
+                    Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, batch.dstPort[i]);
+                    
+                    if (has_signature)
+                    {
+                        info.recv_signature = signature;
+                    }
+                }
+                break;
+            }
+            default:
+                break;
             }
         }
     }
-}
-
-void Scoring_Parser::Parse_Flow_Traffic_Stats(const char * drc_file, double start_timestamp, std::map<unsigned int, Flow_Info>& flow_info)
-{
-    Traffic_Parser traffic_parser(drc_file);
-    Traffic_Event traffic_event;
+        
+    // Report a warning from decompressing a DRC file which has been completely parsed
+    void Report_Decompression_Warning(Traffic_Parser& traffic_parser, const char * drc_file, std::ostream& warnings)
+    {
+        std::string warning = traffic_parser.Decompression_Warning();
+        
+        if (!warning.empty())
+        {
+            warnings << warning << " of " << drc_file << "!" << std::endl;
+        }
+    }
     
-    while (traffic_parser.Next(traffic_event))
+    // Remove the SEND and RECV events of a batch outside of the time window, keeping the rest in order. ON, OFF 
+    // and LISTEN events describe the whole flow, so they are always kept.
+    void Select_Window_Events(Traffic_Event_Batch& batch, double window_begin, double window_end)
     {
-        if (traffic_event.action == "ON")
+        size_t count = 0;
+        
+        for (size_t i = 0; i < batch.count; i++)
         {
-            if (!traffic_event.flow || !traffic_event.srcPort || !traffic_event.dstAddr || !traffic_event.dstPort)
+            double mp_time = Traffic_Period_Time(batch.action[i], batch.time[i], batch.sent[i]);
+            bool traffic = (batch.action[i] == TRAFFIC_ACTION_SEND || batch.action[i] == TRAFFIC_ACTION_RECV);
+            
+            if (traffic && !(mp_time >= window_begin && mp_time < window_end))
             {
-                throw std::runtime_error("Missing field in DRC \"ON\" action!");
+                continue;
             }
             
-            unsigned int flow_uid = *traffic_event.flow;
-            
-            Flow_Info& info = flow_info[flow_uid];
-            info.on_time = traffic_event.time;
+            if (count != i)
+            {
+                batch.action[count] = batch.action[i];
+                batch.fields[count] = batch.fields[i];
+                batch.time[count] = batch.time[i];
+                batch.sent[count] = batch.sent[i];
+                batch.port[count] = batch.port[i];
+                batch.flow[count] = batch.flow[i];
+                batch.seq[count] = batch.seq[i];
+                batch.frag[count] = batch.frag[i];
+                batch.tos[count] = batch.tos[i];
+                batch.dstAddr[count] = batch.dstAddr[i];
+                batch.dstPort[count] = batch.dstPort[i];
+                batch.srcAddr[count] = batch.srcAddr[i];
+                batch.srcPort[count] = batch.srcPort[i];
+                batch.size[count] = batch.size[i];
+                batch.proto[count] = batch.proto[i];
+            }
             
-            Update_Flow_Parameter(flow_uid, "srcPort", info.srcPort, *traffic_event.srcPort);
-            Update_Flow_Parameter(flow_uid, "dstAddr", info.dstAddr, *traffic_event.dstAddr);
-            Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, *traffic_event.dstPort);
+            count++;
         }
-        else if (traffic_event.action == "OFF")
+        
+        batch.count = count;
+    }
+    
+    // Parse all events from a Traffic_Parser or DRC_Cache, or a range of one, optionally appending them to a cache.
+    // An index can only be built from a Traffic_Parser, whose positions are byte offsets.
+    template<class Event_Source>
+    void Parse_Traffic_Events(Event_Source& event_source, const Aggregation_Settings& settings, Flow_Info_Map& flow_info, 
+        std::ostream& warnings, First_Receipt_Map * first_receipts, DRC_Cache_Builder * cache_builder, 
+        DRC_Index_Builder * index_builder, Parse_Counters * counters)
+    {
+        Traffic_Event_Batch batch;
+        Batch_Columns columns;
+        size_t block_begin = event_source.Position();
+        
+        while (Timed_Next_Batch(event_source, batch, counters))
         {
-            if (!traffic_event.flow || !traffic_event.srcPort || !traffic_event.dstAddr || !traffic_event.dstPort)
+            // The cache and index describe every event, including those outside the time window
+            if (index_builder)
             {
-                throw std::runtime_error("Missing field in DRC \"OFF\" action!");
+                size_t block_end = event_source.Position();
+                index_builder->Append(block_begin, block_end, batch);
+                block_begin = block_end;
             }
             
-            unsigned int flow_uid = *traffic_event.flow;
+            if (cache_builder)
+            {
+                Phase_Timer cache_timer(counters, PARSE_PHASE_CACHE);
+                cache_builder->Append(batch);
+            }
             
-            Flow_Info& info = flow_info[flow_uid];
-            info.off_time = traffic_event.time;
+            Phase_Timer aggregate_timer(counters, PARSE_PHASE_AGGREGATE);
             
-            Update_Flow_Parameter(flow_uid, "srcPort", info.srcPort, *traffic_event.srcPort);
-            Update_Flow_Parameter(flow_uid, "dstAddr", info.dstAddr, *traffic_event.dstAddr);
-            Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, *traffic_event.dstPort);
-        }
-        else if (traffic_event.action == "LISTEN")
-        {
-            if (!traffic_event.proto || !traffic_event.port)
+            if (settings.windowed)
             {
-                throw std::runtime_error("Missing field in DRC \"LISTEN\" action!");
+                Select_Window_Events(batch, settings.window_begin, settings.window_end);
             }
             
-            unsigned int flow_uid = *traffic_event.port;
-            
-            Flow_Info& info = flow_info[flow_uid];
-            info.listen_time = traffic_event.time;
+            Process_Traffic_Batch(batch, columns, settings, flow_info, warnings, first_receipts);
+            aggregate_timer.Stop();
             
-            Update_Flow_Parameter(flow_uid, "proto", info.proto, *traffic_event.proto);
-            Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, *traffic_event.port);
+            if (counters)
+            {
+                counters->Count_Batch(batch);
+            }
         }
-        else if (traffic_event.action == "SEND")
+    }
+    
+    // Record the flows and measurement periods updated by a batch which has been processed. Events dropped for 
+    // periods already finalized by a streaming parse did not update anything, so they are skipped.
+    void Record_Batch_Changes(const Traffic_Event_Batch& batch, const Batch_Columns& columns, const Flow_Info_Map& flow_info, 
+        Flow_Changes& changes)
+    {
+        for (size_t i = 0; i < batch.count; i++)
         {
-            if (!traffic_event.flow || !traffic_event.proto || !traffic_event.seq || !traffic_event.frag ||
-                !traffic_event.tos || !traffic_event.srcPort || !traffic_event.dstAddr || !traffic_event.dstPort ||
-                !traffic_event.size)
+            switch (batch.action[i])
             {
-                throw std::runtime_error("Missing field in DRC \"SEND\" action!");
+            case TRAFFIC_ACTION_ON:
+            case TRAFFIC_ACTION_OFF:
+                changes[batch.flow[i]];
+                break;
+            case TRAFFIC_ACTION_LISTEN:
+                changes[batch.port[i]];
+                break;
+            case TRAFFIC_ACTION_SEND:
+            case TRAFFIC_ACTION_RECV:
+            {
+                int mp_num = columns.mp_nums[i];
+                if (mp_num < 0)
+                {
+                    break;
+                }
+                
+                Flow_Info_Map::const_iterator info_it = flow_info.find(batch.flow[i]);
+                if (info_it != flow_info.end() && mp_num <= info_it->second.finalized_mp_num)
+                {
+                    break;
+                }
+                
+                changes[batch.flow[i]].insert(mp_num);
+                break;
+            }
+            default:
+                break;
             }
+        }
+    }
+    
+    // Sequence numbers sent by a flow in the measurement periods which a streaming parse has not finalized
+    struct Stream_Flow_State
+    {
+        Stream_Flow_State() : max_sent_seq(0), any_sent(false) {}
+        
+        std::map<int, uint32_t> min_sent_seqs;  // lowest sequence number sent in each unfinalized measurement period
+        uint32_t max_sent_seq;                  // highest sequence number sent so far
+        bool any_sent;                          // true once any sequence number has been sent
+    };
+    
+    typedef std::map<unsigned int, Stream_Flow_State> Stream_State_Map;
+    
+    // Record the sequence numbers sent by a batch which has been processed
+    void Record_Sent_Sequences(const Traffic_Event_Batch& batch, const Batch_Columns& columns, 
+        const Flow_Info_Map& flow_info, Stream_State_Map& states)
+    {
+        for (size_t i = 0; i < batch.count; i++)
+        {
+            int mp_num = columns.mp_nums[i];
             
-            unsigned int flow_uid = *traffic_event.flow;
+            if (batch.action[i] != TRAFFIC_ACTION_SEND || mp_num < 0)
+            {
+                continue;
+            }
             
-            int mp_num = floor((traffic_event.time - start_timestamp) / MP_DURATION);
-            if (mp_num < 0)
+            Flow_Info_Map::const_iterator info_it = flow_info.find(batch.flow[i]);
+            if (info_it == flow_info.end() || mp_num <= info_it->second.finalized_mp_num)
             {
-                if (*traffic_event.dstPort != MGEN_DUMMY_MESSAGE_PORT) {
-                    std::cerr << "SEND measurement period for flow " << flow_uid
-                        << " with timestamp " << traffic_event.time
-                        << " occurred before start time!" << std::endl;
-                }
+                // Dropped, as its measurement period has already been finalized
                 continue;
             }
             
-            Flow_Info& info = flow_info[flow_uid];
-            Measurement_Period_Stats& stats = info.mp_stats[mp_num];
-            stats.sent++;
+            Stream_Flow_State& state = states[batch.flow[i]];
+            uint32_t seq = batch.seq[i];
+            
+            std::map<int, uint32_t>::iterator seq_it = state.min_sent_seqs.find(mp_num);
+            if (seq_it == state.min_sent_seqs.end())
+            {
+                state.min_sent_seqs[mp_num] = seq;
+            }
+            else if (seq < seq_it->second)
+            {
+                seq_it->second = seq;
+            }
             
-            Update_Flow_Parameter(flow_uid, "proto", info.proto, *traffic_event.proto);
-            Update_Flow_Parameter(flow_uid, "tos", info.tos, *traffic_event.tos);
-            Update_Flow_Parameter(flow_uid, "size", info.size, *traffic_event.size);
-            Update_Flow_Parameter(flow_uid, "srcPort", info.srcPort, *traffic_event.srcPort);
-            Update_Flow_Parameter(flow_uid, "dstAddr", info.dstAddr, *traffic_event.dstAddr);
-            Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, *traffic_event.dstPort);
+            state.max_sent_seq = state.any_sent ? std::max(state.max_sent_seq, seq) : seq;
+            state.any_sent = true;
+        }
+    }
+    
+    // Release the measurement periods of a flow up to the finalized one, and the received sequence numbers 
+    // below those sent in any later period. MGEN sequence numbers increase with sent time, so no later 
+    // receipt can be for a released sequence number. Returns the number of periods with statistics released.
+    size_t Release_Finalized_Periods(Flow_Info& info, Stream_Flow_State& state)
+    {
+        size_t num_released = 0;
+        int finalized_mp_num = info.finalized_mp_num;
+        
+        info.mp_stats.For_Each([&num_released, finalized_mp_num](int mp_num, const Measurement_Period_Stats&)
+        {
+            num_released += (mp_num <= finalized_mp_num) ? 1 : 0;
+        });
+        
+        info.mp_stats.Release_Below(info.finalized_mp_num + 1);
+        info.mp_latency.Release_Below(info.finalized_mp_num + 1);
+        
+        state.min_sent_seqs.erase(state.min_sent_seqs.begin(), state.min_sent_seqs.upper_bound(info.finalized_mp_num));
+        
+        if (!state.any_sent)
+        {
+            return num_released;
+        }
+        
+        uint32_t lowest_unfinalized_seq = state.max_sent_seq + 1;
+        
+        for (std::map<int, uint32_t>::const_iterator it = state.min_sent_seqs.begin(); it != state.min_sent_seqs.end(); it++)
+        {
+            lowest_unfinalized_seq = std::min(lowest_unfinalized_seq, it->second);
         }
-        else if (traffic_event.action == "RECV")
+        
+        info.received_seqs.Evict_Below(lowest_unfinalized_seq);
+        
+        return num_released;
+    }
+    
+    // Merge the statistics from a chunk into the combined statistics of all preceding chunks
+    void Merge_Chunk_Result(Chunk_Result& chunk, const Aggregation_Settings& settings, Flow_Info_Map& flow_info)
+    {
+        for (Flow_Info_Map::iterator it = chunk.flow_info.begin(); it != chunk.flow_info.end(); it++)
         {
-            if (!traffic_event.flow || !traffic_event.proto || !traffic_event.seq || !traffic_event.frag || !traffic_event.tos || 
-                !traffic_event.srcAddr || !traffic_event.srcPort || !traffic_event.dstAddr || !traffic_event.dstPort ||
-                !traffic_event.sent || !traffic_event.size)
+            unsigned int flow_uid = it->first;
+            const Flow_Info& chunk_info = it->second;
+            Flow_Info& info = flow_info[flow_uid];
+            
+            // Later events replace earlier ones, as when parsing sequentially
+            if (chunk_info.on_time)
+            {
+                info.on_time = chunk_info.on_time;
+            }
+            
+            if (chunk_info.off_time)
             {
-                throw std::runtime_error("Missing field in DRC \"RECV\" action!");
+                info.off_time = chunk_info.off_time;
             }
             
-            unsigned int flow_uid = *traffic_event.flow;
+            if (chunk_info.listen_time)
+            {
+                info.listen_time = chunk_info.listen_time;
+            }
             
-            int mp_num = floor((*traffic_event.sent - start_timestamp) / MP_DURATION);
-            if (mp_num < 0)
+            if (chunk_info.proto)
             {
-                if (*traffic_event.dstPort != MGEN_DUMMY_MESSAGE_PORT) {
-                    std::cerr << "RECV measurement period for flow " << flow_uid
-                        << " with sent timestamp " << *traffic_event.sent
-                        << " occurred before start time!" << std::endl;
-                }
-                continue;
+                Update_Flow_Parameter(flow_uid, "proto", info.proto, *chunk_info.proto);
             }
             
-            Flow_Info& info = flow_info[flow_uid];
-            if (!info.max_latency)
+            if (chunk_info.size)
             {
-                throw std::runtime_error("Max latency is missing for flow " + to_string(flow_uid) + "!");
+                Update_Flow_Parameter(flow_uid, "size", info.size, *chunk_info.size);
             }
             
-            double latency = traffic_event.time - *traffic_event.sent;
-            bool duplicate = !info.received_seqs.insert(*traffic_event.seq).second;
-            bool late = (latency > *info.max_latency);
+            if (chunk_info.tos)
+            {
+                Update_Flow_Parameter(flow_uid, "tos", info.tos, *chunk_info.tos);
+            }
             
-            Measurement_Period_Stats& stats = info.mp_stats[mp_num];
+            if (chunk_info.srcAddr)
+            {
+                Update_Flow_Address(flow_uid, "srcAddr", info.srcAddr, *chunk_info.srcAddr);
+            }
             
-            if (duplicate)
+            if (chunk_info.srcPort)
             {
-                stats.duplicate++;
+                Update_Flow_Parameter(flow_uid, "srcPort", info.srcPort, *chunk_info.srcPort);
             }
-            else if (late)
+            
+            if (chunk_info.dstAddr)
             {
-                stats.late++;
+                Update_Flow_Address(flow_uid, "dstAddr", info.dstAddr, *chunk_info.dstAddr);
             }
-            else
+            
+            if (chunk_info.dstPort)
             {
-                stats.received++;
+                Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, *chunk_info.dstPort);
             }
             
-            Update_Flow_Parameter(flow_uid, "proto", info.proto, *traffic_event.proto);
-            Update_Flow_Parameter(flow_uid, "tos", info.tos, *traffic_event.tos);
-            Update_Flow_Parameter(flow_uid, "size", info.size, *traffic_event.size);
-            Update_Flow_Parameter(flow_uid, "srcAddr", info.srcAddr, *traffic_event.srcAddr);
-            Update_Flow_Parameter(flow_uid, "srcPort", info.srcPort, *traffic_event.srcPort);
-            Update_Flow_Parameter(flow_uid, "dstAddr", info.dstAddr, *traffic_event.dstAddr);
-            Update_Flow_Parameter(flow_uid, "dstPort", info.dstPort, *traffic_event.dstPort);
+            chunk_info.mp_stats.For_Each([&info](int mp_num, const Measurement_Period_Stats& chunk_stats)
+            {
+                Measurement_Period_Stats& stats = info.mp_stats[mp_num];
+                stats.sent += chunk_stats.sent;
+                stats.received += chunk_stats.received;
+                stats.duplicate += chunk_stats.duplicate;
+                stats.late += chunk_stats.late;
+            });
+            
+            // A first receipt within this chunk is a duplicate if a preceding chunk received the same sequence number
+            const std::vector<First_Receipt>& receipts = chunk.first_receipts[flow_uid];
+            
+            for (size_t i = 0; i < receipts.size(); i++)
+            {
+                if (!info.received_seqs.Insert(receipts[i].seq))
+                {
+                    Measurement_Period_Stats& stats = info.mp_stats[receipts[i].mp_num];
+                    
+                    if (receipts[i].late)
+                    {
+                        stats.late--;
+                    }
+                    else
+                    {
+                        stats.received--;
+                    }
+                    
+                    stats.duplicate++;
+                }
+                else if (settings.latency_histograms)
+                {
+                    info.latency.Record(receipts[i].latency);
+                    info.mp_latency[receipts[i].mp_num].Record(receipts[i].latency);
+                }
+            }
         }
     }
-}
-
-std::string Scoring_Parser::Get_JSON_Flow_Traffic_Stats(const std::map<unsigned int, Flow_Info>& flow_info)
-{
-    rapidjson::Document flow_stats_doc;
-    flow_stats_doc.SetArray();
-    
-    rapidjson::Document::AllocatorType& allocator = flow_stats_doc.GetAllocator();
     
-    for (std::map<unsigned int, Flow_Info>::const_iterator it = flow_info.begin(); it != flow_info.end(); it++)
+    // Parse all events from a Traffic_Parser or DRC_Cache, split into num_chunks ranges parsed by their own threads
+    template<class Event_Source>
+    void Parse_Event_Source(Event_Source& event_source, size_t num_chunks, const Aggregation_Settings& settings, 
+        Flow_Info_Map& flow_info, std::ostream& warnings, DRC_Cache_Builder * cache_builder, DRC_Index_Builder * index_builder,
+        Parse_Counters * counters)
     {
-        if (!it->second.on_time && !it->second.off_time && !it->second.listen_time && it->second.mp_stats.size() == 0)
+        if (num_chunks <= 1)
         {
-            // No traffic events occurred for the flow
-            continue;
+            Parse_Traffic_Events(event_source, settings, flow_info, warnings, NULL, cache_builder, index_builder, counters);
+            return;
         }
         
-        rapidjson::Value flow_item;
-        flow_item.SetObject();
-        
-        flow_item.AddMember("flow", it->first, allocator);
+        std::vector<Chunk_Result> chunks(num_chunks);
+        std::vector<std::thread> threads;
         
-        if (it->second.max_latency)
+        for (size_t n = 0; n < num_chunks; n++)
         {
-            flow_item.AddMember("maxLatency", *it->second.max_latency, allocator);
-        }
+            Chunk_Result& chunk = chunks[n];
         
-        if (it->second.on_time)
-        {
-            flow_item.AddMember("onTime", *it->second.on_time, allocator);
-        }
+            // Each chunk needs the max latency of its flows to classify late packets
+            for (Flow_Info_Map::const_iterator it = flow_info.begin(); it != flow_info.end(); it++)
+            {
+                if (it->second.max_latency)
+                {
+                    chunk.flow_info[it->first].max_latency = it->second.max_latency;
+                }
+            }
         
-        if (it->second.off_time)
-        {
-            flow_item.AddMember("offTime", *it->second.off_time, allocator);
-        }
+            size_t range_begin = event_source.Size() * n / num_chunks;
+            size_t range_end = event_source.Size() * (n + 1) / num_chunks;
+            DRC_Cache_Builder * chunk_cache_builder = cache_builder ? &chunk.cache_builder : NULL;
+            DRC_Index_Builder * chunk_index_builder = index_builder ? &chunk.index_builder : NULL;
+            Parse_Counters * chunk_counters = counters ? &chunk.counters : NULL;
         
-        if (it->second.listen_time)
-        {
-            flow_item.AddMember("listenTime", *it->second.listen_time, allocator);
+            threads.push_back(std::thread([&event_source, &chunk, range_begin, range_end, &settings, chunk_cache_builder, 
+                chunk_index_builder, chunk_counters]()
+            {
+                try
+                {
+                    Event_Source chunk_source(event_source, range_begin, range_end);
+                    Parse_Traffic_Events(chunk_source, settings, chunk.flow_info, chunk.warnings, &chunk.first_receipts, 
+                        chunk_cache_builder, chunk_index_builder, chunk_counters);
+                    // A line which stops the parse may be the last of the chunk, which then still reaches its end
+                    chunk.stopped = chunk_source.Stopped_At_Line() || !chunk_source.At_End();
+                }
+                catch (...)
+                {
+                    chunk.error = std::current_exception();
+                }
+            }));
         }
         
-        if (it->second.proto)
+        for (size_t n = 0; n < num_chunks; n++)
         {
-            flow_item.AddMember("proto", rapidjson::StringRef(it->second.proto->c_str()), allocator);
+            threads[n].join();
         }
         
-        if (it->second.size)
+        // Merge in file order, so statistics, warnings and errors follow a sequential parse
+        for (size_t n = 0; n < num_chunks; n++)
         {
-            flow_item.AddMember("size", *it->second.size, allocator);
-        }
+            warnings << chunks[n].warnings.str();
         
-        if (it->second.tos)
-        {
-            flow_item.AddMember("tos", *it->second.tos, allocator);
-        }
+            if (chunks[n].error)
+            {
+                std::rethrow_exception(chunks[n].error);
+            }
+        
+            Phase_Timer merge_timer(counters, PARSE_PHASE_AGGREGATE);
+            Merge_Chunk_Result(chunks[n], settings, flow_info);
+            merge_timer.Stop();
+        
+            if (cache_builder)
+            {
+                Phase_Timer cache_timer(counters, PARSE_PHASE_CACHE);
+                cache_builder->Append(chunks[n].cache_builder);
+            }
+            
+            if (index_builder)
+            {
+                index_builder->Append(chunks[n].index_builder);
+            }
+            
+            if (counters)
+            {
+                counters->Add(chunks[n].counters);
+            }
         
-        if (it->second.srcAddr)
+            if (chunks[n].stopped)
+            {
+                break;
+            }
+        }
+    }
+    
+    // Size of a file in bytes, or zero if it cannot be read
+    uint64_t File_Size(const std::string& filename)
+    {
+        struct stat st;
+        return (stat(filename.c_str(), &st) == 0) ? st.st_size : 0;
+    }
+    
+    // Add the statistics of an input file which has been parsed, if stats are being recorded. The bytes read are the
+    // size of the file, unless already set for a file which was only partly read.
+    void Record_Input_File(Parse_Stats * stats, Input_File_Stats& file_stats, const std::string& filename_read, 
+        bool from_cache, double wall_start)
+    {
+        if (stats)
         {
-            flow_item.AddMember("srcAddr", rapidjson::StringRef(it->second.srcAddr->c_str()), allocator);
+            file_stats.from_cache = from_cache;
+            if (file_stats.bytes == 0)
+            {
+                file_stats.bytes = File_Size(filename_read);
+            }
+            file_stats.wall_time = Phase_Timer::Wall_Clock() - wall_start;
+            stats->Add_Input_File(file_stats);
         }
+    }
+    
+    // Set the maximum latency of a flow from its mandates, checking it has not changed if it already exists
+    void Set_Max_Latency(unsigned int flow_uid, double new_value, Max_Latency_Map& max_latency)
+    {
+        Max_Latency_Map::iterator it = max_latency.find(flow_uid);
         
-        if (it->second.srcPort)
+        if (it == max_latency.end())
         {
-            flow_item.AddMember("srcPort", *it->second.srcPort, allocator);
+            max_latency[flow_uid] = new_value;
         }
-        
-        if (it->second.dstAddr)
+        else if (it->second != new_value)
         {
-            flow_item.AddMember("dstAddr", rapidjson::StringRef(it->second.dstAddr->c_str()), allocator);
+            throw std::runtime_error("Error updating parameter \"max_latency\" in flow " + 
+                to_string(flow_uid) + ": changed from \"" + to_string(it->second) + "\" to \"" + to_string(new_value) + "\"!");
         }
-        
-        if (it->second.dstPort)
+    }
+    
+    // Read the maximum latency of each flow from a parsed mandates document
+    void Parse_Mandates(const rapidjson::Document& mandates, Max_Latency_Map& max_latency)
+    {
+        if (!mandates.IsArray())
         {
-            flow_item.AddMember("dstPort", *it->second.dstPort, allocator);
+            throw std::runtime_error("Array expected for JSON flow mandates!");
         }
+
+        for (rapidjson::SizeType i = 0; i < mandates.Size(); i++) 
+        {
+            if (!mandates[i].HasMember("scenario_goals") || !mandates[i]["scenario_goals"].IsArray())
+            {
+                throw std::runtime_error("Mandate does not have \"scenario_goals\" array!");
+            }
+            
+            const rapidjson::Value& scenario_goals = mandates[i]["scenario_goals"];
+
+            for (rapidjson::SizeType j = 0; j < scenario_goals.Size(); j++) 
+            {
+                const rapidjson::Value& goal = scenario_goals[j];
+                    
+                if (!goal.HasMember("requirements") || !goal["requirements"].IsObject())
+                {
+                    throw std::runtime_error("Goal \"requirements\" are missing or incorrect type!");
+                }
+                
+                const rapidjson::Value& requirements = goal["requirements"];
+                
+                if (!goal.HasMember("flow_uid") || !goal["flow_uid"].IsUint())
+                {
+                    throw std::runtime_error("Goal \"flow_uid\" is missing or incorrect type!");
+                }
+                
+                unsigned int flow_uid = goal["flow_uid"].GetUint();
+
+                if (requirements.HasMember("file_transfer_deadline_s") && requirements["file_transfer_deadline_s"].IsDouble())
+                {
+                    Set_Max_Latency(flow_uid, requirements["file_transfer_deadline_s"].GetDouble(), max_latency);
+                }
+                else if (requirements.HasMember("max_latency_s") && requirements["max_latency_s"].IsDouble())
+                {
+                    Set_Max_Latency(flow_uid, requirements["max_latency_s"].GetDouble(), max_latency);
+                }
+                else
+                {
+                    throw std::runtime_error("Expected \"max_latency_s\" or \"file_transfer_deadline_s\" of numerical type!");
+                }
+            }
+        }
+    }
+    
+    // Write a "latency" summary of a latency histogram which is not empty
+    template<class Writer>
+    void Write_JSON_Latency(Writer& writer, const Latency_Histogram& latency)
+    {
+        writer.Key("latency");
+        writer.StartObject();
+        
+        writer.Key("count");
+        writer.Uint64(latency.Count());
+        writer.Key("p50");
+        writer.Double(latency.Percentile(50));
+        writer.Key("p90");
+        writer.Double(latency.Percentile(90));
+        writer.Key("p99");
+        writer.Double(latency.Percentile(99));
+        writer.Key("max");
+        writer.Double(latency.Max());
+        
+        writer.EndObject();
+    }
+    
+    // Write the JSON statistics of one measurement period, with its latency summary if it has one
+    template<class Writer>
+    void Write_JSON_MP_Stats(Writer& writer, int mp_num, const Measurement_Period_Stats& stats, 
+        const Latency_Histogram * latency = NULL)
+    {
+        writer.StartObject();
         
-        const std::map<int, Measurement_Period_Stats>& mp_stats = it->second.mp_stats;
+        writer.Key("time");
+        writer.Int(mp_num);
+        writer.Key("sent");
+        writer.Uint(stats.sent);
+        writer.Key("received");
+        writer.Uint(stats.received);
+        writer.Key("duplicate");
+        writer.Uint(stats.duplicate);
+        writer.Key("late");
+        writer.Uint(stats.late);
+        
+        if (latency)
+        {
+            Write_JSON_Latency(writer, *latency);
+        }
         
-        rapidjson::Value flow_item_mp_stats;
-        flow_item_mp_stats.SetArray();
+        writer.EndObject();
+    }
+    
+    // Write an IPv4 address flow parameter as a dotted string
+    template<class Writer>
+    void Write_JSON_Address(Writer& writer, const char * key, uint32_t addr)
+    {
+        std::string addr_str = Format_IPv4_Address(addr);
         
-        for (std::map<int, Measurement_Period_Stats>::const_iterator mp_it = mp_stats.begin(); mp_it != mp_stats.end(); mp_it++)
+        writer.Key(key);
+        writer.String(addr_str.c_str(), addr_str.size());
+    }
+    
+    // Write the "stats_<multiple>" array of a flow, rolled up from all of its measurement periods or only 
+    // the rollup periods holding those in mp_filter
+    template<class Writer>
+    void Write_JSON_Rollup_Stats(Writer& writer, const Flow_Info& info, const std::set<int> * mp_filter, unsigned int multiple)
+    {
+        writer.Key(("stats_" + to_string(multiple)).c_str());
+        writer.StartArray();
+        
+        if (mp_filter)
         {
-            rapidjson::Value stats_item;
-            stats_item.SetObject();
+            std::set<int> rollup_filter;
+            for (std::set<int>::const_iterator mp_it = mp_filter->begin(); mp_it != mp_filter->end(); mp_it++)
+            {
+                rollup_filter.insert(Rollup_MP_Num(*mp_it, multiple));
+            }
             
-            stats_item.AddMember("time", mp_it->first, allocator);
-            stats_item.AddMember("sent", mp_it->second.sent, allocator);
-            stats_item.AddMember("received", mp_it->second.received, allocator);
-            stats_item.AddMember("duplicate", mp_it->second.duplicate, allocator);
-            stats_item.AddMember("late", mp_it->second.late, allocator);
+            for (std::set<int>::const_iterator rollup_it = rollup_filter.begin(); rollup_it != rollup_filter.end(); rollup_it++)
+            {
+                Measurement_Period_Stats rollup_stats;
+                int first_mp_num = *rollup_it * (int)multiple;
+                
+                for (unsigned int i = 0; i < multiple; i++)
+                {
+                    const Measurement_Period_Stats * stats = info.mp_stats.Find(first_mp_num + i);
+                    if (stats)
+                    {
+                        rollup_stats.Add(*stats);
+                    }
+                }
+                
+                if (!rollup_stats.Empty())
+                {
+                    Write_JSON_MP_Stats(writer, *rollup_it, rollup_stats);
+                }
+            }
+        }
+        else
+        {
+            info.mp_stats.For_Each_Rollup(multiple, [&writer](int rollup_num, const Measurement_Period_Stats& stats)
+            {
+                Write_JSON_MP_Stats(writer, rollup_num, stats);
+            });
+        }
+        
+        writer.EndArray();
+    }
+    
+    // Write the JSON statistics of a flow, with all of its measurement periods or only those in mp_filter
+    template<class Writer>
+    void Write_JSON_Flow_Item(Writer& writer, unsigned int flow_uid, const Flow_Info& info, const std::set<int> * mp_filter, 
+        const std::vector<unsigned int>& mp_rollups)
+    {
+        writer.StartObject();
+        
+        writer.Key("flow");
+        writer.Uint(flow_uid);
+        
+        if (info.max_latency)
+        {
+            writer.Key("maxLatency");
+            writer.Double(*info.max_latency);
+        }
+        
+        if (info.on_time)
+        {
+            writer.Key("onTime");
+            writer.Double(*info.on_time);
+        }
+        
+        if (info.off_time)
+        {
+            writer.Key("offTime");
+            writer.Double(*info.off_time);
+        }
+        
+        if (info.listen_time)
+        {
+            writer.Key("listenTime");
+            writer.Double(*info.listen_time);
+        }
+        
+        if (info.proto)
+        {
+            writer.Key("proto");
+            writer.String(info.proto->c_str(), info.proto->size());
+        }
+        
+        if (info.size)
+        {
+            writer.Key("size");
+            writer.Uint(*info.size);
+        }
+        
+        if (info.tos)
+        {
+            writer.Key("tos");
+            writer.Uint(*info.tos);
+        }
+        
+        if (info.srcAddr)
+        {
+            Write_JSON_Address(writer, "srcAddr", *info.srcAddr);
+        }
+        
+        if (info.srcPort)
+        {
+            writer.Key("srcPort");
+            writer.Uint(*info.srcPort);
+        }
+        
+        if (info.dstAddr)
+        {
+            Write_JSON_Address(writer, "dstAddr", *info.dstAddr);
+        }
+        
+        if (info.dstPort)
+        {
+            writer.Key("dstPort");
+            writer.Uint(*info.dstPort);
+        }
+        
+        writer.Key("stats");
+        writer.StartArray();
+        
+        if (mp_filter)
+        {
+            for (std::set<int>::const_iterator mp_it = mp_filter->begin(); mp_it != mp_filter->end(); mp_it++)
+            {
+                const Measurement_Period_Stats * stats = info.mp_stats.Find(*mp_it);
+                if (stats)
+                {
+                    Write_JSON_MP_Stats(writer, *mp_it, *stats, info.mp_latency.Find(*mp_it));
+                }
+            }
+        }
+        else
+        {
+            info.mp_stats.For_Each([&writer, &info](int mp_num, const Measurement_Period_Stats& stats)
+            {
+                Write_JSON_MP_Stats(writer, mp_num, stats, info.mp_latency.Find(mp_num));
+            });
+        }
+        
+        writer.EndArray();
+        
+        for (size_t n = 0; n < mp_rollups.size(); n++)
+        {
+            Write_JSON_Rollup_Stats(writer, info, mp_filter, mp_rollups[n]);
+        }
+        
+        if (!info.latency.Empty())
+        {
+            Write_JSON_Latency(writer, info.latency);
+        }
+        
+        writer.EndObject();
+    }
+    
+    // Write a JSON array of the statistics of each flow with traffic events
+    template<class Writer>
+    void Write_JSON_Flow_Array(Writer& writer, const Flow_Info_Map& flow_info, const std::vector<unsigned int>& mp_rollups)
+    {
+        writer.StartArray();
+        
+        for (Flow_Info_Map::const_iterator it = flow_info.begin(); it != flow_info.end(); it++)
+        {
+            if (!it->second.on_time && !it->second.off_time && !it->second.listen_time && it->second.mp_stats.Empty())
+            {
+                // No traffic events occurred for the flow
+                continue;
+            }
             
-            flow_item_mp_stats.PushBack(stats_item, allocator);
+            Write_JSON_Flow_Item(writer, it->first, it->second, NULL, mp_rollups);
         }
         
-        flow_item.AddMember("stats", flow_item_mp_stats, allocator);
+        writer.EndArray();
+    }
+    
+    // Write a JSON object of the flow arrays of each DRC file pair, keyed by send filename
+    template<class Writer>
+    void Write_JSON_Match_Object(Writer& writer, const Match_Flow_Info_Map& match_flow_info, 
+        const std::vector<unsigned int>& mp_rollups)
+    {
+        writer.StartObject();
+        
+        for (Match_Flow_Info_Map::const_iterator it = match_flow_info.begin(); it != match_flow_info.end(); it++)
+        {
+            writer.Key(it->first.c_str(), it->first.size());
+            Write_JSON_Flow_Array(writer, it->second, mp_rollups);
+        }
         
-        flow_stats_doc.PushBack(flow_item, allocator);
+        writer.EndObject();
+    }
+    
+    // Write JSON to a file through a fixed size buffer, without holding the whole output in memory
+    template<class Write_Function>
+    void Write_JSON_File(FILE * output, Write_Function write_json)
+    {
+        std::vector<char> buffer(JSON_OUTPUT_BUFFER_SIZE);
+        rapidjson::FileWriteStream stream(output, &buffer[0], buffer.size());
+        
+        rapidjson::Writer<rapidjson::FileWriteStream> writer(stream);
+        write_json(writer);
+        
+        stream.Flush();
+        
+        if (ferror(output))
+        {
+            throw std::runtime_error("Error writing JSON output!");
+        }
+    }
+}
+
+Scoring_Parser::Scoring_Parser() :
+    m_num_threads(1),
+    m_use_cache(false),
+    m_use_index(false),
+    m_windowed(false),
+    m_window_from(0),
+    m_window_to(0),
+    m_mp_duration(DEFAULT_MP_DURATION),
+    m_latency_histograms(false),
+    m_warnings(&std::cerr),
+    m_stats(NULL)
+{
+}
+
+Scoring_Parser::~Scoring_Parser()
+{
+}
+
+void Scoring_Parser::Set_Num_Threads(unsigned int num_threads)
+{
+    m_num_threads = (num_threads > 0) ? num_threads : 1;
+}
+
+void Scoring_Parser::Set_Use_Cache(bool use_cache)
+{
+    m_use_cache = use_cache;
+}
+
+void Scoring_Parser::Set_Use_Index(bool use_index)
+{
+    m_use_index = use_index;
+}
+
+void Scoring_Parser::Set_Time_Window(double from, double to)
+{
+    if (!(to > from))
+    {
+        throw std::runtime_error("Time window must end after it begins!");
     }
     
+    m_windowed = true;
+    m_window_from = from;
+    m_window_to = to;
+}
+
+void Scoring_Parser::Set_MP_Duration(double mp_duration)
+{
+    if (!(mp_duration > 0))
+    {
+        throw std::runtime_error("Measurement period duration must be positive!");
+    }
+    
+    m_mp_duration = mp_duration;
+}
+
+void Scoring_Parser::Set_MP_Rollups(const std::vector<unsigned int>& mp_rollups)
+{
+    for (size_t i = 0; i < mp_rollups.size(); i++)
+    {
+        if (mp_rollups[i] == 0)
+        {
+            throw std::runtime_error("Measurement period rollups must be positive multiples!");
+        }
+    }
+    
+    m_mp_rollups = mp_rollups;
+}
+
+void Scoring_Parser::Set_Latency_Histograms(bool latency_histograms)
+{
+    m_latency_histograms = latency_histograms;
+}
+
+void Scoring_Parser::Set_Warning_Stream(std::ostream& warnings)
+{
+    m_warnings = &warnings;
+}
+
+void Scoring_Parser::Set_Stats(Parse_Stats& stats)
+{
+    m_stats = &stats;
+}
+
+Parse_Counters * Scoring_Parser::Stats_Counters()
+{
+    return m_stats ? &m_stats->Counters() : NULL;
+}
+
+void Scoring_Parser::Parse_Max_Latency_Per_Flow(const char * json_flow_mandates, Flow_Info_Map& flow_info)
+{
+    Phase_Timer timer(Stats_Counters(), PARSE_PHASE_MANDATES);
+    
+    // The in-situ parser needs a writable copy of the mandates
+    std::vector<char> json_buffer(json_flow_mandates, json_flow_mandates + strlen(json_flow_mandates) + 1);
+    
+    Max_Latency_Map max_latency;
+    Parse_Max_Latency_Map(&json_buffer[0], max_latency);
+    Apply_Max_Latency_Map(max_latency, flow_info);
+}
+
+void Scoring_Parser::Parse_Max_Latency_Map(char * json_flow_mandates, Max_Latency_Map& max_latency)
+{
+    rapidjson::Document mandates;
+    mandates.ParseInsitu(json_flow_mandates);
+
+    Parse_Mandates(mandates, max_latency);
+}
+
+void Scoring_Parser::Parse_Max_Latency_File(const char * mandates_file, Max_Latency_Map& max_latency)
+{
+    Phase_Timer timer(Stats_Counters(), PARSE_PHASE_MANDATES);
+    
+    std::ifstream file(mandates_file, std::ios::in | std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Cannot open mandates file " + std::string(mandates_file) + "!");
+    }
+    
+    std::vector<char> json_buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    
+    if (file.bad())
+    {
+        throw std::runtime_error("Cannot read mandates file " + std::string(mandates_file) + "!");
+    }
+    
+    json_buffer.push_back('\0');
+    
+    Parse_Max_Latency_Map(&json_buffer[0], max_latency);
+}
+
+void Scoring_Parser::Apply_Max_Latency_Map(const Max_Latency_Map& max_latency, Flow_Info_Map& flow_info)
+{
+    for (Max_Latency_Map::const_iterator it = max_latency.begin(); it != max_latency.end(); it++)
+    {
+        Update_Flow_Parameter(it->first, "max_latency", flow_info[it->first].max_latency, it->second);
+    }
+}
+
+void Scoring_Parser::Parse_Flow_Traffic_Stats(const char * drc_file, double start_timestamp, Flow_Info_Map& flow_info)
+{
+    Aggregation_Settings settings = { start_timestamp, m_mp_duration, m_latency_histograms, 
+        m_windowed, start_timestamp + m_window_from, start_timestamp + m_window_to };
+    
+    Input_File_Stats file_stats;
+    file_stats.filename = drc_file;
+    Parse_Counters * counters = m_stats ? &file_stats.counters : NULL;
+    double wall_start = Phase_Timer::Wall_Clock();
+    
+    std::string cache_file = std::string(drc_file) + DRC_CACHE_SUFFIX;
+    
+    if (m_use_cache)
+    {
+        Phase_Timer open_timer(counters, PARSE_PHASE_OPEN);
+        DRC_Cache cache(cache_file.c_str(), drc_file);
+        open_timer.Stop();
+        
+        if (cache.Is_Valid())
+        {
+            size_t num_chunks = std::min<size_t>(m_num_threads, cache.Size() / MIN_CHUNK_EVENTS);
+            Parse_Event_Source(cache, num_chunks, settings, flow_info, *m_warnings, NULL, NULL, counters);
+            Record_Input_File(m_stats, file_stats, cache_file, true, wall_start);
+            return;
+        }
+    }
+    
+    std::string index_file = std::string(drc_file) + DRC_INDEX_SUFFIX;
+    
+    if (m_use_index && m_windowed)
+    {
+        Phase_Timer open_timer(counters, PARSE_PHASE_OPEN);
+        DRC_Index index(index_file.c_str(), drc_file);
+        open_timer.Stop();
+        
+        if (index.Is_Valid())
+        {
+            Phase_Timer parser_open_timer(counters, PARSE_PHASE_OPEN);
+            Traffic_Parser traffic_parser(drc_file);
+            parser_open_timer.Stop();
+            
+            // Only the blocks which may hold events within the window, or flow events, are read in file order
+            std::vector<DRC_Index_Range> ranges = index.Find_Ranges(settings.window_begin, settings.window_end);
+            
+            for (size_t i = 0; i < ranges.size(); i++)
+            {
+                Traffic_Parser range_parser(traffic_parser, ranges[i].begin, ranges[i].end);
+                Parse_Traffic_Events(range_parser, settings, flow_info, *m_warnings, NULL, NULL, NULL, counters);
+                file_stats.bytes += ranges[i].end - ranges[i].begin;
+            }
+            
+            Record_Input_File(m_stats, file_stats, drc_file, false, wall_start);
+            return;
+        }
+    }
+    
+    // The source is identified before it is opened, so a cache never describes a newer file than was parsed
+    DRC_Cache_Builder cache_builder;
+    bool build_cache = m_use_cache && cache_builder.Set_Source(drc_file);
+    
+    DRC_Index_Builder index_builder;
+    bool build_index = m_use_index && index_builder.Set_Source(drc_file);
+    
+    Phase_Timer open_timer(counters, PARSE_PHASE_OPEN);
+    Traffic_Parser traffic_parser(drc_file);
+    open_timer.Stop();
+    
+    // Compressed files are read as a stream, so they cannot be indexed
+    build_index = build_index && !traffic_parser.Is_Compressed();
+    
+    size_t num_chunks = std::min<size_t>(m_num_threads, traffic_parser.Size() / MIN_CHUNK_SIZE);
+    Parse_Event_Source(traffic_parser, num_chunks, settings, flow_info, *m_warnings, 
+        build_cache ? &cache_builder : NULL, build_index ? &index_builder : NULL, counters);
+    Report_Decompression_Warning(traffic_parser, drc_file, *m_warnings);
+    
+    if (build_cache)
+    {
+        Phase_Timer cache_timer(counters, PARSE_PHASE_CACHE);
+        
+        if (!cache_builder.Write(cache_file.c_str(), drc_file))
+        {
+            *m_warnings << "Unable to write DRC cache file " << cache_file << "!" << std::endl;
+        }
+    }
+    
+    if (build_index && !index_builder.Write(index_file.c_str(), drc_file))
+    {
+        *m_warnings << "Unable to write DRC index file " << index_file << "!" << std::endl;
+    }
+    
+    Record_Input_File(m_stats, file_stats, drc_file, false, wall_start);
+}
+
+void Scoring_Parser::Parse_New_Traffic_Stats(Traffic_Follower& follower, double start_timestamp, Flow_Info_Map& flow_info, 
+    Flow_Changes& changes)
+{
+    Aggregation_Settings settings = { start_timestamp, m_mp_duration, m_latency_histograms, 
+        false, -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
+    
+    follower.Poll();
+    
+    Traffic_Event_Batch batch;
+    Batch_Columns columns;
+    
+    while (follower.Next_Batch(batch))
+    {
+        Process_Traffic_Batch(batch, columns, settings, flow_info, *m_warnings, NULL);
+        Record_Batch_Changes(batch, columns, flow_info, changes);
+    }
+}
+
+std::string Scoring_Parser::Get_JSON_Flow_Traffic_Stats(const Flow_Info_Map& flow_info)
+{
     rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    
+    Write_JSON_Flow_Array(writer, flow_info, m_mp_rollups);
+    
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
 
-    buffer.Clear();
+void Scoring_Parser::Write_JSON_Flow_Traffic_Stats(const Flow_Info_Map& flow_info, FILE * output)
+{
+    Write_JSON_File(output, [this, &flow_info](rapidjson::Writer<rapidjson::FileWriteStream>& writer)
+    {
+        Write_JSON_Flow_Array(writer, flow_info, m_mp_rollups);
+    });
+}
 
+std::string Scoring_Parser::Get_JSON_Match_Traffic_Stats(const Match_Flow_Info_Map& match_flow_info)
+{
+    rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    flow_stats_doc.Accept(writer);
+    
+    Write_JSON_Match_Object(writer, match_flow_info, m_mp_rollups);
+    
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+void Scoring_Parser::Write_JSON_Match_Traffic_Stats(const Match_Flow_Info_Map& match_flow_info, FILE * output)
+{
+    Write_JSON_File(output, [this, &match_flow_info](rapidjson::Writer<rapidjson::FileWriteStream>& writer)
+    {
+        Write_JSON_Match_Object(writer, match_flow_info, m_mp_rollups);
+    });
+}
+
+void Scoring_Parser::Stream_Flow_Traffic_Stats(const std::vector<std::string>& drc_files, double start_timestamp, 
+    double finalize_margin, Flow_Info_Map& flow_info, FILE * output)
+{
+    Aggregation_Settings settings = { start_timestamp, m_mp_duration, m_latency_histograms, 
+        false, -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
+    
+    std::vector<std::unique_ptr<Traffic_Parser> > parsers;
+    std::vector<Traffic_Event_Batch> batches(drc_files.size());
+    std::vector<bool> has_batch(drc_files.size());
+    std::vector<double> positions(drc_files.size(), -std::numeric_limits<double>::infinity());
+    
+    // The files are parsed together, so each is recorded with the wall time of the whole stream
+    std::vector<Input_File_Stats> file_stats(drc_files.size());
+    std::vector<Parse_Counters *> counters(drc_files.size());
+    double wall_start = Phase_Timer::Wall_Clock();
+    
+    for (size_t n = 0; n < drc_files.size(); n++)
+    {
+        file_stats[n].filename = drc_files[n];
+        counters[n] = m_stats ? &file_stats[n].counters : NULL;
+        
+        Phase_Timer open_timer(counters[n], PARSE_PHASE_OPEN);
+        parsers.emplace_back(new Traffic_Parser(drc_files[n].c_str()));
+        open_timer.Stop();
+        
+        has_batch[n] = Timed_Next_Batch(*parsers[n], batches[n], counters[n]);
+    }
+    
+    Batch_Columns columns;
+    Flow_Changes pending;       // updated measurement periods which have not been finalized
+    Stream_State_Map states;
+    uint64_t released_mps = 0;  // measurement periods with statistics which were written and released
+    
+    while (true)
+    {
+        // Merge the files in time order, a batch at a time, taking the batch which starts earliest
+        size_t next = drc_files.size();
+        
+        for (size_t n = 0; n < drc_files.size(); n++)
+        {
+            if (has_batch[n] && (next == drc_files.size() || batches[n].time[0] < batches[next].time[0]))
+            {
+                next = n;
+            }
+        }
+        
+        bool at_end = (next == drc_files.size());
+        
+        if (!at_end)
+        {
+            Traffic_Event_Batch& batch = batches[next];
+            
+            Phase_Timer aggregate_timer(counters[next], PARSE_PHASE_AGGREGATE);
+            Process_Traffic_Batch(batch, columns, settings, flow_info, *m_warnings, NULL);
+            Record_Batch_Changes(batch, columns, flow_info, pending);
+            Record_Sent_Sequences(batch, columns, flow_info, states);
+            aggregate_timer.Stop();
+            
+            if (counters[next])
+            {
+                counters[next]->Count_Batch(batch);
+            }
+            
+            positions[next] = std::max(positions[next], batch.time[batch.count - 1]);
+            has_batch[next] = Timed_Next_Batch(*parsers[next], batch, counters[next]);
+        }
+        
+        // Every file has been read up to the earliest position among those not yet finished
+        double position = std::numeric_limits<double>::infinity();
+        
+        for (size_t n = 0; n < drc_files.size(); n++)
+        {
+            if (has_batch[n])
+            {
+                position = std::min(position, positions[n]);
+            }
+        }
+        
+        if (position == -std::numeric_limits<double>::infinity())
+        {
+            continue;
+        }
+        
+        Flow_Changes finalized;
+        
+        for (Flow_Changes::iterator it = pending.begin(); it != pending.end(); )
+        {
+            Flow_Info& info = flow_info[it->first];
+            std::set<int>& mp_nums = it->second;
+            
+            int horizon_mp_num = INT_MAX;
+            
+            if (!at_end)
+            {
+                double horizon = floor((position - start_timestamp - info.max_latency.get_value_or(0) - finalize_margin) / m_mp_duration) - 1;
+                horizon_mp_num = (horizon < INT_MAX) ? (int)std::max<double>(horizon, INT_MIN) : INT_MAX - 1;
+            }
+            
+            std::set<int>::iterator mp_end = mp_nums.upper_bound(horizon_mp_num);
+            
+            // Flow parameter changes are emitted along with any finalized periods, or alone if there are none pending
+            if (mp_nums.empty() || mp_end != mp_nums.begin())
+            {
+                finalized[it->first].insert(mp_nums.begin(), mp_end);
+                mp_nums.erase(mp_nums.begin(), mp_end);
+            }
+            
+            info.finalized_mp_num = std::max(info.finalized_mp_num, horizon_mp_num);
+            
+            if (mp_nums.empty())
+            {
+                pending.erase(it++);
+            }
+            else
+            {
+                it++;
+            }
+        }
+        
+        if (!finalized.empty())
+        {
+            Phase_Timer output_timer(Stats_Counters(), PARSE_PHASE_OUTPUT);
+            std::string json_output = Get_JSON_Flow_Traffic_Changes(flow_info, finalized);
+            
+            if (fprintf(output, "%s\n", json_output.c_str()) < 0 || fflush(output) != 0)
+            {
+                throw std::runtime_error("Error writing JSON output!");
+            }
+        }
+        
+        if (at_end)
+        {
+            break;
+        }
+        
+        Phase_Timer release_timer(Stats_Counters(), PARSE_PHASE_AGGREGATE);
+        
+        for (Flow_Changes::const_iterator it = finalized.begin(); it != finalized.end(); it++)
+        {
+            released_mps += Release_Finalized_Periods(flow_info[it->first], states[it->first]);
+        }
+    }
+    
+    for (size_t n = 0; n < drc_files.size(); n++)
+    {
+        Report_Decompression_Warning(*parsers[n], drc_files[n].c_str(), *m_warnings);
+        Record_Input_File(m_stats, file_stats[n], drc_files[n], false, wall_start);
+    }
+    
+    if (m_stats)
+    {
+        m_stats->Count_Released_Periods(released_mps);
+    }
+    
+    for (Flow_Info_Map::const_iterator it = flow_info.begin(); it != flow_info.end(); it++)
+    {
+        if (it->second.num_dropped > 0)
+        {
+            *m_warnings << "Dropped " << it->second.num_dropped << " events of flow " << it->first 
+                << " for measurement periods which were already finalized!" << std::endl;
+        }
+    }
+}
 
-    return std::string( buffer.GetString() );
-}
\ No newline at end of file
+std::string Scoring_Parser::Get_JSON_Flow_Traffic_Changes(const Flow_Info_Map& flow_info, const Flow_Changes& changes)
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    
+    writer.StartArray();
+    
+    for (Flow_Changes::const_iterator it = changes.begin(); it != changes.end(); it++)
+    {
+        Flow_Info_Map::const_iterator info_it = flow_info.find(it->first);
+        if (info_it == flow_info.end())
+        {
+            continue;
+        }
+        
+        Write_JSON_Flow_Item(writer, it->first, info_it->second, &it->second, m_mp_rollups);
+    }
+    
+    writer.EndArray();
+    
+    return std::string(buffer.GetString(), buffer.GetSize());
+}
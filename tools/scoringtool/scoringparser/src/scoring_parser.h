@@ -17,10 +17,21 @@
 
 #pragma once
 
+#include <algorithm>
 #include <map>
+#include <ostream>
 #include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <limits.h>
+#include <stdio.h>
 #include <boost/optional.hpp>
 
+#include "flat_map.h"
+#include "latency_histogram.h"
+#include "sequence_tracker.h"
+
 struct Measurement_Period_Stats
 {
     Measurement_Period_Stats() :
@@ -34,10 +45,206 @@ struct Measurement_Period_Stats
     unsigned int received;   // number of received messages in the measurement period, excluding duplicate/late
     unsigned int duplicate;  // number of duplicate messages in the measurement period
     unsigned int late;       // number of late messages in the measurement period, excluding duplicate
+    
+    // True if no messages have been counted, as for a measurement period with no events
+    bool Empty() const { return (sent | received | duplicate | late) == 0; }
+    
+    // Add the counts of another measurement period, as when rolling periods up into a longer one
+    void Add(const Measurement_Period_Stats& other)
+    {
+        sent += other.sent;
+        received += other.received;
+        duplicate += other.duplicate;
+        late += other.late;
+    }
+};
+
+// Default duration of a measurement period, in seconds
+#define DEFAULT_MP_DURATION 1.0
+
+// Number of the period of multiple times the measurement period duration which holds a measurement period
+inline int Rollup_MP_Num(int mp_num, unsigned int multiple)
+{
+    int divisor = (int)multiple;
+    return (mp_num >= 0) ? (mp_num / divisor) : -((-(mp_num + 1)) / divisor) - 1;
+}
+
+// Measurement periods from zero up to this are stored contiguously
+#define MAX_DENSE_MP_NUM (64 * 1024)
+
+/*
+ * Values per measurement period of a flow, such as Measurement_Period_Stats,
+ * which provide Empty() and Add(). Measurement periods are small integers
+ * counting up from the start time, so they index a vector directly.
+ * Periods outside [0, MAX_DENSE_MP_NUM), which only arise from timestamps
+ * far from the start time, are kept in a map instead so they cannot cause
+ * a huge allocation. Periods with empty values are treated as absent.
+ * Periods which are no longer needed can be released from the start, 
+ * after which the vector begins at a later period.
+ */
+template<class T>
+class Measurement_Period_Array
+{
+public:
+    Measurement_Period_Array() :
+        m_dense_base(0)
+    {
+    }
+
+    T& operator[](int mp_num)
+    {
+        if (mp_num < m_dense_base || mp_num >= MAX_DENSE_MP_NUM)
+        {
+            return m_sparse[mp_num];
+        }
+        
+        size_t index = mp_num - m_dense_base;
+        if (index >= m_dense.size())
+        {
+            m_dense.resize(index + 1);
+        }
+        
+        return m_dense[index];
+    }
+
+    // Return the value of a measurement period, or NULL if it is empty
+    const T * Find(int mp_num) const
+    {
+        if (mp_num >= m_dense_base && (size_t)(mp_num - m_dense_base) < m_dense.size())
+        {
+            const T& value = m_dense[mp_num - m_dense_base];
+            return value.Empty() ? NULL : &value;
+        }
+        
+        typename std::map<int, T>::const_iterator it = m_sparse.find(mp_num);
+        return (it != m_sparse.end() && !it->second.Empty()) ? &it->second : NULL;
+    }
+
+    // True if no measurement period has been updated
+    bool Empty() const { return m_dense.empty() && m_sparse.empty(); }
+    
+    // Release the values of all measurement periods before mp_num, which are then empty
+    void Release_Below(int mp_num)
+    {
+        m_sparse.erase(m_sparse.begin(), m_sparse.lower_bound(mp_num));
+        
+        if (mp_num <= m_dense_base)
+        {
+            return;
+        }
+        
+        size_t num_released = std::min<size_t>(mp_num - m_dense_base, m_dense.size());
+        m_dense.erase(m_dense.begin(), m_dense.begin() + num_released);
+        m_dense_base = std::min(mp_num, MAX_DENSE_MP_NUM);
+    }
+
+    // Call visit(mp_num, value) for each measurement period which is not empty, in order
+    template<class Visitor>
+    void For_Each(Visitor visit) const
+    {
+        typename std::map<int, T>::const_iterator it = m_sparse.begin();
+        
+        for (; it != m_sparse.end() && it->first < m_dense_base; it++)
+        {
+            if (!it->second.Empty())
+            {
+                visit(it->first, it->second);
+            }
+        }
+        
+        for (size_t index = 0; index < m_dense.size(); index++)
+        {
+            if (!m_dense[index].Empty())
+            {
+                visit(m_dense_base + (int)index, m_dense[index]);
+            }
+        }
+        
+        for (; it != m_sparse.end(); it++)
+        {
+            if (!it->second.Empty())
+            {
+                visit(it->first, it->second);
+            }
+        }
+    }
+
+    // Call visit(rollup_num, value) for each period of multiple times the measurement period duration which 
+    // is not empty, in order, with the sum of the values of the measurement periods it covers
+    template<class Visitor>
+    void For_Each_Rollup(unsigned int multiple, Visitor visit) const
+    {
+        bool pending = false;
+        int rollup_num = 0;
+        T rollup_value;
+        
+        For_Each([multiple, &visit, &pending, &rollup_num, &rollup_value](int mp_num, const T& value)
+        {
+            int num = Rollup_MP_Num(mp_num, multiple);
+            
+            if (pending && num != rollup_num)
+            {
+                visit(rollup_num, rollup_value);
+                rollup_value = T();
+            }
+            
+            pending = true;
+            rollup_num = num;
+            rollup_value.Add(value);
+        });
+        
+        if (pending)
+        {
+            visit(rollup_num, rollup_value);
+        }
+    }
+
+protected:
+    int m_dense_base;                   // first period held in m_dense
+    std::vector<T> m_dense;             // values of periods [m_dense_base, m_dense_base + m_dense.size())
+    std::map<int, T> m_sparse;          // values of periods outside [m_dense_base, MAX_DENSE_MP_NUM)
+};
+
+// Statistics per measurement period of a flow
+typedef Measurement_Period_Array<Measurement_Period_Stats> Measurement_Period_Table;
+
+/*
+ * Parameters of the last SEND or RECV event which was fully checked against
+ * its flow's parameters. Flow parameters never change once set, so a later
+ * event with an identical signature would pass the same checks, and they
+ * are skipped.
+ */
+struct Flow_Signature
+{
+    Flow_Signature() :
+        bound(false)
+    {
+    }
+    
+    bool operator==(const Flow_Signature& other) const
+    {
+        return bound == other.bound && proto == other.proto && tos == other.tos && size == other.size &&
+            srcAddr == other.srcAddr && srcPort == other.srcPort && dstAddr == other.dstAddr && dstPort == other.dstPort;
+    }
+    
+    bool bound;         // true for the signature of a checked event, false before any event has been checked
+    uint64_t proto;     // proto field packed into an integer, zero padded
+    uint32_t tos;
+    uint32_t size;
+    uint32_t srcAddr;   // zero for SEND events, whose source address is not checked
+    uint32_t srcPort;
+    uint32_t dstAddr;
+    uint32_t dstPort;
 };
 
 struct Flow_Info
 {
+    Flow_Info() :
+        finalized_mp_num(INT_MIN),
+        num_dropped(0)
+    {
+    }
+
     boost::optional<double> max_latency;   // maximum latency for packets (max_latency_s or file_transfer_deadline_s)
     
     boost::optional<double> on_time;       // "ON" time for the flow
@@ -47,23 +254,131 @@ struct Flow_Info
     boost::optional<std::string> proto;    // proto field (UDP/TCP)
     boost::optional<unsigned int> size;    // size field (bytes)
     boost::optional<unsigned int> tos;     // tos field
-    boost::optional<std::string> srcAddr;  // source address field
+    boost::optional<uint32_t> srcAddr;     // source IPv4 address field
     boost::optional<unsigned int> srcPort; // source port field
-    boost::optional<std::string> dstAddr;  // dest address field
+    boost::optional<uint32_t> dstAddr;     // dest IPv4 address field
     boost::optional<unsigned int> dstPort; // dest port field
 
-    std::map<int, Measurement_Period_Stats> mp_stats; // statistics per measurement period
+    Measurement_Period_Table mp_stats;     // statistics per measurement period
+    
+    Latency_Histogram latency;             // latencies of received and late packets, if histograms are enabled
+    Measurement_Period_Array<Latency_Histogram> mp_latency; // latencies per measurement period by sent time
 
-    std::set<unsigned int> received_seqs;   // sequence numbers already received
+    Sequence_Tracker received_seqs;        // sequence numbers already received
+    
+    Flow_Signature send_signature;         // parameters of the last SEND event checked against the flow
+    Flow_Signature recv_signature;         // parameters of the last RECV event checked against the flow
+    
+    int finalized_mp_num;                  // last measurement period emitted by a streaming parse, if any
+    unsigned int num_dropped;              // SEND/RECV events dropped for measurement periods already emitted
 };
 
+// Flows keyed by flow UID
+typedef Flat_Map<unsigned int, Flow_Info> Flow_Info_Map;
+
+// Maximum latency of each flow from its mandates, keyed by flow UID
+typedef Flat_Map<unsigned int, double> Max_Latency_Map;
+
+// Measurement periods updated per flow since the last emission. A flow may be present with no
+// measurement periods if only its flow parameters changed.
+typedef std::map<unsigned int, std::set<int> > Flow_Changes;
+
+// Flows of each send/listen DRC file pair in a match, keyed by send filename
+typedef std::map<std::string, Flow_Info_Map> Match_Flow_Info_Map;
+
+class Traffic_Follower;
+class Parse_Stats;
+struct Parse_Counters;
+
 class Scoring_Parser 
 {
 public:
     Scoring_Parser();
     virtual ~Scoring_Parser();
     
-    void Parse_Max_Latency_Per_Flow(const char * json_flow_mandates, std::map<unsigned int, Flow_Info>& flow_info);
-    void Parse_Flow_Traffic_Stats(const char * drc_file, double start_timestamp, std::map<unsigned int, Flow_Info>& flow_info);
-    std::string Get_JSON_Flow_Traffic_Stats(const std::map<unsigned int, Flow_Info>& flow_info);
+    // Set the number of threads used to parse each DRC file (default 1)
+    void Set_Num_Threads(unsigned int num_threads);
+    
+    // Read events from a valid DRC cache file next to each DRC file, writing one when it is missing or out of date
+    void Set_Use_Cache(bool use_cache);
+    
+    // Read a sparse time index file next to each uncompressed DRC file to seek to the time window, writing one 
+    // when it is missing or out of date
+    void Set_Use_Index(bool use_index);
+    
+    // Only aggregate events within [from, to) seconds of the match start, by sent time for RECV events as
+    // for measurement periods. Measurement periods entirely within the window have the same statistics as 
+    // without one. ON, OFF and LISTEN events set parameters of the whole flow, so they are included wherever
+    // they are in the file.
+    void Set_Time_Window(double from, double to);
+    
+    // Set the duration of a measurement period, in seconds (default DEFAULT_MP_DURATION)
+    void Set_MP_Duration(double mp_duration);
+    
+    // Also output the statistics of periods of each multiple of the measurement period duration, which are
+    // rolled up from the measurement periods in the same pass. Each multiple adds a "stats_<multiple>" array.
+    void Set_MP_Rollups(const std::vector<unsigned int>& mp_rollups);
+    
+    // Record a histogram of the latencies of received and late packets, per flow and per measurement 
+    // period, adding a "latency" summary to each in the JSON output
+    void Set_Latency_Histograms(bool latency_histograms);
+    
+    // Write parse warnings to a stream other than std::cerr. The stream must outlive the parser.
+    void Set_Warning_Stream(std::ostream& warnings);
+    
+    // Record the time of each phase and the events of each DRC file parsed. The stats must outlive the parser.
+    void Set_Stats(Parse_Stats& stats);
+    
+    void Parse_Max_Latency_Per_Flow(const char * json_flow_mandates, Flow_Info_Map& flow_info);
+    
+    // Parse mandates JSON in place, overwriting the buffer, into the maximum latency of each flow
+    void Parse_Max_Latency_Map(char * json_flow_mandates, Max_Latency_Map& max_latency);
+    
+    // Read and parse a mandates JSON file into the maximum latency of each flow
+    void Parse_Max_Latency_File(const char * mandates_file, Max_Latency_Map& max_latency);
+    
+    // Set the maximum latency of flows from their parsed mandates
+    void Apply_Max_Latency_Map(const Max_Latency_Map& max_latency, Flow_Info_Map& flow_info);
+    void Parse_Flow_Traffic_Stats(const char * drc_file, double start_timestamp, Flow_Info_Map& flow_info);
+    std::string Get_JSON_Flow_Traffic_Stats(const Flow_Info_Map& flow_info);
+    
+    // Stream the same JSON as Get_JSON_Flow_Traffic_Stats to a file, without building it in memory
+    void Write_JSON_Flow_Traffic_Stats(const Flow_Info_Map& flow_info, FILE * output);
+    
+    // Statistics of every DRC file pair in a match, as an object of flow arrays keyed by send filename
+    std::string Get_JSON_Match_Traffic_Stats(const Match_Flow_Info_Map& match_flow_info);
+    
+    // Stream the same JSON as Get_JSON_Match_Traffic_Stats to a file, without building it in memory
+    void Write_JSON_Match_Traffic_Stats(const Match_Flow_Info_Map& match_flow_info, FILE * output);
+    
+    // Parse the events appended to a followed DRC file since its last poll, recording which flows changed
+    void Parse_New_Traffic_Stats(Traffic_Follower& follower, double start_timestamp, Flow_Info_Map& flow_info, 
+        Flow_Changes& changes);
+    
+    // Statistics for only the changed flows, with only the changed measurement periods of each
+    std::string Get_JSON_Flow_Traffic_Changes(const Flow_Info_Map& flow_info, const Flow_Changes& changes);
+    
+    // Parse send and listen DRC files together in time order, writing a JSON line of the measurement 
+    // periods finalized after each batch. A period is finalized once every file has passed its end by the
+    // flow's max latency plus finalize_margin seconds. Its statistics, latencies, and the received sequence 
+    // numbers sent within it are then released, so memory is bounded by the periods in flight. Events 
+    // arriving for a finalized period are dropped with a warning.
+    void Stream_Flow_Traffic_Stats(const std::vector<std::string>& drc_files, double start_timestamp, 
+        double finalize_margin, Flow_Info_Map& flow_info, FILE * output);
+
+protected:
+    unsigned int m_num_threads; // number of threads used to parse each DRC file
+    bool m_use_cache;           // true to read and write DRC cache files
+    bool m_use_index;           // true to read and write DRC index files
+    bool m_windowed;            // true if a time window has been set
+    double m_window_from;       // start of the time window, in seconds from the match start
+    double m_window_to;         // end of the time window, in seconds from the match start
+    double m_mp_duration;       // duration of a measurement period, in seconds
+    std::vector<unsigned int> m_mp_rollups; // multiples of the measurement period duration also output
+    bool m_latency_histograms;  // true to record latency histograms
+    std::ostream * m_warnings;  // stream for parse warnings
+    Parse_Stats * m_stats;      // stats being recorded, or NULL
+    
+    // Counters of the phases outside of input files, or NULL if stats are not being recorded
+    Parse_Counters * Stats_Counters();
 };
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "sequence_tracker.h"
+
+Sequence_Tracker::Sequence_Tracker() :
+    m_base_chunk(0),
+    m_count(0)
+{
+}
+
+bool Sequence_Tracker::Contains(uint32_t seq) const
+{
+    uint32_t chunk = seq >> SEQUENCE_CHUNK_BITS;
+    
+    if (m_chunks.empty() || chunk < m_base_chunk || chunk - m_base_chunk >= m_chunks.size())
+    {
+        return false;
+    }
+    
+    const std::vector<uint64_t>& bitmap = m_chunks[chunk - m_base_chunk];
+    if (bitmap.empty())
+    {
+        return false;
+    }
+    
+    uint32_t offset = seq & (SEQUENCE_CHUNK_SIZE - 1);
+    return (bitmap[offset / 64] >> (offset % 64)) & 1;
+}
+
+void Sequence_Tracker::Evict_Below(uint32_t seq)
+{
+    uint32_t chunk = seq >> SEQUENCE_CHUNK_BITS;
+    
+    if (m_chunks.empty() || chunk <= m_base_chunk)
+    {
+        return;
+    }
+    
+    size_t num_evicted = std::min<size_t>(chunk - m_base_chunk, m_chunks.size());
+    m_chunks.erase(m_chunks.begin(), m_chunks.begin() + num_evicted);
+    m_base_chunk = m_chunks.empty() ? 0 : chunk;
+}
+
+uint64_t * Sequence_Tracker::Chunk_Bitmap(uint32_t chunk)
+{
+    if (m_chunks.empty())
+    {
+        m_base_chunk = chunk;
+        m_chunks.resize(1);
+    }
+    else if (chunk < m_base_chunk)
+    {
+        // Slide the base back for a sequence number before any received so far
+        m_chunks.insert(m_chunks.begin(), m_base_chunk - chunk, std::vector<uint64_t>());
+        m_base_chunk = chunk;
+    }
+    else if (chunk - m_base_chunk >= m_chunks.size())
+    {
+        m_chunks.resize(chunk - m_base_chunk + 1);
+    }
+    
+    std::vector<uint64_t>& bitmap = m_chunks[chunk - m_base_chunk];
+    if (bitmap.empty())
+    {
+        bitmap.resize(SEQUENCE_CHUNK_SIZE / 64);
+    }
+    
+    return &bitmap[0];
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sequence numbers per bitmap chunk, as a power of two
+#define SEQUENCE_CHUNK_BITS 14
+#define SEQUENCE_CHUNK_SIZE (1u << SEQUENCE_CHUNK_BITS)
+
+/*
+ * Set of received sequence numbers, stored as a bitmap of fixed size
+ * chunks. MGEN sequence numbers are dense and increasing, so this needs
+ * about one bit per sequence number. The chunk index starts at the first
+ * chunk received rather than at zero, and chunks are only allocated once
+ * a sequence number within them is received.
+ */
+class Sequence_Tracker
+{
+public:
+    Sequence_Tracker();
+
+    // Mark a sequence number as received. Returns false if it had already been received.
+    bool Insert(uint32_t seq);
+
+    // True if a sequence number has been received
+    bool Contains(uint32_t seq) const;
+
+    // Number of distinct sequence numbers received
+    size_t Size() const { return m_count; }
+    
+    // Release the chunks holding only sequence numbers below seq. The released sequence numbers are 
+    // forgotten, so Insert reports them as new again.
+    void Evict_Below(uint32_t seq);
+
+protected:
+    // Return the bitmap of a chunk, allocating it and extending the chunk index if needed
+    uint64_t * Chunk_Bitmap(uint32_t chunk);
+
+    uint32_t m_base_chunk;                          // chunk number of m_chunks[0]
+    std::vector<std::vector<uint64_t> > m_chunks;   // bitmap of each chunk from m_base_chunk, empty until used
+    size_t m_count;                                 // number of distinct sequence numbers received
+};
+
+inline bool Sequence_Tracker::Insert(uint32_t seq)
+{
+    uint32_t chunk = seq >> SEQUENCE_CHUNK_BITS;
+    size_t index = chunk - m_base_chunk;
+    
+    uint64_t * bitmap = (chunk >= m_base_chunk && index < m_chunks.size() && !m_chunks[index].empty()) ? 
+        &m_chunks[index][0] : Chunk_Bitmap(chunk);
+    
+    uint32_t offset = seq & (SEQUENCE_CHUNK_SIZE - 1);
+    uint64_t mask = (uint64_t)1 << (offset % 64);
+    uint64_t& word = bitmap[offset / 64];
+    
+    if (word & mask)
+    {
+        return false;
+    }
+    
+    word |= mask;
+    m_count++;
+    return true;
+}
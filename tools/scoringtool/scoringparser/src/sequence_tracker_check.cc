@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2019, Malcolm Stagg
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks Sequence_Tracker against a std::set of the same sequence numbers:
+ * duplicates, gaps wider than a chunk, and inserts below the base chunk
+ * after an eviction. Prints each mismatch, and exits non-zero if there
+ * were any.
+ */
+
+#include <iostream>
+#include <set>
+#include <stdint.h>
+
+#include "sequence_tracker.h"
+
+namespace
+{
+    int num_checks = 0;
+    int mismatches = 0;
+    
+    void Check(bool passed, const char * what, uint32_t seq)
+    {
+        num_checks++;
+        
+        if (!passed)
+        {
+            std::cerr << what << " failed for sequence number " << seq << std::endl;
+            mismatches++;
+        }
+    }
+    
+    // Insert seq into both the tracker and the expected set, checking that they agree on whether it is new
+    void Insert(Sequence_Tracker& tracker, std::set<uint32_t>& expected, uint32_t seq)
+    {
+        bool inserted = expected.insert(seq).second;
+        Check(tracker.Insert(seq) == inserted, "Insert", seq);
+        Check(tracker.Size() == expected.size(), "Size", seq);
+    }
+    
+    // Check Contains for each sequence number of the chunks from first_chunk to last_chunk
+    void Check_Contains(const Sequence_Tracker& tracker, const std::set<uint32_t>& expected, uint32_t first_chunk, uint32_t last_chunk)
+    {
+        for (uint64_t seq = (uint64_t)first_chunk * SEQUENCE_CHUNK_SIZE; seq < (uint64_t)(last_chunk + 1) * SEQUENCE_CHUNK_SIZE; seq++)
+        {
+            if (tracker.Contains(seq) != (expected.count(seq) != 0))
+            {
+                Check(false, "Contains", seq);
+                return;
+            }
+        }
+        
+        num_checks++;
+    }
+    
+    void Check_Duplicates()
+    {
+        Sequence_Tracker tracker;
+        std::set<uint32_t> expected;
+        
+        uint32_t seqs[] = { 100, 101, 100, 63, 64, 101, 0, 0, SEQUENCE_CHUNK_SIZE - 1, SEQUENCE_CHUNK_SIZE, SEQUENCE_CHUNK_SIZE - 1 };
+        
+        for (size_t i = 0; i < sizeof(seqs) / sizeof(seqs[0]); i++)
+        {
+            Insert(tracker, expected, seqs[i]);
+        }
+        
+        Check_Contains(tracker, expected, 0, 1);
+    }
+    
+    void Check_Wide_Gaps()
+    {
+        Sequence_Tracker tracker;
+        std::set<uint32_t> expected;
+        
+        // Starting far from zero, then skipping whole chunks forwards and backwards
+        uint32_t base = 1000 * SEQUENCE_CHUNK_SIZE + 5;
+        
+        Insert(tracker, expected, base);
+        Insert(tracker, expected, base + 3 * SEQUENCE_CHUNK_SIZE);
+        Insert(tracker, expected, base + 3 * SEQUENCE_CHUNK_SIZE + 1);
+        Insert(tracker, expected, base + SEQUENCE_CHUNK_SIZE);
+        Insert(tracker, expected, base - 2 * SEQUENCE_CHUNK_SIZE);
+        Insert(tracker, expected, base + 3 * SEQUENCE_CHUNK_SIZE);
+        Insert(tracker, expected, base - 2 * SEQUENCE_CHUNK_SIZE);
+        
+        Check_Contains(tracker, expected, 997, 1004);
+        
+        // The highest sequence numbers are in the last chunk
+        Insert(tracker, expected, UINT32_MAX);
+        Insert(tracker, expected, UINT32_MAX);
+        Check(tracker.Contains(UINT32_MAX), "Contains", UINT32_MAX);
+        Check(!tracker.Contains(UINT32_MAX - 1), "Contains", UINT32_MAX - 1);
+    }
+    
+    void Check_Evicted()
+    {
+        Sequence_Tracker tracker;
+        std::set<uint32_t> expected;
+        
+        for (uint32_t seq = 2 * SEQUENCE_CHUNK_SIZE; seq < 6 * SEQUENCE_CHUNK_SIZE; seq += 7)
+        {
+            Insert(tracker, expected, seq);
+        }
+        
+        // Eviction keeps the chunk holding the given sequence number
+        tracker.Evict_Below(4 * SEQUENCE_CHUNK_SIZE + 1);
+        
+        Check(!tracker.Contains(2 * SEQUENCE_CHUNK_SIZE), "Evict_Below", 2 * SEQUENCE_CHUNK_SIZE);
+        uint32_t first_kept = *expected.lower_bound(4 * SEQUENCE_CHUNK_SIZE);
+        Check(tracker.Contains(first_kept), "Evict_Below", first_kept);
+        Check(tracker.Size() == expected.size(), "Size", 4 * SEQUENCE_CHUNK_SIZE);
+        
+        // The evicted sequence numbers are forgotten, so inserting them again counts them again
+        size_t size = tracker.Size();
+        
+        Check(tracker.Insert(2 * SEQUENCE_CHUNK_SIZE), "Insert below the base", 2 * SEQUENCE_CHUNK_SIZE);
+        Check(!tracker.Insert(2 * SEQUENCE_CHUNK_SIZE), "Insert below the base", 2 * SEQUENCE_CHUNK_SIZE);
+        Check(tracker.Insert(5), "Insert below the base", 5);
+        Check(tracker.Size() == size + 2, "Size", 5);
+        
+        Check(tracker.Contains(5) && tracker.Contains(2 * SEQUENCE_CHUNK_SIZE), "Contains", 5);
+        Check(!tracker.Contains(2 * SEQUENCE_CHUNK_SIZE + 7), "Contains", 2 * SEQUENCE_CHUNK_SIZE + 7);
+        
+        // The chunks kept are unchanged by the base sliding back
+        std::set<uint32_t> kept(expected.lower_bound(4 * SEQUENCE_CHUNK_SIZE), expected.end());
+        kept.insert(5);
+        kept.insert(2 * SEQUENCE_CHUNK_SIZE);
+        Check_Contains(tracker, kept, 0, 6);
+        
+        // Evicting past every chunk empties the tracker, which then starts again at any chunk
+        tracker.Evict_Below(10 * SEQUENCE_CHUNK_SIZE);
+        Check(!tracker.Contains(5 * SEQUENCE_CHUNK_SIZE + 1), "Evict_Below", 5 * SEQUENCE_CHUNK_SIZE + 1);
+        Check(tracker.Insert(SEQUENCE_CHUNK_SIZE), "Insert after evicting all", SEQUENCE_CHUNK_SIZE);
+        Check(tracker.Contains(SEQUENCE_CHUNK_SIZE), "Contains", SEQUENCE_CHUNK_SIZE);
+    }
+}
+
+int main()
+{
+    Check_Duplicates();
+    Check_Wide_Gaps();
+    Check_Evicted();
+    
+    std::cout << "Ran " << num_checks << " checks, " << mismatches << " mismatches" << std::endl;
+    
+    return mismatches ? 1 : 0;
+}
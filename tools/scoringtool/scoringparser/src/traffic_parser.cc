@@ -19,22 +19,552 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdexcept>
+#include <stdint.h>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "traffic_parser.h"
 
-#define MAX_LINE_LENGTH 4096
+#define MAX_TIMESTAMP_LENGTH 64
+#define MAX_FRACTION_DIGITS 15
+#define READ_CHUNK_SIZE 65536
+
+namespace
+{
+    // Powers of ten which are exactly representable as a double
+    const double POWERS_OF_TEN[MAX_FRACTION_DIGITS + 1] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+    };
+    
+    // Decode two ASCII digits which are known to be valid
+    inline int Two_Digits(const char * digits)
+    {
+        return (digits[0] - '0') * 10 + (digits[1] - '0');
+    }
+    
+    // Find the spaces, '>' key separators and newlines in up to 16 bytes at p. The end of the data counts as a newline.
+    inline void Scan_Bytes(const char * p, const char * end, uint32_t& spaces, uint32_t& separators, uint32_t& newlines)
+    {
+#ifdef __SSE2__
+        if (end - p >= 16)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+            spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')));
+            separators = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('>')));
+            newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')));
+            return;
+        }
+#endif
+        
+        size_t count = std::min<size_t>(end - p, 16);
+        spaces = 0;
+        separators = 0;
+        newlines = (count < 16) ? (1u << count) : 0;
+        
+        for (size_t i = 0; i < count; i++)
+        {
+            spaces |= (uint32_t)(p[i] == ' ') << i;
+            separators |= (uint32_t)(p[i] == '>') << i;
+            newlines |= (uint32_t)(p[i] == '\n') << i;
+        }
+    }
+    
+    // Scan a line starting at begin, returning its end and filling bitmaps of the spaces and '>' separators within it
+    inline const char * Scan_Line(const char * begin, const char * end, std::vector<uint64_t>& spaces, std::vector<uint64_t>& separators)
+    {
+        spaces.clear();
+        separators.clear();
+        
+        for (size_t offset = 0; ; offset += 16)
+        {
+            uint32_t space_bits;
+            uint32_t separator_bits;
+            uint32_t newline_bits;
+            Scan_Bytes(begin + offset, end, space_bits, separator_bits, newline_bits);
+            
+            if (offset % 64 == 0)
+            {
+                spaces.push_back(0);
+                separators.push_back(0);
+            }
+            
+            size_t length = 16;
+            if (newline_bits)
+            {
+                length = __builtin_ctz(newline_bits);
+                space_bits &= (1u << length) - 1;
+                separator_bits &= (1u << length) - 1;
+            }
+            
+            spaces.back() |= (uint64_t)space_bits << (offset % 64);
+            separators.back() |= (uint64_t)separator_bits << (offset % 64);
+            
+            if (newline_bits)
+            {
+                return begin + offset + length;
+            }
+        }
+    }
+    
+    // Return the position of the first bit at or after from, but before limit, which is set (or clear if Clear)
+    template<bool Clear>
+    inline size_t Next_Bit(const uint64_t * words, size_t from, size_t limit)
+    {
+        if (from >= limit)
+        {
+            return limit;
+        }
+        
+        size_t word = from / 64;
+        size_t last_word = (limit - 1) / 64;
+        uint64_t bits = (Clear ? ~words[word] : words[word]) & (~(uint64_t)0 << (from % 64));
+        
+        while (bits == 0)
+        {
+            if (++word > last_word)
+            {
+                return limit;
+            }
+            bits = Clear ? ~words[word] : words[word];
+        }
+        
+        return std::min<size_t>(word * 64 + __builtin_ctzll(bits), limit);
+    }
+    
+    inline size_t Next_Set_Bit(const uint64_t * words, size_t from, size_t limit)
+    {
+        return Next_Bit<false>(words, from, limit);
+    }
+    
+    inline size_t Next_Clear_Bit(const uint64_t * words, size_t from, size_t limit)
+    {
+        return Next_Bit<true>(words, from, limit);
+    }
+    
+    // Keys of the key>value fields in a DRC line
+    enum DRC_Key
+    {
+        DRC_KEY_UNKNOWN,
+        DRC_KEY_DST,
+        DRC_KEY_SRC,
+        DRC_KEY_SRC_PORT,
+        DRC_KEY_SENT,
+        DRC_KEY_PROTO,
+        DRC_KEY_PORT,
+        DRC_KEY_FLOW,
+        DRC_KEY_SEQ,
+        DRC_KEY_FRAG,
+        DRC_KEY_TOS,
+        DRC_KEY_SIZE,
+        DRC_KEY_GPS,
+        DRC_KEY_TYPE,
+        NUM_DRC_KEYS = DRC_KEY_TYPE
+    };
+    
+    struct DRC_Key_Entry
+    {
+        const char * name;
+        size_t length;
+        DRC_Key key;
+    };
+    
+    const size_t DRC_KEY_TABLE_SIZE = 32;
+    
+    // Perfect hash of the known keys, which all have at least two characters
+    constexpr size_t DRC_Key_Hash(const char * key, size_t length)
+    {
+        return (length + (unsigned char)key[0] + (unsigned char)key[1] * 9) % DRC_KEY_TABLE_SIZE;
+    }
+    
+    // Known keys, each in the slot given by its hash
+    constexpr DRC_Key_Entry DRC_KEY_TABLE[DRC_KEY_TABLE_SIZE] = {
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"seq", 3, DRC_KEY_SEQ},
+        {"sent", 4, DRC_KEY_SENT},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"size", 4, DRC_KEY_SIZE},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"frag", 4, DRC_KEY_FRAG},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"dst", 3, DRC_KEY_DST},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"flow", 4, DRC_KEY_FLOW},
+        {"proto", 5, DRC_KEY_PROTO},
+        {"src", 3, DRC_KEY_SRC},
+        {"type", 4, DRC_KEY_TYPE},
+        {"gps", 3, DRC_KEY_GPS},
+        {"port", 4, DRC_KEY_PORT},
+        {"srcPort", 7, DRC_KEY_SRC_PORT},
+        {"", 0, DRC_KEY_UNKNOWN},
+        {"TOS", 3, DRC_KEY_TOS},
+        {"", 0, DRC_KEY_UNKNOWN}
+    };
+    
+    // Check at compile time that every key is in its own slot
+    constexpr size_t Count_DRC_Key_Slots(size_t slot)
+    {
+        return (slot == DRC_KEY_TABLE_SIZE) ? 0 : 
+            ((DRC_KEY_TABLE[slot].key != DRC_KEY_UNKNOWN && 
+              DRC_Key_Hash(DRC_KEY_TABLE[slot].name, DRC_KEY_TABLE[slot].length) == slot) ? 1 : 0) + Count_DRC_Key_Slots(slot + 1);
+    }
+    
+    static_assert(Count_DRC_Key_Slots(0) == NUM_DRC_KEYS, "DRC key table does not match DRC_Key_Hash!");
+    
+    inline DRC_Key Lookup_DRC_Key(const boost::string_ref& key)
+    {
+        if (key.size() < 2)
+        {
+            return DRC_KEY_UNKNOWN;
+        }
+        
+        const DRC_Key_Entry& entry = DRC_KEY_TABLE[DRC_Key_Hash(key.data(), key.size())];
+        
+        if (entry.length != key.size() || memcmp(entry.name, key.data(), key.size()) != 0)
+        {
+            return DRC_KEY_UNKNOWN;
+        }
+        
+        return entry.key;
+    }
+    
+    // Parse an unsigned integer with the same semantics as atoi, without requiring a terminator
+    inline unsigned int Parse_Uint(const char * begin, const char * end)
+    {
+        while (begin < end && (*begin == ' ' || (*begin >= '\t' && *begin <= '\r')))
+        {
+            begin++;
+        }
+        
+        bool negative = false;
+        if (begin < end && (*begin == '-' || *begin == '+'))
+        {
+            negative = (*begin == '-');
+            begin++;
+        }
+        
+        unsigned int value = 0;
+        while (begin < end && *begin >= '0' && *begin <= '9')
+        {
+            value = value * 10 + (*begin - '0');
+            begin++;
+        }
+        
+        return negative ? -value : value;
+    }
+    
+    inline unsigned int Parse_Uint(const boost::string_ref& value)
+    {
+        return Parse_Uint(value.data(), value.data() + value.size());
+    }
+    
+    // Parse a dotted quad IPv4 address to host byte order, only accepting the form Format_IPv4_Address produces
+    inline bool Parse_IPv4_Address(const char * begin, const char * end, uint32_t& address)
+    {
+        address = 0;
+        for (int octet_num = 0; octet_num < 4; octet_num++)
+        {
+            if (octet_num > 0)
+            {
+                if (begin == end || *begin != '.')
+                {
+                    return false;
+                }
+                begin++;
+            }
+            
+            const char * octet_begin = begin;
+            unsigned int octet = 0;
+            while (begin < end && *begin >= '0' && *begin <= '9' && begin - octet_begin < 3)
+            {
+                octet = octet * 10 + (*begin - '0');
+                begin++;
+            }
+            
+            size_t octet_length = begin - octet_begin;
+            if (octet_length == 0 || octet > 255 || (octet_length > 1 && *octet_begin == '0'))
+            {
+                return false;
+            }
+            
+            address = (address << 8) | octet;
+        }
+        
+        return begin == end;
+    }
+    
+    // Return the start of the first line which begins at or after offset
+    inline const char * Line_Start_At_Or_After(const char * data, size_t size, size_t offset)
+    {
+        if (offset >= size)
+        {
+            return data + size;
+        }
+        
+        if (offset == 0 || data[offset - 1] == '\n')
+        {
+            return data + offset;
+        }
+        
+        const char * line_end = (const char *)memchr(data + offset, '\n', size - offset);
+        return line_end ? line_end + 1 : data + size;
+    }
+    
+    inline Traffic_Action Decode_Action(const boost::string_ref& action)
+    {
+        switch (action.size())
+        {
+        case 2:
+            return (action == "ON") ? TRAFFIC_ACTION_ON : TRAFFIC_ACTION_OTHER;
+        case 3:
+            return (action == "OFF") ? TRAFFIC_ACTION_OFF : TRAFFIC_ACTION_OTHER;
+        case 4:
+            if (action == "SEND")
+            {
+                return TRAFFIC_ACTION_SEND;
+            }
+            return (action == "RECV") ? TRAFFIC_ACTION_RECV : TRAFFIC_ACTION_OTHER;
+        case 6:
+            return (action == "LISTEN") ? TRAFFIC_ACTION_LISTEN : TRAFFIC_ACTION_OTHER;
+        default:
+            return TRAFFIC_ACTION_OTHER;
+        }
+    }
+    
+    inline boost::optional<std::string> To_String(const Traffic_Event_View& event, uint32_t field, const boost::string_ref& value)
+    {
+        if (!event.Has(field))
+        {
+            return boost::none;
+        }
+        
+        return value.to_string();
+    }
+    
+    template<class T>
+    inline boost::optional<T> To_Optional(const Traffic_Event_View& event, uint32_t field, const T& value)
+    {
+        if (!event.Has(field))
+        {
+            return boost::none;
+        }
+        
+        return value;
+    }
+}
+
+Traffic_Event_Batch::Traffic_Event_Batch(size_t capacity) :
+    count(0),
+    action(capacity),
+    fields(capacity),
+    time(capacity),
+    sent(capacity),
+    port(capacity),
+    flow(capacity),
+    seq(capacity),
+    frag(capacity),
+    tos(capacity),
+    dstAddr(capacity),
+    dstPort(capacity),
+    srcAddr(capacity),
+    srcPort(capacity),
+    size(capacity),
+    proto(capacity)
+{
+}
 
-Traffic_Parser::Traffic_Parser(const char * drc_filename)
+std::string Format_IPv4_Address(uint32_t address)
+{
+    char address_string[16];
+    snprintf(address_string, sizeof(address_string), "%u.%u.%u.%u",
+        (address >> 24) & 0xff, (address >> 16) & 0xff, (address >> 8) & 0xff, address & 0xff);
+    return address_string;
+}
+
+Traffic_Parser::Traffic_Parser(const char * drc_filename) :
+    m_data(NULL),
+    m_size(0),
+    m_pos(NULL),
+    m_end(NULL),
+    m_mapped(false),
+    m_block(NULL),
+    m_stream_done(false),
+    m_following(false),
+    m_batch_stopped(false),
+    m_stopped_at_line(false)
+{
+    // As with std::ifstream, a file which cannot be opened simply has no events
+    int fd = open(drc_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    
+    Compression_Type compression = Compressed_Reader::Detect(fd);
+    if (compression != COMPRESSION_NONE)
+    {
+        // The reader takes ownership of the file
+        m_reader.reset(new Compressed_Reader(fd, compression));
+        return;
+    }
+    
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0)
+    {
+        void * mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            madvise(mapping, file_stat.st_size, MADV_SEQUENTIAL);
+            m_data = (const char *)mapping;
+            m_size = file_stat.st_size;
+            m_mapped = true;
+        }
+    }
+    
+    if (!m_mapped)
+    {
+        ssize_t bytes_read;
+        do
+        {
+            size_t offset = m_buffer.size();
+            m_buffer.resize(offset + READ_CHUNK_SIZE);
+            bytes_read = read(fd, &m_buffer[offset], READ_CHUNK_SIZE);
+            m_buffer.resize(offset + (bytes_read > 0 ? bytes_read : 0));
+        } while (bytes_read > 0);
+        
+        m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+        m_size = m_buffer.size();
+    }
+    
+    close(fd);
+    m_pos = m_data;
+    m_end = m_data + m_size;
+}
+
+Traffic_Parser::Traffic_Parser(const Traffic_Parser& source, size_t range_begin, size_t range_end) :
+    m_data(source.m_data),
+    m_size(source.m_size),
+    m_pos(NULL),
+    m_end(NULL),
+    m_mapped(false),
+    m_block(NULL),
+    m_stream_done(false),
+    m_following(false),
+    m_batch_stopped(false),
+    m_stopped_at_line(false)
+{
+    m_pos = Line_Start_At_Or_After(m_data, m_size, range_begin);
+    m_end = Line_Start_At_Or_After(m_data, m_size, range_end);
+}
+
+Traffic_Parser::Traffic_Parser() :
+    m_data(NULL),
+    m_size(0),
+    m_pos(NULL),
+    m_end(NULL),
+    m_mapped(false),
+    m_block(NULL),
+    m_stream_done(false),
+    m_following(false),
+    m_batch_stopped(false),
+    m_stopped_at_line(false)
 {
-    m_drc_file.open(drc_filename);
 }
 
 Traffic_Parser::~Traffic_Parser()
 {
+    if (m_mapped)
+    {
+        munmap((void *)m_data, m_size);
+    }
+}
+
+DRC_Timestamp_Decoder::DRC_Timestamp_Decoder() :
+    m_cached_epoch(0)
+{
+    memset(m_cached_date, 0, sizeof(m_cached_date));
+}
+
+double DRC_Timestamp_Decoder::Decode(const char * begin, const char * end)
+{
+    // Fixed layout: YYYY-MM-DD_HH:MM:SS.f[fffff...]
+    static const char layout[] = "dddd-dd-dd_dd:dd:dd.";
+    static const size_t layout_length = sizeof(layout) - 1;
+    
+    size_t length = end - begin;
+    size_t fraction_digits = length - layout_length;
+    
+    if (length <= layout_length || fraction_digits > MAX_FRACTION_DIGITS)
+    {
+        return Decode_General(begin, end);
+    }
+    
+    for (size_t i = 0; i < length; i++)
+    {
+        bool is_separator = (i < layout_length && layout[i] != 'd');
+        bool is_digit = (begin[i] >= '0' && begin[i] <= '9');
+        if (is_separator ? begin[i] != layout[i] : !is_digit)
+        {
+            return Decode_General(begin, end);
+        }
+    }
+    
+    if (memcmp(begin, m_cached_date, sizeof(m_cached_date)) != 0)
+    {
+        tm date;
+        memset(&date, 0, sizeof(date));
+        date.tm_year = Two_Digits(begin) * 100 + Two_Digits(begin + 2) - 1900;
+        date.tm_mon = Two_Digits(begin + 5) - 1;
+        date.tm_mday = Two_Digits(begin + 8);
+        m_cached_epoch = timegm(&date);
+        memcpy(m_cached_date, begin, sizeof(m_cached_date));
+    }
+    
+    // timegm is linear in hours, minutes and seconds, so these can be added directly
+    time_t epoch_time = m_cached_epoch + 
+        Two_Digits(begin + 11) * 3600 + Two_Digits(begin + 14) * 60 + Two_Digits(begin + 17);
+    
+    // Both operands are exact, so the division is correctly rounded just as atof is
+    uint64_t fraction = 0;
+    for (const char * digit = begin + layout_length; digit < end; digit++)
+    {
+        fraction = fraction * 10 + (*digit - '0');
+    }
+    
+    return epoch_time + fraction / POWERS_OF_TEN[fraction_digits];
 }
 
-double Traffic_Parser::Parse_DRC_Timestamp(char * timestamp)
+double DRC_Timestamp_Decoder::Decode_General(const char * begin, const char * end)
 {
+    // Copy to a terminated buffer, since the DRC contents must not be modified
+    char timestamp[MAX_TIMESTAMP_LENGTH];
+    size_t length = end - begin;
+    if (length >= MAX_TIMESTAMP_LENGTH)
+    {
+        throw std::runtime_error("Cannot parse timestamp!"); 
+    }
+    memcpy(timestamp, begin, length);
+    timestamp[length] = '\0';
+    
     char * end_date_time;
     char * date_string = strtok_r(timestamp, "_", &end_date_time);
     char * time_string = strtok_r(NULL, "", &end_date_time);
@@ -72,127 +602,372 @@ double Traffic_Parser::Parse_DRC_Timestamp(char * timestamp)
     throw std::runtime_error("Cannot parse timestamp!"); 
 }
 
-void Traffic_Parser::Parse_DRC_IP_Port(char * ip_port, std::string& ip, std::string& port)
+double Traffic_Parser::Parse_DRC_Timestamp(const char * begin, const char * end)
 {
-    char * ip_port_end_token;
-    char * ip_val = strtok_r(ip_port, "/", &ip_port_end_token);
-    char * port_val = strtok_r(NULL, "", &ip_port_end_token);
+    return m_timestamp_decoder.Decode(begin, end);
+}
 
-    if (!ip_val || !port_val) 
+void Traffic_Parser::Parse_DRC_IP_Port(const char * begin, const char * end, uint32_t& ip, uint32_t& port)
+{
+    while (begin < end && *begin == '/')
+    {
+        begin++;
+    }
+    
+    const char * separator = (const char *)memchr(begin, '/', end - begin);
+
+    if (begin == end || !separator || separator + 1 == end) 
     {
         throw std::runtime_error("Cannot parse ip/port!"); 
     }
 
-    ip = std::string(ip_val);
-    port = std::string(port_val);
+    if (!Parse_IPv4_Address(begin, separator, ip))
+    {
+        throw std::runtime_error("Cannot parse IPv4 address: " + std::string(begin, separator) + "!"); 
+    }
+    
+    port = Parse_Uint(separator + 1, end);
 }
 
-bool Traffic_Parser::Next(Traffic_Event& traffic_event)
+bool Traffic_Parser::Next_Stream_Block()
 {
-    if (!m_drc_file)
+    if (!m_reader || m_stream_done)
     {
         return false;
     }
+    
+    if (m_block)
+    {
+        m_retired_blocks.push_back(m_block);
+        m_block = NULL;
+    }
+    
+    m_block = m_reader->Next_Block();
+    
+    if (!m_block)
+    {
+        m_stream_done = true;
+        return false;
+    }
+    
+    m_pos = &m_block->data[0];
+    m_end = m_pos + m_block->size;
+    return true;
+}
+
+void Traffic_Parser::Release_Stream_Blocks()
+{
+    for (size_t i = 0; i < m_retired_blocks.size(); i++)
+    {
+        m_reader->Release_Block(m_retired_blocks[i]);
+    }
+    
+    m_retired_blocks.clear();
+}
 
-    char file_line[MAX_LINE_LENGTH];
-    m_drc_file.getline(file_line, MAX_LINE_LENGTH); 
+bool Traffic_Parser::Next_View(Traffic_Event_View& traffic_event)
+{
+    Release_Stream_Blocks();
+    return Parse_Next_Line(traffic_event);
+}
 
-    char * end_token;
-    char * line_timestamp = strtok_r(file_line," \n", &end_token);
+bool Traffic_Parser::Parse_Next_Line(Traffic_Event_View& traffic_event)
+{
+    if (m_pos >= m_end && !Next_Stream_Block())
+    {
+        return false;
+    }
+    
+    // Find the end of the line and all of its delimiters in a single pass
+    const char * line_begin = m_pos;
+    const char * line_end = Scan_Line(line_begin, m_end, m_spaces, m_separators);
+    m_pos = (line_end < m_end) ? line_end + 1 : m_end;
+    
+    size_t line_length = line_end - line_begin;
+    const uint64_t * spaces = &m_spaces[0];
+    const uint64_t * separators = &m_separators[0];
+    
+    size_t timestamp_begin = Next_Clear_Bit(spaces, 0, line_length);
+    size_t timestamp_end = Next_Set_Bit(spaces, timestamp_begin, line_length);
 
-    if (!line_timestamp)
+    if (timestamp_begin == timestamp_end)
     {
+        m_stopped_at_line = true;
         return false;
     }
 
-    traffic_event = Traffic_Event();
-    traffic_event.time = Parse_DRC_Timestamp(line_timestamp);
+    traffic_event.fields = 0;
+    traffic_event.time = Parse_DRC_Timestamp(line_begin + timestamp_begin, line_begin + timestamp_end);
 
-    char * line_action = strtok_r(NULL, " \n", &end_token);
+    size_t action_begin = Next_Clear_Bit(spaces, timestamp_end, line_length);
+    size_t action_end = Next_Set_Bit(spaces, action_begin, line_length);
 
-    if (!line_action)
+    if (action_begin == action_end)
     {
         throw std::runtime_error("No action present!"); 
     }
 
-    traffic_event.action = std::string(line_action);
+    boost::string_ref line_action(line_begin + action_begin, action_end - action_begin);
+    traffic_event.action_name = line_action;
+    traffic_event.action = Decode_Action(line_action);
 
-    char * next_token = strtok_r(NULL, " \n", &end_token);
-    while (next_token) 
+    size_t token_begin = Next_Clear_Bit(spaces, action_end, line_length);
+    while (token_begin < line_length) 
     {
-        char * inner_end_token;
-        char * inner_key = strtok_r(next_token, ">", &inner_end_token);
-        char * inner_value = strtok_r(NULL, "", &inner_end_token);
+        size_t token_end = Next_Set_Bit(spaces, token_begin, line_length);
+        size_t key_begin = Next_Clear_Bit(separators, token_begin, token_end);
+        size_t key_end = Next_Set_Bit(separators, key_begin, token_end);
 
-        if (inner_key && inner_value) 
+        if (key_end + 1 < token_end) 
         {
-            if (strcmp(inner_key, "dst") == 0)
-            {
-                std::string ip, port;
-                Parse_DRC_IP_Port(inner_value, ip, port);
-                traffic_event.dstAddr = ip;
-                traffic_event.dstPort = atoi(port.c_str());
-            }
-            else if (strcmp(inner_key, "src") == 0)
-            {
-                std::string ip, port;
-                Parse_DRC_IP_Port(inner_value, ip, port);
-                traffic_event.srcAddr = ip;
-                traffic_event.srcPort = atoi(port.c_str());
-            }
-            else if (strcmp(inner_key, "srcPort") == 0)
-            {
-                traffic_event.srcPort = atoi(inner_value);
-            }
-            else if (strcmp(inner_key, "sent") == 0)
-            {
-                traffic_event.sent = Parse_DRC_Timestamp(inner_value);
-            }
-            else if (strcmp(inner_key, "proto") == 0)
+            boost::string_ref inner_key(line_begin + key_begin, key_end - key_begin);
+            boost::string_ref inner_value(line_begin + key_end + 1, token_end - (key_end + 1));
+            
+            switch (Lookup_DRC_Key(inner_key))
             {
+            case DRC_KEY_DST:
+                Parse_DRC_IP_Port(inner_value.begin(), inner_value.end(), traffic_event.dstAddr, traffic_event.dstPort);
+                traffic_event.fields |= TRAFFIC_FIELD_DST_ADDR | TRAFFIC_FIELD_DST_PORT;
+                break;
+            case DRC_KEY_SRC:
+                Parse_DRC_IP_Port(inner_value.begin(), inner_value.end(), traffic_event.srcAddr, traffic_event.srcPort);
+                traffic_event.fields |= TRAFFIC_FIELD_SRC_ADDR | TRAFFIC_FIELD_SRC_PORT;
+                break;
+            case DRC_KEY_SRC_PORT:
+                traffic_event.srcPort = Parse_Uint(inner_value);
+                traffic_event.fields |= TRAFFIC_FIELD_SRC_PORT;
+                break;
+            case DRC_KEY_SENT:
+                traffic_event.sent = Parse_DRC_Timestamp(inner_value.begin(), inner_value.end());
+                traffic_event.fields |= TRAFFIC_FIELD_SENT;
+                break;
+            case DRC_KEY_PROTO:
                 traffic_event.proto = inner_value;
+                traffic_event.fields |= TRAFFIC_FIELD_PROTO;
+                break;
+            case DRC_KEY_PORT:
+                traffic_event.port = Parse_Uint(inner_value);
+                traffic_event.fields |= TRAFFIC_FIELD_PORT;
+                break;
+            case DRC_KEY_FLOW:
+                traffic_event.flow = Parse_Uint(inner_value);
+                traffic_event.fields |= TRAFFIC_FIELD_FLOW;
+                break;
+            case DRC_KEY_SEQ:
+                traffic_event.seq = Parse_Uint(inner_value);
+                traffic_event.fields |= TRAFFIC_FIELD_SEQ;
+                break;
+            case DRC_KEY_FRAG:
+                traffic_event.frag = Parse_Uint(inner_value);
+                traffic_event.fields |= TRAFFIC_FIELD_FRAG;
+                break;
+            case DRC_KEY_TOS:
+                traffic_event.tos = Parse_Uint(inner_value);
+                traffic_event.fields |= TRAFFIC_FIELD_TOS;
+                break;
+            case DRC_KEY_SIZE:
+                traffic_event.size = Parse_Uint(inner_value);
+                traffic_event.fields |= TRAFFIC_FIELD_SIZE;
+                break;
+            case DRC_KEY_GPS:
+                traffic_event.gps = inner_value;
+                traffic_event.fields |= TRAFFIC_FIELD_GPS;
+                break;
+            case DRC_KEY_TYPE:
+                traffic_event.type = inner_value;
+                traffic_event.fields |= TRAFFIC_FIELD_TYPE;
+                break;
+            default:
+                throw std::runtime_error(std::string("unknown field: ") + inner_key.to_string() + " = " + inner_value.to_string());
             }
-            else if (strcmp(inner_key, "port") == 0)
-            {
-                traffic_event.port = atoi(inner_value);
-            }
-            else if (strcmp(inner_key, "flow") == 0)
-            {
-                traffic_event.flow = atoi(inner_value);
-            }
-            else if (strcmp(inner_key, "seq") == 0)
-            {
-                traffic_event.seq = atoi(inner_value);
-            }
-            else if (strcmp(inner_key, "frag") == 0)
-            {
-                traffic_event.frag = atoi(inner_value);
-            }
-            else if (strcmp(inner_key, "TOS") == 0)
-            {
-                traffic_event.tos = atoi(inner_value);
-            }
-            else if (strcmp(inner_key, "size") == 0)
-            {
-                traffic_event.size = atoi(inner_value);
-            }
-            else if (strcmp(inner_key, "gps") == 0)
+        }
+
+        token_begin = Next_Clear_Bit(spaces, token_end, line_length);
+    }
+
+    if (!traffic_event.Has(TRAFFIC_ACTION_SCHEMAS[traffic_event.action]))
+    {
+        throw std::runtime_error("Missing field in DRC \"" + line_action.to_string() + "\" action!");
+    }
+
+    return true;
+}
+
+bool Traffic_Parser::Next(Traffic_Event& traffic_event)
+{
+    Traffic_Event_View view;
+    
+    if (!Next_View(view))
+    {
+        return false;
+    }
+    
+    traffic_event = Traffic_Event();
+    traffic_event.action = view.action_name.to_string();
+    traffic_event.time = view.time;
+    traffic_event.sent = To_Optional(view, TRAFFIC_FIELD_SENT, view.sent);
+    traffic_event.proto = To_String(view, TRAFFIC_FIELD_PROTO, view.proto);
+    traffic_event.port = To_Optional(view, TRAFFIC_FIELD_PORT, view.port);
+    traffic_event.flow = To_Optional(view, TRAFFIC_FIELD_FLOW, view.flow);
+    traffic_event.seq = To_Optional(view, TRAFFIC_FIELD_SEQ, view.seq);
+    traffic_event.frag = To_Optional(view, TRAFFIC_FIELD_FRAG, view.frag);
+    traffic_event.tos = To_Optional(view, TRAFFIC_FIELD_TOS, view.tos);
+    if (view.Has(TRAFFIC_FIELD_DST_ADDR))
+    {
+        traffic_event.dstAddr = Format_IPv4_Address(view.dstAddr);
+    }
+    traffic_event.dstPort = To_Optional(view, TRAFFIC_FIELD_DST_PORT, view.dstPort);
+    if (view.Has(TRAFFIC_FIELD_SRC_ADDR))
+    {
+        traffic_event.srcAddr = Format_IPv4_Address(view.srcAddr);
+    }
+    traffic_event.srcPort = To_Optional(view, TRAFFIC_FIELD_SRC_PORT, view.srcPort);
+    traffic_event.size = To_Optional(view, TRAFFIC_FIELD_SIZE, view.size);
+    traffic_event.gps = To_String(view, TRAFFIC_FIELD_GPS, view.gps);
+    traffic_event.type = To_String(view, TRAFFIC_FIELD_TYPE, view.type);
+    
+    return true;
+}
+
+bool Traffic_Parser::Next_Batch(Traffic_Event_Batch& batch)
+{
+    batch.count = 0;
+    
+    if (m_batch_error)
+    {
+        std::exception_ptr error = m_batch_error;
+        m_batch_error = std::exception_ptr();
+        m_batch_stopped = true;
+        std::rethrow_exception(error);
+    }
+    
+    if (m_batch_stopped)
+    {
+        return false;
+    }
+    
+    size_t capacity = batch.Capacity();
+    Traffic_Event_View view = Traffic_Event_View();
+    
+    // Blocks are kept until the next call, since the batch may refer to them
+    Release_Stream_Blocks();
+    
+    try
+    {
+        while (batch.count < capacity)
+        {
+            // Never span compressed blocks, so the decompression thread always has a free block
+            if (m_reader && m_pos >= m_end && batch.count > 0)
             {
-                traffic_event.gps = std::string(inner_value);
+                break;
             }
-            else if (strcmp(inner_key, "type") == 0)
+            
+            // Running out of lines only stops a follower until more are appended
+            if (m_pos >= m_end && !Next_Stream_Block())
             {
-                traffic_event.type = std::string(inner_value);
+                m_batch_stopped = !m_following;
+                break;
             }
-            else
+            
+            if (!Parse_Next_Line(view))
             {
-                throw std::runtime_error(std::string("unknown field: ") + std::string(inner_key) + " = " + std::string(inner_value));
+                m_batch_stopped = true;
+                break;
             }
+            
+            size_t n = batch.count++;
+            batch.action[n] = view.action;
+            batch.fields[n] = view.fields;
+            batch.time[n] = view.time;
+            batch.sent[n] = view.Has(TRAFFIC_FIELD_SENT) ? view.sent : view.time;
+            batch.port[n] = view.port;
+            batch.flow[n] = view.flow;
+            batch.seq[n] = view.seq;
+            batch.frag[n] = view.frag;
+            batch.tos[n] = view.tos;
+            batch.dstAddr[n] = view.dstAddr;
+            batch.dstPort[n] = view.dstPort;
+            batch.srcAddr[n] = view.srcAddr;
+            batch.srcPort[n] = view.srcPort;
+            batch.size[n] = view.size;
+            batch.proto[n] = view.proto;
         }
-
-        next_token = strtok_r(NULL, " \n", &end_token);
     }
+    catch (...)
+    {
+        // Return the events preceding the error first, as Next_View would have
+        if (batch.count == 0)
+        {
+            m_batch_stopped = true;
+            throw;
+        }
+        
+        m_batch_error = std::current_exception();
+    }
+    
+    return batch.count > 0;
+}
 
-    return true;
+Traffic_Follower::Traffic_Follower(const char * drc_filename) :
+    m_filename(drc_filename),
+    m_fd(-1),
+    m_offset(0)
+{
+    m_following = true;
 }
 
+Traffic_Follower::~Traffic_Follower()
+{
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+size_t Traffic_Follower::Poll()
+{
+    // As with Traffic_Parser, a file which does not exist yet simply has no events
+    if (m_fd < 0)
+    {
+        m_fd = open(m_filename.c_str(), O_RDONLY);
+        if (m_fd < 0)
+        {
+            return 0;
+        }
+        
+        if (Compressed_Reader::Detect(m_fd) != COMPRESSION_NONE)
+        {
+            throw std::runtime_error("Cannot follow compressed DRC file " + m_filename + "!");
+        }
+    }
+    
+    struct stat file_stat;
+    if (fstat(m_fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && (uint64_t)file_stat.st_size < m_offset)
+    {
+        throw std::runtime_error("DRC file " + m_filename + " was truncated while following it!");
+    }
+    
+    // Drop the lines which have been parsed, keeping any partial line
+    size_t parsed_size = m_pos ? m_pos - m_data : 0;
+    m_buffer.erase(m_buffer.begin(), m_buffer.begin() + parsed_size);
+    
+    size_t old_size = m_buffer.size();
+    ssize_t bytes_read;
+    do
+    {
+        size_t offset = m_buffer.size();
+        m_buffer.resize(offset + READ_CHUNK_SIZE);
+        bytes_read = pread(m_fd, &m_buffer[offset], READ_CHUNK_SIZE, m_offset);
+        m_buffer.resize(offset + (bytes_read > 0 ? bytes_read : 0));
+        m_offset += (bytes_read > 0 ? bytes_read : 0);
+    } while (bytes_read > 0);
+    
+    m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+    m_size = m_buffer.size();
+    m_pos = m_data;
+    
+    const char * last_newline = m_data ? (const char *)memrchr(m_data, '\n', m_size) : NULL;
+    m_end = last_newline ? last_newline + 1 : m_data;
+    
+    return m_size - old_size;
+}
@@ -19,9 +19,18 @@
 
 #include <string>
 #include <map>
-#include <fstream>
+#include <vector>
+#include <ctime>
+#include <exception>
+#include <stdint.h>
 
 #include <boost/optional.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include "compressed_reader.h"
+
+// Default number of events per Traffic_Event_Batch
+#define TRAFFIC_EVENT_BATCH_SIZE 1024
 
 struct Traffic_Event
 {
@@ -43,18 +52,256 @@ struct Traffic_Event
     boost::optional<std::string> type;      // type field (used by RERR)
 };
 
+// Actions decoded from a DRC line
+enum Traffic_Action
+{
+    TRAFFIC_ACTION_OTHER,   // Any action not used for scoring (START, STOP, RERR...)
+    TRAFFIC_ACTION_ON,
+    TRAFFIC_ACTION_OFF,
+    TRAFFIC_ACTION_LISTEN,
+    TRAFFIC_ACTION_SEND,
+    TRAFFIC_ACTION_RECV
+};
+
+// Presence bits for the optional fields of a Traffic_Event_View
+enum Traffic_Field
+{
+    TRAFFIC_FIELD_SENT     = 1 << 0,
+    TRAFFIC_FIELD_PROTO    = 1 << 1,
+    TRAFFIC_FIELD_PORT     = 1 << 2,
+    TRAFFIC_FIELD_FLOW     = 1 << 3,
+    TRAFFIC_FIELD_SEQ      = 1 << 4,
+    TRAFFIC_FIELD_FRAG     = 1 << 5,
+    TRAFFIC_FIELD_TOS      = 1 << 6,
+    TRAFFIC_FIELD_DST_ADDR = 1 << 7,
+    TRAFFIC_FIELD_DST_PORT = 1 << 8,
+    TRAFFIC_FIELD_SRC_ADDR = 1 << 9,
+    TRAFFIC_FIELD_SRC_PORT = 1 << 10,
+    TRAFFIC_FIELD_SIZE     = 1 << 11,
+    TRAFFIC_FIELD_GPS      = 1 << 12,
+    TRAFFIC_FIELD_TYPE     = 1 << 13
+};
+
+// Fields which must be present for each action. Every line is checked against these by the parser.
+constexpr uint32_t TRAFFIC_SCHEMA_ON = TRAFFIC_FIELD_FLOW | TRAFFIC_FIELD_SRC_PORT | TRAFFIC_FIELD_DST_ADDR | TRAFFIC_FIELD_DST_PORT;
+constexpr uint32_t TRAFFIC_SCHEMA_OFF = TRAFFIC_SCHEMA_ON;
+constexpr uint32_t TRAFFIC_SCHEMA_LISTEN = TRAFFIC_FIELD_PROTO | TRAFFIC_FIELD_PORT;
+constexpr uint32_t TRAFFIC_SCHEMA_SEND = TRAFFIC_FIELD_FLOW | TRAFFIC_FIELD_PROTO | TRAFFIC_FIELD_SEQ | TRAFFIC_FIELD_FRAG |
+    TRAFFIC_FIELD_TOS | TRAFFIC_FIELD_SRC_PORT | TRAFFIC_FIELD_DST_ADDR | TRAFFIC_FIELD_DST_PORT | TRAFFIC_FIELD_SIZE;
+constexpr uint32_t TRAFFIC_SCHEMA_RECV = TRAFFIC_SCHEMA_SEND | TRAFFIC_FIELD_SRC_ADDR | TRAFFIC_FIELD_SENT;
+
+// Required fields indexed by Traffic_Action
+constexpr uint32_t TRAFFIC_ACTION_SCHEMAS[] = {
+    0,                      // TRAFFIC_ACTION_OTHER
+    TRAFFIC_SCHEMA_ON,      // TRAFFIC_ACTION_ON
+    TRAFFIC_SCHEMA_OFF,     // TRAFFIC_ACTION_OFF
+    TRAFFIC_SCHEMA_LISTEN,  // TRAFFIC_ACTION_LISTEN
+    TRAFFIC_SCHEMA_SEND,    // TRAFFIC_ACTION_SEND
+    TRAFFIC_SCHEMA_RECV     // TRAFFIC_ACTION_RECV
+};
+
+static_assert(sizeof(TRAFFIC_ACTION_SCHEMAS) / sizeof(TRAFFIC_ACTION_SCHEMAS[0]) == TRAFFIC_ACTION_RECV + 1, 
+    "Every Traffic_Action needs a schema!");
+
+/*
+ * Compact, zero-copy form of Traffic_Event. A field is only valid if its
+ * bit is set in 'fields', which always include the action's schema. Addresses are IPv4 addresses in host byte order.
+ * String fields are views into the DRC file contents held by the
+ * Traffic_Parser, so they are only valid for as long as the parser which
+ * returned them.
+ */
+struct Traffic_Event_View
+{
+    bool Has(uint32_t field_mask) const { return (fields & field_mask) == field_mask; }
+
+    double time;                  // Timestamp of the event
+    double sent;                  // Sent timestamp
+    uint32_t port;                // Port field
+    uint32_t flow;                // Flow field
+    uint32_t seq;                 // Sequence field
+    uint32_t frag;                // Fragment field
+    uint32_t tos;                 // TOS field
+    uint32_t dstAddr;             // destination address field
+    uint32_t dstPort;             // destination port field
+    uint32_t srcAddr;             // source address field
+    uint32_t srcPort;             // source port field
+    uint32_t size;                // message size field
+    boost::string_ref proto;      // Proto field (UDP/TCP)
+    boost::string_ref gps;        // gps data field
+    boost::string_ref type;       // type field (used by RERR)
+    boost::string_ref action_name;// Action field as it appears in the file
+    Traffic_Action action;        // Decoded action field
+    uint32_t fields;              // Traffic_Field bits for the fields which are present
+};
+
+/*
+ * Structure-of-arrays block of traffic events, filled by Next_Batch. Entry
+ * i of every column describes the i'th event of the batch. A column is only
+ * valid if the event's bit is set in 'fields', except that 'sent' holds the
+ * event time when no sent timestamp is present.
+ */
+struct Traffic_Event_Batch
+{
+    explicit Traffic_Event_Batch(size_t capacity = TRAFFIC_EVENT_BATCH_SIZE);
+
+    size_t Capacity() const { return action.size(); }
+
+    size_t count;                           // number of events in the batch
+
+    std::vector<uint8_t> action;            // Traffic_Action of each event
+    std::vector<uint32_t> fields;           // Traffic_Field bits of each event
+    std::vector<double> time;               // Timestamp of each event
+    std::vector<double> sent;               // Sent timestamp of each event
+    std::vector<uint32_t> port;             // Port field
+    std::vector<uint32_t> flow;             // Flow field
+    std::vector<uint32_t> seq;              // Sequence field
+    std::vector<uint32_t> frag;             // Fragment field
+    std::vector<uint32_t> tos;              // TOS field
+    std::vector<uint32_t> dstAddr;          // destination address field
+    std::vector<uint32_t> dstPort;          // destination port field
+    std::vector<uint32_t> srcAddr;          // source address field
+    std::vector<uint32_t> srcPort;          // source port field
+    std::vector<uint32_t> size;             // message size field
+    std::vector<boost::string_ref> proto;   // Proto field (UDP/TCP)
+};
+
+// Time which places an event in a measurement period: the sent time of RECV events, otherwise the event time
+inline double Traffic_Period_Time(uint8_t action, double time, double sent)
+{
+    return (action == TRAFFIC_ACTION_RECV) ? sent : time;
+}
+
+// Format an IPv4 address in host byte order as a dotted quad
+std::string Format_IPv4_Address(uint32_t address);
+
+/*
+ * Decodes DRC timestamps of the form YYYY-MM-DD_HH:MM:SS.ffffff to seconds
+ * since the epoch. The epoch of the most recent date is cached, so calendar
+ * conversion is only done when the date changes. Timestamps which do not
+ * match the fixed layout fall back to a general parser. Results are
+ * identical to timegm() plus atof() of the fractional part.
+ */
+class DRC_Timestamp_Decoder
+{
+public:
+    DRC_Timestamp_Decoder();
+
+    double Decode(const char * begin, const char * end);
+
+protected:
+    double Decode_General(const char * begin, const char * end);
+
+    char m_cached_date[10];   // YYYY-MM-DD of the cached date, or zeros if none
+    time_t m_cached_epoch;    // epoch time at midnight of the cached date
+};
+
+/*
+ * Reads events from a DRC file. Regular files are memory-mapped and parsed
+ * in place; anything which cannot be mapped (pipes, character devices) is
+ * read into memory up front. A parser may also be restricted to a range of
+ * another parser's file, which must outlive it.
+ *
+ * Gzip (and zstd, if built with HAVE_ZSTD) compressed files are detected
+ * from their magic bytes and decompressed on a separate thread. For these,
+ * views returned by Next_View or Next_Batch are only valid until the next
+ * call to either, and Size() is zero.
+ */
 class Traffic_Parser 
 {
 public:
     Traffic_Parser(const char * drc_filename);
+    
+    // Parse only the lines of another parser's DRC file which start within [range_begin, range_end)
+    Traffic_Parser(const Traffic_Parser& source, size_t range_begin, size_t range_end);
+    
     virtual ~Traffic_Parser();
 
+    // Size of the DRC file contents, in bytes
+    size_t Size() const { return m_size; }
+    
+    // True for gzip or zstd compressed files, which are read as a stream and cannot be seeked
+    bool Is_Compressed() const { return m_reader != NULL; }
+    
+    // Byte offset of the next line to be parsed, for files which are not compressed
+    size_t Position() const { return m_pos - m_data; }
+    
+    // True once every line in the parser's range has been read
+    bool At_End() const { return m_pos >= m_end && (!m_reader || m_stream_done); }
+    
+    // True if parsing stopped at a line with no timestamp, such as a blank line, even if it was the last line
+    bool Stopped_At_Line() const { return m_stopped_at_line; }
+    
+    // Warning from decompressing a compressed file, such as ignored trailing data, once all lines have been read
+    std::string Decompression_Warning() { return m_reader ? m_reader->Warning() : std::string(); }
+
+    // Compatibility interface, copies all string fields out of the DRC file
     bool Next(Traffic_Event& traffic_event);
 
+    // Zero-copy interface, string fields refer into the DRC file
+    bool Next_View(Traffic_Event_View& traffic_event);
+
+    // Batched zero-copy interface, fills up to batch.Capacity() events. Returns false once no events remain.
+    bool Next_Batch(Traffic_Event_Batch& batch);
+
 protected:
-    // The following methods may modify the input data for efficiency
-    inline double Parse_DRC_Timestamp(char * timestamp);
-    inline void Parse_DRC_IP_Port(char * ip_port, std::string& ip, std::string& port);
+    // Parser with no events, for derived classes which supply their own contents
+    Traffic_Parser();
+
+    bool Parse_Next_Line(Traffic_Event_View& traffic_event);
+    bool Next_Stream_Block();
+    void Release_Stream_Blocks();
 
-    std::ifstream m_drc_file;
+    inline double Parse_DRC_Timestamp(const char * begin, const char * end);
+    inline void Parse_DRC_IP_Port(const char * begin, const char * end, uint32_t& ip, uint32_t& port);
+
+    const char * m_data;        // start of the DRC file contents
+    size_t m_size;              // size of the DRC file contents, in bytes
+    const char * m_pos;         // start of the next line to be parsed
+    const char * m_end;         // end of the range of lines to be parsed
+    bool m_mapped;              // true if m_data is a memory mapping owned by this parser
+    std::vector<char> m_buffer; // file contents, if the file could not be mapped
+
+    std::unique_ptr<Compressed_Reader> m_reader;                 // decompression thread, for compressed files
+    const Decompressed_Block * m_block;                         // block currently being parsed, for compressed files
+    std::vector<const Decompressed_Block *> m_retired_blocks;   // parsed blocks which views may still refer to
+    bool m_stream_done;                                         // true once all compressed blocks have been read
+
+    DRC_Timestamp_Decoder m_timestamp_decoder;
+    std::vector<uint64_t> m_spaces;     // bitmap of the spaces in the line being parsed
+    std::vector<uint64_t> m_separators; // bitmap of the '>' key separators in the line being parsed
+
+    bool m_following;                   // true if more lines may be appended after the current end
+    bool m_batch_stopped;               // true once Next_Batch has reached the end of the events
+    bool m_stopped_at_line;             // true once a line with no timestamp has ended the events
+    std::exception_ptr m_batch_error;   // error deferred until the events before it have been returned
+
+private:
+    // Not copyable, since views share the parser's file contents
+    Traffic_Parser(const Traffic_Parser&);
+    Traffic_Parser& operator=(const Traffic_Parser&);
+};
+
+/*
+ * Follows a DRC file which is still being written, as with tail -f. The
+ * file is kept open at the offset reached so far, and each Poll() makes
+ * the complete lines appended since the last poll available to Next_Batch.
+ * A partial line at the end of the file is held back until its newline
+ * has been written. Compressed files cannot be followed.
+ *
+ * Views returned by Next_View or Next_Batch are only valid until the next
+ * call to Poll().
+ */
+class Traffic_Follower : public Traffic_Parser
+{
+public:
+    Traffic_Follower(const char * drc_filename);
+    virtual ~Traffic_Follower();
+
+    // Read any data appended to the file. Returns the number of new bytes read.
+    size_t Poll();
+
+protected:
+    std::string m_filename;     // name of the followed file, for errors
+    int m_fd;                   // followed file, or -1 if it has not been opened yet
+    uint64_t m_offset;          // file offset up to which data has been read
 };
@@ -13,5 +13,8 @@ for send_file in $traffic_logs/send_*.drc; do
     fi
     recnode=`echo $send_file | sed -r 's/.*RECNODE-([0-9]*)_.*/\1/g'`
     for mandates_file in ${mandates}/Node${recnode}MandatedOutcomes*.json; do break; done
-    ./scoring_parser --input $send_file --input $listen_file --timestamp $start_timestamp --mandates "`cat $mandates_file`"
+    ./scoring_parser --input $send_file --input $listen_file --timestamp $start_timestamp --mandates-file $mandates_file
 done
+
+# Alternatively, score every send/listen pair within one process, with the results keyed by send filename:
+# ./scoring_parser --traffic-logs $traffic_logs --timestamp $start_timestamp --mandates-dir $mandates
@@ -0,0 +1,196 @@
+#!/usr/bin/env python
+# MIT License
+#
+# Copyright (c) 2019 Malcolm Stagg
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+# This file is a part of the CIRN Interaction Language.
+
+from __future__ import print_function
+import argparse
+import mmap
+import numpy as np
+
+# Reader for the binary columnar output of scoring_parser --output-format binary.
+# The layout is described in scoringparser/src/binary_results.h. Measurement
+# period columns are returned as numpy views into the memory-mapped file, so
+# no per-element python objects are created.
+
+BINARY_RESULTS_MAGIC = b"SC2STATS"
+BINARY_RESULTS_VERSION = 1
+
+HEADER_DTYPE = np.dtype([
+    ("magic", "S8"),
+    ("version", "<u4"),
+    ("num_tables", "<u4")
+])
+
+TABLE_HEADER_DTYPE = np.dtype([
+    ("name_size", "<u4"),
+    ("num_flows", "<u4"),
+    ("num_mps", "<u8")
+])
+
+FLOW_RECORD_DTYPE = np.dtype([
+    ("flow", "<u4"),
+    ("present", "<u4"),
+    ("max_latency", "<f8"),
+    ("on_time", "<f8"),
+    ("off_time", "<f8"),
+    ("listen_time", "<f8"),
+    ("size", "<u4"),
+    ("tos", "<u4"),
+    ("src_addr", "<u4"),
+    ("src_port", "<u4"),
+    ("dst_addr", "<u4"),
+    ("dst_port", "<u4"),
+    ("proto", "S8"),
+    ("mp_offset", "<u8"),
+    ("mp_count", "<u8")
+])
+
+# Bits of the "present" field of a flow record, with the JSON key of each flow parameter
+FLOW_FIELDS = [
+    (1 << 0, "maxLatency", "max_latency"),
+    (1 << 1, "onTime", "on_time"),
+    (1 << 2, "offTime", "off_time"),
+    (1 << 3, "listenTime", "listen_time"),
+    (1 << 4, "proto", "proto"),
+    (1 << 5, "size", "size"),
+    (1 << 6, "tos", "tos"),
+    (1 << 7, "srcAddr", "src_addr"),
+    (1 << 8, "srcPort", "src_port"),
+    (1 << 9, "dstAddr", "dst_addr"),
+    (1 << 10, "dstPort", "dst_port")
+]
+
+MP_COLUMNS = [
+    ("time", "<i4"),
+    ("sent", "<u4"),
+    ("received", "<u4"),
+    ("duplicate", "<u4"),
+    ("late", "<u4")
+]
+
+def align(offset):
+    return (offset + 7) & ~7
+
+def format_ipv4_address(address):
+    return "%d.%d.%d.%d" % ((address >> 24) & 0xff, (address >> 16) & 0xff, (address >> 8) & 0xff, address & 0xff)
+
+def measurement_period_rows(columns):
+    
+    """
+    Converts the measurement period columns of a flow returned by
+    read_tables to the list of dicts of the JSON output.
+    """
+    
+    column_names = [column_name for column_name, _ in MP_COLUMNS]
+    return [dict(zip(column_names, mp)) for mp in zip(*[columns[column_name].tolist() for column_name in column_names])]
+
+def read_tables(buf):
+    
+    """
+    Parses binary scoring results from a buffer. Returns a dict keyed by
+    table name (the send filename in batch mode, otherwise ""), of lists 
+    of flow dicts. Each flow has the same keys as in the JSON output, 
+    except that "stats" is a dict of numpy arrays of each measurement 
+    period column.
+    """
+    
+    header = np.frombuffer(buf, HEADER_DTYPE, 1, 0)[0]
+    
+    if header["magic"] != BINARY_RESULTS_MAGIC:
+        raise RuntimeError("Not a binary scoring results file!")
+    
+    if header["version"] != BINARY_RESULTS_VERSION:
+        raise RuntimeError("Unsupported binary scoring results version %d!" % header["version"])
+    
+    offset = HEADER_DTYPE.itemsize
+    tables = {}
+    
+    for _ in range(header["num_tables"]):
+        table_header = np.frombuffer(buf, TABLE_HEADER_DTYPE, 1, offset)[0]
+        offset += TABLE_HEADER_DTYPE.itemsize
+        
+        name_size = int(table_header["name_size"])
+        name = bytes(buf[offset:offset + name_size]).decode('ascii')
+        offset = align(offset + name_size)
+        
+        num_flows = int(table_header["num_flows"])
+        records = np.frombuffer(buf, FLOW_RECORD_DTYPE, num_flows, offset)
+        offset += num_flows * FLOW_RECORD_DTYPE.itemsize
+        
+        num_mps = int(table_header["num_mps"])
+        columns = {}
+        for column_name, column_type in MP_COLUMNS:
+            columns[column_name] = np.frombuffer(buf, column_type, num_mps, offset)
+            offset = align(offset + num_mps * columns[column_name].itemsize)
+        
+        flows = []
+        for record in records:
+            flow_info = {"flow": int(record["flow"])}
+            
+            for bit, key, field in FLOW_FIELDS:
+                if record["present"] & bit:
+                    flow_info[key] = record[field].item()
+            
+            if "proto" in flow_info:
+                flow_info["proto"] = flow_info["proto"].rstrip(b"\0").decode('ascii')
+            if "srcAddr" in flow_info:
+                flow_info["srcAddr"] = format_ipv4_address(flow_info["srcAddr"])
+            if "dstAddr" in flow_info:
+                flow_info["dstAddr"] = format_ipv4_address(flow_info["dstAddr"])
+            
+            mp_begin = int(record["mp_offset"])
+            mp_end = mp_begin + int(record["mp_count"])
+            flow_info["stats"] = dict((column_name, columns[column_name][mp_begin:mp_end]) for column_name, _ in MP_COLUMNS)
+            
+            flows.append(flow_info)
+            
+        tables[name] = flows
+    
+    return tables
+
+def read_file(path):
+    
+    """
+    Memory-maps a binary scoring results file and parses it with read_tables.
+    The returned arrays keep the mapping open.
+    """
+    
+    with open(path, "rb") as results_file:
+        buf = mmap.mmap(results_file.fileno(), 0, access=mmap.ACCESS_READ)
+    
+    return read_tables(buf)
+
+def run(args=None):
+    
+    parser = argparse.ArgumentParser(
+        formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+    parser.add_argument('path', help="binary scoring results path")
+    args = parser.parse_args(args)
+    
+    for name, flows in sorted(read_file(args.path).items()):
+        for flow_info in flows:
+            print("%s flow %d: %d measurement periods" % (name, flow_info["flow"], len(flow_info["stats"]["time"])))
+            
+if __name__ == '__main__':
+    run()
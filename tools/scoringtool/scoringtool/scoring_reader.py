@@ -27,11 +27,20 @@ from __future__ import print_function
 import argparse
 import subprocess
 import multiprocessing
+import multiprocessing.pool
 import json
 import glob
 import os
 import re
 from .mandate_reader import MandateReader
+from . import binary_results
+
+# The in-process parser is optional, since it needs SWIG to build. Without
+# it, each DRC file pair is parsed by a scoring_parser subprocess.
+try:
+    from . import scoring_native
+except ImportError:
+    scoring_native = None
 
 def get_script_path():
     return os.path.dirname(os.path.realpath(__file__))
@@ -59,6 +68,27 @@ def run_scoring_parser(file_info):
 
     return send_filename, json.loads(json_result.decode('ascii'))
 
+def run_native_scoring_parser(file_info):
+    send_path = file_info["send_path"]
+    listen_path = file_info["listen_path"]
+    start_timestamp = file_info["start_timestamp"]
+    mandates = file_info["mandates"]
+    
+    # Round the start timestamp as it is passed to the subprocess, so both give the same results
+    start_timestamp = float("%.6f" % start_timestamp)
+    
+    stats = scoring_native.Traffic_Stats()
+    stats.Parse_Mandates(json.dumps(mandates))
+    stats.Parse_DRC_File(send_path, start_timestamp)
+    stats.Parse_DRC_File(listen_path, start_timestamp)
+    
+    # Measurement period columns are converted to lists by read(), outside of the worker threads
+    flows = binary_results.read_tables(stats.Get_Binary())[""]
+    
+    send_filename = os.path.basename(send_path)
+    
+    return send_filename, flows
+
 class ScoringReader(object):
     
     """
@@ -105,8 +135,15 @@ class ScoringReader(object):
                 "mandates": node_mandates
             })
 
-        procs = multiprocessing.Pool()
-        for send_filename, json_result in procs.imap_unordered(run_scoring_parser, files_to_load):
+        # The native parser releases the GIL while parsing, so threads are enough
+        if scoring_native is not None:
+            procs = multiprocessing.pool.ThreadPool()
+            parse_func = run_native_scoring_parser
+        else:
+            procs = multiprocessing.Pool()
+            parse_func = run_scoring_parser
+            
+        for send_filename, json_result in procs.imap_unordered(parse_func, files_to_load):
             self.results[send_filename] = json_result
         procs.close()
         procs.join()
@@ -134,6 +171,10 @@ class ScoringReader(object):
             except StopIteration:
                 return
                 
+        # Flows parsed by scoring_native have numpy columns of measurement period statistics
+        if isinstance(next_flow_info["stats"], dict):
+            next_flow_info["stats"] = binary_results.measurement_period_rows(next_flow_info["stats"])
+            
         # Append metadata for send and receive node from the DRC filename
         next_flow_info["sendNode"] = int(
             re.search("SENDNODE-(\d+)", self.current_filename).group(1))
@@ -30,11 +30,15 @@ import subprocess
 if subprocess.call(['make', 'all']) != 0:
     raise EnvironmentError("Error calling make")
 
+# The in-process python binding is optional, since it needs SWIG
+if subprocess.call(['make', 'python']) != 0:
+    print("Could not build the scoring_native module, falling back to the scoring_parser executable")
+
 setup(
     name='scoringtool',
     #version='0.1',
     packages=['scoringtool'],
-    package_data={'scoringtool': ['scoring_parser']},
+    package_data={'scoringtool': ['scoring_parser', 'scoring_native.py', '_scoring_native*.so']},
     include_package_data=True,
     license='MIT',
     description="Tools for scoring DARPA SC2 traffic logs",
@@ -0,0 +1,372 @@
+# MIT License
+#
+# Copyright (c) 2019 Malcolm Stagg
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+# This file is a part of the CIRN Interaction Language.
+
+import json
+import os
+import struct
+import subprocess
+import time
+
+import pytest
+
+SCORING_PARSER = os.path.join(os.path.dirname(os.path.realpath(__file__)), "..", "scoringparser", "src", "scoring_parser")
+
+START_TIMESTAMP = 1556649000.0
+
+# Each chunk of a parallel parse is at least MIN_CHUNK_SIZE (4 MiB) in scoring_parser.cc
+MIN_CHUNK_SIZE = 4 * 1024 * 1024
+
+MANDATES = [{"timestamp": 0, "scenario_goals": [{"flow_uid": 5000, "requirements": {"max_latency_s": 0.5}}]}]
+
+# Packets sent per second by write_traffic_logs, which is 1024 (TRAFFIC_EVENT_BATCH_SIZE) events in about 10 seconds
+PACKET_RATE = 100
+
+
+def drc_time(offset):
+    """
+    DRC timestamp of a time offset in seconds from the match start
+    """
+    
+    seconds, microseconds = divmod(int(round(offset * 1e6)), 1000000)
+    return time.strftime("%Y-%m-%d_%H:%M:%S", time.gmtime(START_TIMESTAMP + seconds)) + ".%06d" % microseconds
+
+
+def send_line(seq):
+    return ("2019-04-30_18:30:%02d.%06d SEND proto>UDP flow>5000 seq>%09d frag>0 TOS>0 srcPort>5000 "
+            "dst>192.168.1.1/5000 size>102 gps>INVALID\n" % (seq // 1000 % 60, seq % 1000 * 1000, seq))
+
+
+def send_event_line(seq, sent):
+    return ("%s SEND proto>UDP flow>5000 seq>%d frag>0 TOS>0 srcPort>5000 dst>192.168.1.1/5000 size>102 gps>INVALID\n" %
+            (drc_time(sent), seq))
+
+
+def recv_event_line(seq, sent, received):
+    return ("%s RECV proto>UDP flow>5000 seq>%d src>10.0.0.1/5000 dst>192.168.1.1/5000 sent>%s size>102 frag>0 TOS>0 "
+            "gps>INVALID,0.0,0.0\n" % (drc_time(received), seq, drc_time(sent)))
+
+
+def write_traffic_logs(tmp_path, num_packets, latency=0.1, late_receipts={}):
+    """
+    Write a send and listen DRC file of flow 5000, sending num_packets at PACKET_RATE from the match start. Each
+    packet is received latency seconds after it was sent, or at the time given by late_receipts for its sequence
+    number. Returns the send and listen file paths.
+    """
+    
+    send_path = str(tmp_path / "send_SENDNODE-1_RECNODE-2.drc")
+    listen_path = str(tmp_path / "listen_SENDNODE-1_RECNODE-2.drc")
+    
+    with open(send_path, "w") as send_file:
+        send_file.write("%s ON flow>5000 srcPort>5000 dst>192.168.1.1/5000\n" % drc_time(0))
+        send_file.write("".join(send_event_line(seq, seq / PACKET_RATE) for seq in range(num_packets)))
+        send_file.write("%s OFF flow>5000 srcPort>5000 dst>192.168.1.1/5000\n" % drc_time(num_packets / PACKET_RATE + 0.5))
+    
+    receipts = sorted((late_receipts.get(seq, seq / PACKET_RATE + latency), seq) for seq in range(num_packets))
+    
+    with open(listen_path, "w") as listen_file:
+        listen_file.write("%s LISTEN proto>UDP port>5000\n" % drc_time(-1))
+        listen_file.write("".join(recv_event_line(seq, seq / PACKET_RATE, received) for received, seq in receipts))
+    
+    return [send_path, listen_path]
+
+
+def scoring_parser_command(drc_paths, *args):
+    command = [SCORING_PARSER, "--timestamp", "%.6f" % START_TIMESTAMP, "--mandates", json.dumps(MANDATES)]
+    
+    for drc_path in drc_paths:
+        command += ["--input", drc_path]
+    
+    return command + list(args)
+
+
+def run_scoring_parser(drc_paths, *args):
+    output = subprocess.check_output(scoring_parser_command(drc_paths, *args), stderr=subprocess.DEVNULL)
+    
+    return json.loads(output.decode('ascii'))
+
+
+def run_scoring_parser_stream(drc_paths, *args):
+    """
+    Returns the json lines written by a --stream run, and its warnings
+    """
+    
+    process = subprocess.run(scoring_parser_command(drc_paths, "--stream", *args), 
+                             stdout=subprocess.PIPE, stderr=subprocess.PIPE, check=True)
+    
+    lines = [json.loads(line) for line in process.stdout.decode('ascii').splitlines()]
+    return lines, process.stderr.decode('ascii')
+
+
+def input_sources(stats_path):
+    """
+    Source of the events of each input file, "drc" or "cache", from a --stats-file
+    """
+    
+    with open(stats_path) as stats_file:
+        return [input_file["source"] for input_file in json.load(stats_file)["files"]]
+
+
+@pytest.mark.skipif(not os.path.isfile(SCORING_PARSER), reason="scoring_parser has not been built")
+class TestChunkedParse(object):
+    def test_blank_line_at_chunk_boundary(self, tmp_path):
+        """
+        A blank line stops a parse. When it is the last line of the first chunk of a parallel parse, the
+        later chunk must not be merged, so the results are the same as a sequential parse.
+        """
+        
+        num_lines = MIN_CHUNK_SIZE // len(send_line(0)) + 1
+        first_half = "".join(send_line(seq) for seq in range(num_lines))
+        second_half = "".join(send_line(seq) for seq in range(num_lines, 2 * num_lines))
+        
+        # With a file of 2 * len(first_half) + 2 bytes, the second chunk starts just after the blank line
+        second_half = second_half[:-1] + " \n"
+        assert len(second_half) == len(first_half) + 1
+        
+        drc_path = str(tmp_path / "send_SENDNODE-1_RECNODE-2.drc")
+        with open(drc_path, "w") as drc_file:
+            drc_file.write(first_half + "\n" + second_half)
+        
+        sequential = run_scoring_parser([drc_path], "--threads", "1")
+        chunked = run_scoring_parser([drc_path], "--threads", "2")
+        
+        assert sum(mp["sent"] for mp in sequential[0]["stats"]) == num_lines
+        assert chunked == sequential
+
+
+@pytest.mark.skipif(not os.path.isfile(SCORING_PARSER), reason="scoring_parser has not been built")
+class TestCache(object):
+    def test_cache_matches_text_parse(self, tmp_path):
+        """
+        The results of a parse which writes the .cache files, and of one which reads them, are the same as a
+        parse of the DRC text.
+        """
+        
+        drc_paths = write_traffic_logs(tmp_path, 3000)
+        stats_path = str(tmp_path / "stats.json")
+        
+        text = run_scoring_parser(drc_paths)
+        
+        built = run_scoring_parser(drc_paths, "--cache", "--stats-file", stats_path)
+        assert input_sources(stats_path) == ["drc", "drc"]
+        assert all(os.path.isfile(drc_path + ".cache") for drc_path in drc_paths)
+        
+        cached = run_scoring_parser(drc_paths, "--cache", "--stats-file", stats_path)
+        assert input_sources(stats_path) == ["cache", "cache"]
+        
+        assert built == text
+        assert cached == text
+    
+    def test_stale_cache_rebuilt(self, tmp_path):
+        """
+        A cache is rebuilt from the DRC text once its source file's size or modification time changes.
+        """
+        
+        send_path, listen_path = write_traffic_logs(tmp_path, 3000)
+        stats_path = str(tmp_path / "stats.json")
+        
+        original = run_scoring_parser([send_path, listen_path], "--cache")
+        
+        # A larger send file, with one more packet
+        with open(send_path, "a") as send_file:
+            send_file.write(send_event_line(3000, 30.0))
+        
+        appended = run_scoring_parser([send_path, listen_path])
+        assert appended != original
+        
+        assert run_scoring_parser([send_path, listen_path], "--cache", "--stats-file", stats_path) == appended
+        assert input_sources(stats_path) == ["drc", "cache"]
+        
+        # A send file of the same size, with the last packet sent one period earlier and a later modification time
+        mtime_ns = os.stat(send_path).st_mtime_ns
+        
+        with open(send_path) as send_file:
+            lines = send_file.readlines()
+        
+        lines[-1] = send_event_line(3000, 29.0)
+        
+        with open(send_path, "w") as send_file:
+            send_file.write("".join(lines))
+        
+        os.utime(send_path, ns=(mtime_ns + 1000000000, mtime_ns + 1000000000))
+        
+        moved = run_scoring_parser([send_path, listen_path])
+        assert moved != appended
+        
+        assert run_scoring_parser([send_path, listen_path], "--cache", "--stats-file", stats_path) == moved
+        assert input_sources(stats_path) == ["drc", "cache"]
+        
+        assert run_scoring_parser([send_path, listen_path], "--cache", "--stats-file", stats_path) == moved
+        assert input_sources(stats_path) == ["cache", "cache"]
+    
+    def test_cache_after_blank_line(self, tmp_path):
+        """
+        A blank line stops a parse, so the cache written by it only holds the events before the blank line.
+        """
+        
+        drc_path = str(tmp_path / "send_SENDNODE-1_RECNODE-2.drc")
+        with open(drc_path, "w") as drc_file:
+            drc_file.write("".join(send_event_line(seq, seq / PACKET_RATE) for seq in range(2000)))
+            drc_file.write("\n")
+            drc_file.write("".join(send_event_line(seq, seq / PACKET_RATE) for seq in range(2000, 3000)))
+        
+        stats_path = str(tmp_path / "stats.json")
+        
+        text = run_scoring_parser([drc_path])
+        assert sum(mp["sent"] for mp in text[0]["stats"]) == 2000
+        
+        assert run_scoring_parser([drc_path], "--cache") == text
+        
+        # num_events of the DRC_Cache_Header, after its magic, version, byte order, source size and mtime
+        with open(drc_path + ".cache", "rb") as cache_file:
+            num_events = struct.unpack_from("=8sIIQqqQ", cache_file.read(48))[6]
+        
+        assert num_events == 2000
+        
+        assert run_scoring_parser([drc_path], "--cache", "--stats-file", stats_path) == text
+        assert input_sources(stats_path) == ["cache"]
+
+
+@pytest.mark.skipif(not os.path.isfile(SCORING_PARSER), reason="scoring_parser has not been built")
+class TestStream(object):
+    # Receipts of the first period's packets, 25 seconds after they were sent and well after the batch of the
+    # other receipts of that period
+    LATE_RECEIPTS = dict((seq, 25.0 + seq / 1000) for seq in range(10))
+    
+    @staticmethod
+    def concatenated_stats(lines):
+        periods = []
+        for line in lines:
+            for flow in line:
+                assert flow["flow"] == 5000
+                periods += flow["stats"]
+        
+        return periods
+    
+    def test_stream_matches_full_parse(self, tmp_path):
+        """
+        With a finalize margin beyond the latest receipt, the periods written as a stream are finalized once each,
+        in order, and match a full parse, including the late receipts.
+        """
+        
+        drc_paths = write_traffic_logs(tmp_path, 6000, late_receipts=self.LATE_RECEIPTS)
+        
+        full = run_scoring_parser(drc_paths)
+        assert full[0]["stats"][0]["late"] == 10
+        
+        lines, warnings = run_scoring_parser_stream(drc_paths, "--finalize-margin", "30")
+        
+        # Periods are finalized before the end of the stream
+        assert len(lines) > 1
+        assert self.concatenated_stats(lines) == full[0]["stats"]
+        assert "Dropped" not in warnings
+    
+    def test_stream_drops_receipts_past_horizon(self, tmp_path):
+        """
+        Without a finalize margin, the late receipts arrive after their period was finalized. They are counted
+        as dropped, with a warning, and every other period still matches a full parse.
+        """
+        
+        drc_paths = write_traffic_logs(tmp_path, 6000, late_receipts=self.LATE_RECEIPTS)
+        
+        full = run_scoring_parser(drc_paths)
+        lines, warnings = run_scoring_parser_stream(drc_paths, "--finalize-margin", "0")
+        
+        streamed = self.concatenated_stats(lines)
+        assert streamed[0] == dict(full[0]["stats"][0], late=0)
+        assert streamed[1:] == full[0]["stats"][1:]
+        
+        assert "Dropped 10 events of flow 5000 for measurement periods which were already finalized!" in warnings
+
+
+@pytest.mark.skipif(not os.path.isfile(SCORING_PARSER), reason="scoring_parser has not been built")
+class TestTimeWindow(object):
+    # Receipts of the first period's packets in a later batch of the listen file, so its blocks overlap in sent time
+    LATE_RECEIPTS = dict((seq, 25.0 + seq / 1000) for seq in range(10))
+    
+    WINDOWS = [(0, 15), (15, 42), (42, 100)]
+    
+    def run_window(self, drc_paths, window, *args):
+        return run_scoring_parser(drc_paths, "--from", str(window[0]), "--to", str(window[1]), *args)
+    
+    def test_index_matches_unindexed_window(self, tmp_path):
+        """
+        A windowed parse has the same results whether it writes an index, seeks with it, or reads the whole file.
+        """
+        
+        drc_paths = write_traffic_logs(tmp_path, 6000, late_receipts=self.LATE_RECEIPTS)
+        stats_path = str(tmp_path / "stats.json")
+        
+        for window in self.WINDOWS:
+            unindexed = self.run_window(drc_paths, window)
+            assert self.run_window(drc_paths, window, "--index") == unindexed
+            assert all(os.path.isfile(drc_path + ".index") for drc_path in drc_paths)
+            
+            assert self.run_window(drc_paths, window, "--index", "--stats-file", stats_path) == unindexed
+        
+        # Seeking for the last window skips the send file's blocks of earlier periods
+        with open(stats_path) as stats_file:
+            send_stats = json.load(stats_file)["files"][0]
+        
+        assert send_stats["bytes"] < os.path.getsize(drc_paths[0])
+    
+    def test_window_periods_match_full_parse(self, tmp_path):
+        """
+        Each window holds the same periods as a full parse over its time range, with receipts by sent time, and
+        the windows together hold every period.
+        """
+        
+        drc_paths = write_traffic_logs(tmp_path, 6000, late_receipts=self.LATE_RECEIPTS)
+        
+        full = run_scoring_parser(drc_paths)[0]["stats"]
+        assert full[0]["late"] == 10
+        
+        # The first --index run writes the index files, and the second seeks with them
+        for args in [(), ("--index",), ("--index",)]:
+            windows = []
+            
+            for window in self.WINDOWS:
+                stats = self.run_window(drc_paths, window, *args)[0]["stats"]
+                assert stats == [mp for mp in full if window[0] <= mp["time"] < window[1]]
+                windows += stats
+            
+            assert windows == full
+    
+    def test_flow_events_outside_window(self, tmp_path):
+        """
+        The ON, OFF and LISTEN events are in blocks of the index which are outside the window, which are still
+        read for the flow parameters.
+        """
+        
+        drc_paths = write_traffic_logs(tmp_path, 6000)
+        
+        full = run_scoring_parser(drc_paths)[0]
+        
+        self.run_window(drc_paths, (20, 40), "--index")
+        indexed = self.run_window(drc_paths, (20, 40), "--index")[0]
+        
+        for key in ["onTime", "offTime", "listenTime", "maxLatency", "proto", "size", "tos", "srcAddr", "srcPort",
+                    "dstAddr", "dstPort"]:
+            assert indexed[key] == full[key]
+        
+        assert [mp["time"] for mp in indexed["stats"]] == list(range(20, 40))